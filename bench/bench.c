@@ -0,0 +1,379 @@
+#include "timing.h"
+#include "renderer.h"
+#include "input.h"
+#include "scene.h"
+#include "debug.h"
+#include "jobs.h"
+#include "loader.h"
+#include "profile.h"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// drives the real scenes headless through a fixed input script and reports
+// per-stage frame times. same stages as the game loop in main.c, but with
+// exactly one simulation step per frame and no frame limiter, so two runs do
+// the same work. -k 1 also times the compositing kernels on their own first
+
+extern int LOG_VERBOSITY;
+
+#define BENCH_DEFAULT_FRAMES 600
+#define BENCH_DELTA_TIME (1.0f / TIMING_SIM_HZ)
+#define BENCH_DEVICE 0 // keyboard, always connected
+#define BENCH_FRAME_STAT STAGE_MAX // per-frame total, kept next to the stages
+#define BENCH_KERNEL_RUNS 50
+
+typedef struct {
+   ui32 frame;
+   InputEvent event;
+} BenchStep;
+
+// title -> main menu -> settings -> main menu -> solo -> arcade -> device select -> character select
+static const BenchStep bench_script[] = {
+   {  60, INPUT_A },      // title: start, device 0 becomes player 1
+   {  90, INPUT_DOWN },   // main menu: SOLO -> VERSUS
+   {  95, INPUT_DOWN },   //            VERSUS -> SETTINGS
+   { 100, INPUT_A },
+   { 130, INPUT_DOWN },   // settings: walk down to BACK
+   { 135, INPUT_DOWN },
+   { 140, INPUT_DOWN },
+   { 145, INPUT_DOWN },
+   { 150, INPUT_DOWN },
+   { 180, INPUT_A },
+   { 220, INPUT_A },      // main menu: SOLO
+   { 230, INPUT_A },      // solo: ARCADE
+   { 260, INPUT_A },      // device select: take player 1
+   { 270, INPUT_A },      //                confirm
+   { 300, INPUT_RIGHT },  // character select: look around
+   { 320, INPUT_DOWN },
+   { 340, INPUT_RIGHT },
+   { 360, INPUT_UP },
+};
+#define BENCH_SCRIPT_LENGTH (sizeof(bench_script) / sizeof(bench_script[0]))
+
+typedef struct {
+   double mean;
+   ui32 p50, p90, p99, max;
+} BenchStat;
+
+static bool g_bench_running = true;
+
+static bool handle_flags(int argc, char* argv[], ui32* frames, float* scale_factor, int* workers,
+                         bool* pipelined, bool* recording, bool* kernels, const char** json_path, const char** trace_path);
+static void time_kernels(void);
+static double elapsed_us(Uint64 start, int runs);
+static void run_script(ui32 frame, InputEvent* held);
+static BenchStat summarize(ui32* samples, ui32 count);
+static int compare_us(const void* a, const void* b);
+static const char* stat_name(int stat);
+static void print_text(const BenchStat* stats, ui32 frames, int threads, SceneType last_scene);
+static bool write_json(const char* path, const BenchStat* stats, ui32 frames, int threads, float scale_factor,
+                       bool pipelined, bool recording, SceneType last_scene);
+
+// input.c and scene.c call back into the game
+void game_escape(uint32_t timer) { (void)timer; }
+void game_shutdown(void) { g_bench_running = false; }
+
+int main(int argc, char* argv[]) {
+   ui32 frames = BENCH_DEFAULT_FRAMES;
+   float scale_factor = 1.0f;
+   int workers = JOBS_AUTO;
+   bool pipelined = false;
+   bool recording = false;
+   bool kernels = false;
+   const char* json_path = NULL;
+   const char* trace_path = NULL;
+   if (!handle_flags(argc, argv, &frames, &scale_factor, &workers, &pipelined, &recording, &kernels, &json_path, &trace_path))
+      return 1;
+
+   if (SDL_Init(SDL_INIT_GAMECONTROLLER) < 0) {
+      d_err("SDL could not initialize! SDL_Error: %s", SDL_GetError());
+      return 1;
+   }
+   timing_init(60);
+   if (!profile_init(trace_path)) return 1;
+   if (!jobs_init(workers) || !loader_init(LOADER_THREADS) || !renderer_init(scale_factor, true)) return 1;
+   int threads = jobs_get_thread_count();
+   file_wait_sheets(false); // sprites would otherwise stream in over the first frames and land in the timings
+   if (kernels) time_kernels();
+   renderer_set_pipelined(pipelined);
+   renderer_set_recording(recording);
+   input_init();
+   scene_init();
+
+   ui32* samples = malloc(sizeof(ui32) * (BENCH_FRAME_STAT + 1) * frames);
+   if (d_dne(samples)) return 1;
+
+   InputEvent held = INPUT_NONE;
+   ui32 frame = 0;
+   for (; frame < frames && g_bench_running; frame++) {
+      timing_frame_start();
+      ui64 frame_start = timing_get_time_us();
+      run_script(frame, &held);
+      loader_update();
+
+      SDL_Event e;
+      while (SDL_PollEvent(&e)) {
+         if (e.type == SDL_QUIT) g_bench_running = false;
+      }
+      input_update(BENCH_DELTA_TIME);
+      ui64 update_start = timing_get_time_us();
+      timing_record_stage(STAGE_EVENTS, (ui32)(update_start - frame_start));
+      scene_update(BENCH_DELTA_TIME);
+      timing_record_stage(STAGE_UPDATE, (ui32)(timing_get_time_us() - update_start));
+      renderer_present();
+      timing_frame_end();
+
+      for (int s = 0; s < STAGE_MAX; s++) samples[s * frames + frame] = timing_get_stage_time(s);
+      samples[BENCH_FRAME_STAT * frames + frame] = (ui32)(timing_get_time_us() - frame_start);
+   }
+   SceneType last_scene = scene_get_current();
+
+   BenchStat stats[BENCH_FRAME_STAT + 1];
+   for (int s = 0; s <= BENCH_FRAME_STAT; s++) stats[s] = summarize(&samples[s * frames], frame);
+   free(samples);
+
+   scene_destroy();
+   input_shutdown();
+   renderer_cleanup();
+   loader_cleanup();
+   jobs_cleanup();
+   profile_export();
+   profile_cleanup();
+   SDL_Quit();
+
+   print_text(stats, frame, threads, last_scene);
+   if (json_path && !write_json(json_path, stats, frame, threads, scale_factor, pipelined, recording, last_scene))
+      return 1;
+   return 0;
+}
+
+// INTERNAL
+static bool handle_flags(int argc, char* argv[], ui32* frames, float* scale_factor, int* workers,
+                         bool* pipelined, bool* recording, bool* kernels, const char** json_path, const char** trace_path) {
+   for (int i = 1; i < argc; i++) {
+      if (argv[i][0] != '-') continue;
+      char flag = argv[i][1];
+      if (i + 1 >= argc) {
+         fprintf(stderr, "Missing value for -%c\n", flag);
+         return false;
+      }
+      switch (flag) {
+      case 'n':
+         *frames = (ui32)atoi(argv[++i]);
+         break;
+      case 'l':
+         LOG_VERBOSITY = atoi(argv[++i]);
+         break;
+      case 's':
+         *scale_factor = atof(argv[++i]);
+         break;
+      case 't':
+         *workers = atoi(argv[++i]);
+         break;
+      case 'p':
+         *pipelined = atoi(argv[++i]) != 0;
+         break;
+      case 'r':
+         *recording = atoi(argv[++i]) != 0;
+         break;
+      case 'k':
+         *kernels = atoi(argv[++i]) != 0;
+         break;
+      case 'j':
+         *json_path = argv[++i]; // "-" for stdout
+         break;
+      case 'x':
+         *trace_path = argv[++i]; // profile zones as a chrome trace
+         break;
+      default:
+         fprintf(stderr, "Unknown flag: -%c\n", flag);
+         return false;
+      }
+   }
+   if (*frames == 0) *frames = BENCH_DEFAULT_FRAMES;
+   return true;
+}
+
+static void time_kernels(void) {
+   /* full frames through every supported kernel at both display resolutions, */
+   /* four layers flattened, then composite_scale() 1x-6x and the fused       */
+   /* flatten + scale, each next to what SDL takes for the same. the layer is  */
+   /* random indices with transparent runs, like the test in test/ checks     */
+   const RendererState* g_renderer = renderer_get_debug_state();
+   Uint32 format = g_renderer->composite_surface->format->format;
+   const int sizes[][2] = {
+      { GAME_WIDTH_VGA, GAME_HEIGHT_VGA },
+      { GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA }
+   };
+   CompositeKernel original = composite_get_kernel();
+
+   SDL_Surface* layer = SDL_CreateRGBSurface(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 8, 0, 0, 0, 0);
+   SDL_Surface* frame = SDL_CreateRGBSurfaceWithFormat(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 32, format);
+   if (d_dne(layer) || d_dne(frame)) goto cleanup;
+   SDL_SetPaletteColors(layer->format->palette, g_renderer->layers[g_renderer->draw_order[0]].surface->format->palette->colors, 0, PALETTE_SIZE);
+   SDL_SetColorKey(layer, SDL_TRUE, PALETTE_TRANSPARENT);
+   srand(1);
+   for (int y = 0; y < layer->h; y++) {
+      ui8* row = (ui8*)layer->pixels + y * layer->pitch;
+      for (int x = 0; x < layer->w; x++) {
+         row[x] = ((x / 24 + y / 16) % 3 == 0 || rand() % 8 == 0) ? PALETTE_TRANSPARENT : rand() % PALETTE_TRANSPARENT;
+      }
+   }
+
+   printf("%-20s %-22s %10s   (us)\n", "kernel", "work", "mean");
+   for (int s = 0; s < 2; s++) {
+      Rect src_rect = { 0, 0, sizes[s][0], sizes[s][1] };
+      char work[32];
+      Uint64 start = SDL_GetPerformanceCounter();
+      for (int r = 0; r < BENCH_KERNEL_RUNS; r++) {
+         SDL_Rect dest_rect = src_rect;
+         SDL_BlitSurface(layer, &src_rect, frame, &dest_rect);
+      }
+      snprintf(work, sizeof(work), "%dx%d", sizes[s][0], sizes[s][1]);
+      printf("%-20s %-22s %10.1f\n", "SDL_BlitSurface", work, elapsed_us(start, BENCH_KERNEL_RUNS));
+
+      for (int k = 0; k < COMPOSITE_MAX; k++) {
+         if (!composite_set_kernel(k)) continue;
+         start = SDL_GetPerformanceCounter();
+         for (int r = 0; r < BENCH_KERNEL_RUNS; r++) composite_blit(layer, src_rect, frame, 0, 0, 255);
+         printf("%-20s %-22s %10.1f\n", d_name_composite_kernel(k), work, elapsed_us(start, BENCH_KERNEL_RUNS));
+
+         // four stacked layers, like character select
+         CompositeSource sources[] = { { .surface = layer }, { .surface = layer }, { .surface = layer }, { .surface = layer } };
+         start = SDL_GetPerformanceCounter();
+         for (int r = 0; r < BENCH_KERNEL_RUNS; r++) composite_flatten(sources, 4, frame, src_rect);
+         snprintf(work, sizeof(work), "%dx%d flatten x4", sizes[s][0], sizes[s][1]);
+         printf("%-20s %-22s %10.1f\n", d_name_composite_kernel(k), work, elapsed_us(start, BENCH_KERNEL_RUNS));
+         snprintf(work, sizeof(work), "%dx%d", sizes[s][0], sizes[s][1]);
+      }
+   }
+
+   // upscaling the last flatten, and the fused version of flattening then scaling
+   const float scales[] = { 1.0f, 2.0f, 2.5f, 3.0f, 4.0f, 5.0f, 6.0f };
+   const int runs = BENCH_KERNEL_RUNS / 5;
+   CompositeSource sources[] = {
+      { .fill = { 0, 0, frame->w, frame->h }, .fill_index = 4 },
+      { .surface = layer }, { .surface = layer, .x = 5, .y = 3 }, { .surface = layer, .x = -9 }, { .surface = layer, .y = 11 }
+   };
+   int source_count = sizeof(sources) / sizeof(sources[0]);
+   for (ui32 i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+      int w = (int)(frame->w * scales[i]);
+      int h = (int)(frame->h * scales[i]);
+      SDL_Surface* scaled = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, format);
+      if (d_dne(scaled)) break;
+      char work[32];
+      snprintf(work, sizeof(work), "scale x%.1f", scales[i]);
+      Uint64 start = SDL_GetPerformanceCounter();
+      for (int r = 0; r < runs; r++) SDL_BlitScaled(frame, NULL, scaled, NULL);
+      printf("%-20s %-22s %10.1f\n", "SDL_BlitScaled", work, elapsed_us(start, runs));
+
+      for (int k = 0; k < COMPOSITE_MAX; k++) {
+         if (!composite_set_kernel(k)) continue;
+         start = SDL_GetPerformanceCounter();
+         for (int r = 0; r < runs; r++) composite_scale(frame, scaled, (Rect){ 0, 0, w, h });
+         snprintf(work, sizeof(work), "scale x%.1f", scales[i]);
+         printf("%-20s %-22s %10.1f\n", d_name_composite_kernel(k), work, elapsed_us(start, runs));
+
+         start = SDL_GetPerformanceCounter();
+         for (int r = 0; r < runs; r++) {
+            composite_flatten(sources, source_count, frame, (Rect){ 0, 0, frame->w, frame->h });
+            composite_scale(frame, scaled, (Rect){ 0, 0, w, h });
+         }
+         snprintf(work, sizeof(work), "flatten + scale x%.1f", scales[i]);
+         printf("%-20s %-22s %10.1f\n", d_name_composite_kernel(k), work, elapsed_us(start, runs));
+
+         start = SDL_GetPerformanceCounter();
+         for (int r = 0; r < runs; r++) {
+            composite_flatten_scaled(sources, source_count, frame->w, frame->h, scaled, (Rect){ 0, 0, w, h });
+         }
+         snprintf(work, sizeof(work), "fused x%.1f", scales[i]);
+         printf("%-20s %-22s %10.1f\n", d_name_composite_kernel(k), work, elapsed_us(start, runs));
+      }
+      SDL_FreeSurface(scaled);
+   }
+
+cleanup:
+   composite_set_kernel(original);
+   if (layer) SDL_FreeSurface(layer);
+   if (frame) SDL_FreeSurface(frame);
+}
+
+static double elapsed_us(Uint64 start, int runs) {
+   return (double)(SDL_GetPerformanceCounter() - start) * 1000000.0 / SDL_GetPerformanceFrequency() / runs;
+}
+
+static void run_script(ui32 frame, InputEvent* held) {
+   // each step is pressed for one frame, then let go so the next one is a fresh press
+   if (*held != INPUT_NONE) {
+      input_inject(*held, BENCH_DEVICE, false);
+      *held = INPUT_NONE;
+   }
+   for (ui32 i = 0; i < BENCH_SCRIPT_LENGTH; i++) {
+      if (bench_script[i].frame != frame) continue;
+      input_inject(bench_script[i].event, BENCH_DEVICE, true);
+      *held = bench_script[i].event;
+      d_logv(2, "bench frame %u: %s", frame, d_name_input_event(bench_script[i].event));
+   }
+}
+
+static BenchStat summarize(ui32* samples, ui32 count) {
+   // sorts samples in place
+   BenchStat stat = { 0 };
+   if (count == 0) return stat;
+   qsort(samples, count, sizeof(ui32), compare_us);
+   double total = 0;
+   for (ui32 i = 0; i < count; i++) total += samples[i];
+   stat.mean = total / count;
+   stat.p50 = samples[(count - 1) * 50 / 100];
+   stat.p90 = samples[(count - 1) * 90 / 100];
+   stat.p99 = samples[(count - 1) * 99 / 100];
+   stat.max = samples[count - 1];
+   return stat;
+}
+
+static int compare_us(const void* a, const void* b) {
+   ui32 ua = *(const ui32*)a;
+   ui32 ub = *(const ui32*)b;
+   return (ua > ub) - (ua < ub);
+}
+
+static const char* stat_name(int stat) {
+   return (stat == BENCH_FRAME_STAT) ? "FRAME" : d_name_frame_stage(stat);
+}
+
+static void print_text(const BenchStat* stats, ui32 frames, int threads, SceneType last_scene) {
+   printf("bench: %u frames headless, %d threads, ended on %s\n", frames, threads, d_name_scene_type(last_scene));
+   printf("%-20s %10s %8s %8s %8s %8s   (us)\n", "stage", "mean", "p50", "p90", "p99", "max");
+   for (int s = 0; s <= BENCH_FRAME_STAT; s++) {
+      printf("%-20s %10.1f %8u %8u %8u %8u\n", stat_name(s),
+             stats[s].mean, stats[s].p50, stats[s].p90, stats[s].p99, stats[s].max);
+   }
+}
+
+static bool write_json(const char* path, const BenchStat* stats, ui32 frames, int threads, float scale_factor,
+                       bool pipelined, bool recording, SceneType last_scene) {
+   FILE* file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+   if (!file) {
+      d_err("couldn't open %s for the bench results", path);
+      return false;
+   }
+   fprintf(file, "{\n");
+   fprintf(file, "  \"frames\": %u,\n", frames);
+   fprintf(file, "  \"scale\": %.2f,\n", scale_factor);
+   fprintf(file, "  \"threads\": %d,\n", threads);
+   fprintf(file, "  \"pipelined\": %s,\n", pipelined ? "true" : "false");
+   fprintf(file, "  \"recording\": %s,\n", recording ? "true" : "false");
+   fprintf(file, "  \"last_scene\": \"%s\",\n", d_name_scene_type(last_scene));
+   fprintf(file, "  \"unit\": \"us\",\n");
+   fprintf(file, "  \"stages\": {\n");
+   for (int s = 0; s <= BENCH_FRAME_STAT; s++) {
+      fprintf(file, "    \"%s\": { \"mean\": %.1f, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u }%s\n",
+              stat_name(s), stats[s].mean, stats[s].p50, stats[s].p90, stats[s].p99, stats[s].max,
+              (s < BENCH_FRAME_STAT) ? "," : "");
+   }
+   fprintf(file, "  }\n}\n");
+   if (file != stdout) fclose(file);
+   return true;
+}
@@ -0,0 +1,207 @@
+#include "bundle.h"
+#include "renderer.h" // for palette
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static ui32 hash_key(const char* key);
+static const char* entry_key(const BundleEntry* entry);
+static ui32 index_size_for(ui32 count);
+static size_t align_up(size_t offset);
+static bool check_entry(const Bundle* bundle, const BundleEntry* entry);
+
+bool bundle_open(Bundle* bundle, const char* path) {
+   memset(bundle, 0, sizeof(*bundle));
+   MappedFile* file = &bundle->file;
+   if (!file_map(path, file)) return false;
+
+   const BundleHeader* header = (const BundleHeader*)file->bytes;
+   if (file->size < sizeof(BundleHeader) || memcmp(header->magic, BUNDLE_MAGIC, 4) != 0) {
+      d_err("%s is not a bundle", path);
+      goto fail;
+   }
+   if (header->version != BUNDLE_VERSION) {
+      d_log("%s is version %u, this build reads %u. run make bundle", path, header->version, BUNDLE_VERSION);
+      goto fail;
+   }
+   if (header->palette_checksum != bundle_palette_checksum()) {
+      d_log("%s was packed with another palette. run make bundle", path);
+      goto fail;
+   }
+   size_t table_size = sizeof(BundleEntry) * header->entry_count + sizeof(ui32) * header->index_size;
+   if (header->entry_count == 0 || header->index_size == 0 || (header->index_size & (header->index_size - 1)) != 0 ||
+       header->index_size < header->entry_count || table_size > file->size - sizeof(BundleHeader)) {
+      d_err("%s has a broken header", path);
+      goto fail;
+   }
+   if (bundle_checksum(file->bytes + sizeof(BundleHeader), table_size) != header->table_checksum) {
+      d_err("%s has a bad table checksum", path);
+      goto fail;
+   }
+
+   bundle->header = header;
+   bundle->entries = (const BundleEntry*)(file->bytes + sizeof(BundleHeader));
+   bundle->index = (const ui32*)(bundle->entries + header->entry_count);
+   for (ui32 i = 0; i < header->entry_count; i++) {
+      if (!check_entry(bundle, &bundle->entries[i])) {
+         d_err("%s: entry %u points outside the file", path, i);
+         goto fail;
+      }
+   }
+   d_logv(2, "opened %s, %u sheets in %zu bytes", path, header->entry_count, file->size);
+   return true;
+
+fail:
+   bundle_close(bundle);
+   return false;
+}
+
+void bundle_close(Bundle* bundle) {
+   file_unmap(&bundle->file);
+   memset(bundle, 0, sizeof(*bundle));
+}
+
+const BundleEntry* bundle_find(const Bundle* bundle, BundleType type, const char* key) {
+   if (!bundle->header || !key) return NULL;
+   ui32 mask = bundle->header->index_size - 1;
+   for (ui32 slot = hash_key(key) & mask, probes = 0; probes <= mask; slot = (slot + 1) & mask, probes++) {
+      ui32 entry = bundle->index[slot];
+      if (entry == 0 || entry > bundle->header->entry_count) return NULL;
+      const BundleEntry* candidate = &bundle->entries[entry - 1];
+      if (candidate->type == type && strcmp(entry_key(candidate), key) == 0) return candidate;
+   }
+   return NULL;
+}
+
+ImageData* bundle_get_image(const Bundle* bundle, const BundleEntry* entry) {
+   // the mapping is read only, nothing writes to sheet pixels after loading
+   return (ImageData*)(bundle->file.bytes + entry->image_offset);
+}
+
+bool bundle_verify_entry(const Bundle* bundle, const BundleEntry* entry) {
+   return bundle_checksum(bundle->file.bytes + entry->image_offset, entry->image_size) == entry->checksum;
+}
+
+bool bundle_owns(const Bundle* bundle, const void* pointer) {
+   const ui8* bytes = bundle->file.bytes;
+   return bytes && (const ui8*)pointer >= bytes && (const ui8*)pointer < bytes + bundle->file.size;
+}
+
+bool bundle_write(const char* path, const BundleSource* sources, ui32 count) {
+   ui32 index_size = index_size_for(count);
+   size_t table_size = sizeof(BundleEntry) * count + sizeof(ui32) * index_size;
+   size_t offset = align_up(sizeof(BundleHeader) + table_size);
+
+   BundleHeader header = { 0 };
+   memcpy(header.magic, BUNDLE_MAGIC, 4);
+   header.version = BUNDLE_VERSION;
+   header.palette_checksum = bundle_palette_checksum();
+   header.entry_count = count;
+   header.index_size = index_size;
+
+   ui8* table = calloc(1, table_size);
+   if (d_dne(table)) return false;
+   BundleEntry* entries = (BundleEntry*)table;
+   ui32* index = (ui32*)(entries + count);
+   for (ui32 i = 0; i < count; i++) {
+      const BundleSource* source = &sources[i];
+      BundleEntry* entry = &entries[i];
+      if (strlen(source->fname) >= BUNDLE_NAME_MAX || strlen(source->name) >= BUNDLE_NAME_MAX) {
+         d_err("%s: name is too long for a bundle", source->fname);
+         free(table);
+         return false;
+      }
+      strcpy(entry->fname, source->fname);
+      strcpy(entry->name, source->name);
+      entry->type = source->type;
+      entry->tile_w = source->tile_w;
+      entry->tile_h = source->tile_h;
+      entry->image_offset = (ui32)offset;
+      entry->image_size = (ui32)(sizeof(ImageData) + source->image->size);
+      entry->checksum = bundle_checksum(source->image, entry->image_size);
+      offset = align_up(offset + entry->image_size);
+
+      ui32 slot = hash_key(entry_key(entry)) & (index_size - 1);
+      while (index[slot] != 0) {
+         const BundleEntry* other = &entries[index[slot] - 1];
+         if (other->type == entry->type && strcmp(entry_key(other), entry_key(entry)) == 0) {
+            d_err("%s and %s would both be found as %s", other->fname, entry->fname, entry_key(entry));
+            free(table);
+            return false;
+         }
+         slot = (slot + 1) & (index_size - 1);
+      }
+      index[slot] = i + 1;
+   }
+   header.table_checksum = bundle_checksum(table, table_size);
+
+   FILE* file = fopen(path, "wb");
+   if (!file) {
+      d_err("couldn't open %s for writing", path);
+      free(table);
+      return false;
+   }
+   static const ui8 padding[BUNDLE_ALIGN] = { 0 };
+   bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(table, table_size, 1, file) == 1;
+   size_t position = sizeof(header) + table_size;
+   for (ui32 i = 0; i < count && written; i++) {
+      size_t pad = entries[i].image_offset - position;
+      written = (pad == 0 || fwrite(padding, pad, 1, file) == 1) &&
+                fwrite(sources[i].image, entries[i].image_size, 1, file) == 1;
+      position = entries[i].image_offset + entries[i].image_size;
+   }
+   written = (fclose(file) == 0) && written;
+   free(table);
+   if (!written) d_err("couldn't write %s", path);
+   return written;
+}
+
+ui32 bundle_checksum(const void* bytes, size_t size) {
+   // fnv-1a, good enough to catch a truncated or hand-edited bundle
+   const ui8* data = bytes;
+   ui32 hash = 2166136261u;
+   for (size_t i = 0; i < size; i++) {
+      hash ^= data[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+ui32 bundle_palette_checksum(void) {
+   return bundle_checksum(palette, sizeof(palette));
+}
+
+// INTERNAL
+static ui32 hash_key(const char* key) {
+   return bundle_checksum(key, strlen(key));
+}
+
+static const char* entry_key(const BundleEntry* entry) {
+   // fonts are asked for by FontType, which maps to a file name
+   return (entry->type == BUNDLE_FONT) ? entry->fname : entry->name;
+}
+
+static ui32 index_size_for(ui32 count) {
+   // at most half full, so probes stay short
+   ui32 size = 8;
+   while (size < count * 2) size *= 2;
+   return size;
+}
+
+static size_t align_up(size_t offset) {
+   return (offset + BUNDLE_ALIGN - 1) & ~(size_t)(BUNDLE_ALIGN - 1);
+}
+
+static bool check_entry(const Bundle* bundle, const BundleEntry* entry) {
+   // everything an entry points at has to be inside the file and add up
+   size_t size = bundle->file.size;
+   if (entry->image_offset % BUNDLE_ALIGN != 0 || entry->image_size < sizeof(ImageData) ||
+       entry->image_offset > size || entry->image_size > size - entry->image_offset) return false;
+   if (memchr(entry->fname, '\0', BUNDLE_NAME_MAX) == NULL || memchr(entry->name, '\0', BUNDLE_NAME_MAX) == NULL)
+      return false;
+   const ImageData* image = bundle_get_image(bundle, entry);
+   return image->width > 0 && image->height > 0 && entry->tile_w > 0 && entry->tile_h > 0 &&
+          image->size == (ui32)image->width * (ui32)image->height &&
+          image->size == entry->image_size - sizeof(ImageData);
+}
@@ -0,0 +1,687 @@
+#include "composite.h"
+#include "debug.h"
+#include "jobs.h"
+#include "timing.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   #define COMPOSITE_X86
+   #include <immintrin.h>
+#endif
+
+typedef struct {
+   ui8* indices;           // one scanline of resolved indices
+   int index_capacity;
+   ui32* colors;           // the same scanline in colors, for composite_flatten_scaled()
+   int color_capacity;
+} CompositeScratch;
+
+static struct {
+   CompositeKernel kernel;
+   CompositeRowFunc row;
+   CompositeMergeFunc merge;
+   ui32 lut[256];          // full byte range so stray indices can't read past the palette
+   ui8 transparent_index;
+   CompositeScratch scratch[JOBS_MAX_THREADS]; // one per job thread so bands can run in parallel
+   ui32* scale_columns;    // dst x -> src x, rebuilt when either width changes
+   int scale_src_w, scale_dst_w;
+
+   // composite_run_bands(), main thread only
+   const Rect* band_rects;
+   int band_rect_count;
+   Rect band_bounds;       // union of band_rects
+   CompositeBandFunc band_func;
+   void* band_data;
+   ui32* band_times;       // us per band
+   int band_capacity;
+} g_composite = { 0 };
+
+static void composite_row_scalar(ui32* dst, const ui8* src, int count, ui8 opacity);
+static void composite_merge_scalar(ui8* dst, const ui8* src, int count);
+#ifdef COMPOSITE_X86
+static void composite_row_sse2(ui32* dst, const ui8* src, int count, ui8 opacity);
+static void composite_row_avx2(ui32* dst, const ui8* src, int count, ui8 opacity);
+static void composite_merge_sse2(ui8* dst, const ui8* src, int count);
+static void composite_merge_avx2(ui8* dst, const ui8* src, int count);
+#endif
+static inline ui32 blend_pixel(ui32 src, ui32 dst, ui8 alpha);
+static bool reserve_rows(int index_count, int color_count);
+static void resolve_row(const CompositeSource* sources, int count, int y, int x0, int x1, ui8* row);
+static bool build_scale_columns(int src_w, int dst_w);
+static void run_band(int index, void* data);
+static void scale_row_columns(ui32* dst, const ui32* src, const ui32* columns, int count, ui32 src_x0);
+static void scale_row_whole(ui32* dst, const ui32* src, int dst_x, int count, int factor);
+#ifdef COMPOSITE_X86
+static void scale_row_whole_sse2(ui32* dst, const ui32* src, int dst_x, int count, int factor);
+#endif
+
+void composite_init(void) {
+   g_composite.transparent_index = PALETTE_TRANSPARENT;
+
+   if (composite_kernel_supported(COMPOSITE_AVX2)) composite_set_kernel(COMPOSITE_AVX2);
+   else if (composite_kernel_supported(COMPOSITE_SSE2)) composite_set_kernel(COMPOSITE_SSE2);
+   else composite_set_kernel(COMPOSITE_SCALAR);
+
+   d_logv(2, "composite kernel: %s", d_name_composite_kernel(g_composite.kernel));
+}
+
+void composite_cleanup(void) {
+   for (int i = 0; i < JOBS_MAX_THREADS; i++) {
+      SAFE_FREE(g_composite.scratch[i].indices);
+      SAFE_FREE(g_composite.scratch[i].colors);
+      g_composite.scratch[i].index_capacity = 0;
+      g_composite.scratch[i].color_capacity = 0;
+   }
+   SAFE_FREE(g_composite.band_times);
+   g_composite.band_capacity = 0;
+   free(g_composite.scale_columns);
+   g_composite.scale_columns = NULL;
+   g_composite.scale_src_w = g_composite.scale_dst_w = 0;
+}
+
+void composite_set_palette(const ui32* colors, int count, ui8 transparent_index) {
+   memset(g_composite.lut, 0, sizeof(g_composite.lut));
+   for (int i = 0; i < count && i < 256; i++) {
+      g_composite.lut[i] = colors[i];
+   }
+   g_composite.transparent_index = transparent_index;
+}
+
+bool composite_set_kernel(CompositeKernel kernel) {
+   if (!composite_kernel_supported(kernel)) return false;
+
+   switch (kernel) {
+#ifdef COMPOSITE_X86
+   case COMPOSITE_SSE2:
+      g_composite.row = composite_row_sse2;
+      g_composite.merge = composite_merge_sse2;
+      break;
+   case COMPOSITE_AVX2:
+      g_composite.row = composite_row_avx2;
+      g_composite.merge = composite_merge_avx2;
+      break;
+#endif
+   default:
+      kernel = COMPOSITE_SCALAR;
+      g_composite.row = composite_row_scalar;
+      g_composite.merge = composite_merge_scalar;
+   }
+   g_composite.kernel = kernel;
+   return true;
+}
+
+CompositeKernel composite_get_kernel(void) {
+   return g_composite.kernel;
+}
+
+bool composite_kernel_supported(CompositeKernel kernel) {
+   switch (kernel) {
+   case COMPOSITE_SCALAR:
+      return true;
+#ifdef COMPOSITE_X86
+   case COMPOSITE_SSE2:
+      return SDL_HasSSE2();
+   case COMPOSITE_AVX2:
+      return SDL_HasAVX2();
+#endif
+   default:
+      return false;
+   }
+}
+
+void composite_blit(SDL_Surface* src, Rect src_rect, SDL_Surface* dst, int dst_x, int dst_y, ui8 opacity) {
+   if (!g_composite.row) composite_init();
+
+   if (dst->format->BytesPerPixel != 4 || src->format->BytesPerPixel != 1) {
+      Rect dest_rect = { dst_x, dst_y, src_rect.w, src_rect.h };
+      SDL_SetSurfaceAlphaMod(src, opacity);
+      SDL_BlitSurface(src, &src_rect, dst, &dest_rect);
+      return;
+   }
+
+   // clip to source
+   if (src_rect.x < 0) { dst_x -= src_rect.x; src_rect.w += src_rect.x; src_rect.x = 0; }
+   if (src_rect.y < 0) { dst_y -= src_rect.y; src_rect.h += src_rect.y; src_rect.y = 0; }
+   if (src_rect.x + src_rect.w > src->w) src_rect.w = src->w - src_rect.x;
+   if (src_rect.y + src_rect.h > src->h) src_rect.h = src->h - src_rect.y;
+
+   // clip to destination
+   if (dst_x < 0) { src_rect.x -= dst_x; src_rect.w += dst_x; dst_x = 0; }
+   if (dst_y < 0) { src_rect.y -= dst_y; src_rect.h += dst_y; dst_y = 0; }
+   if (dst_x + src_rect.w > dst->w) src_rect.w = dst->w - dst_x;
+   if (dst_y + src_rect.h > dst->h) src_rect.h = dst->h - dst_y;
+
+   if (src_rect.w <= 0 || src_rect.h <= 0) return;
+
+   const ui8* src_row = (const ui8*)src->pixels + src_rect.y * src->pitch + src_rect.x;
+   ui8* dst_row = (ui8*)dst->pixels + dst_y * dst->pitch + dst_x * 4;
+   for (int y = 0; y < src_rect.h; y++) {
+      g_composite.row((ui32*)dst_row, src_row, src_rect.w, opacity);
+      src_row += src->pitch;
+      dst_row += dst->pitch;
+   }
+}
+
+void composite_row(ui32* dst, const ui8* src, int count, ui8 opacity) {
+   if (!g_composite.row) composite_init();
+   g_composite.row(dst, src, count, opacity);
+}
+
+void composite_merge(ui8* dst, const ui8* src, int count) {
+   if (!g_composite.merge) composite_init();
+   g_composite.merge(dst, src, count);
+}
+
+void composite_flatten(const CompositeSource* sources, int count, SDL_Surface* dst, Rect rect) {
+   if (!g_composite.row) composite_init();
+   if (count <= 0) return;
+
+   // clip rect to dst
+   int x0 = rect.x < 0 ? 0 : rect.x;
+   int y0 = rect.y < 0 ? 0 : rect.y;
+   int x1 = rect.x + rect.w > dst->w ? dst->w : rect.x + rect.w;
+   int y1 = rect.y + rect.h > dst->h ? dst->h : rect.y + rect.h;
+   if (x1 <= x0 || y1 <= y0) return;
+   int width = x1 - x0;
+
+   if (dst->format->BytesPerPixel != 4) {
+      // no fast path, blit the layers one by one like before
+      for (int i = 0; i < count; i++) {
+         const CompositeSource* source = &sources[i];
+         if (!source->surface) {
+            Rect fill;
+            if (SDL_IntersectRect(&source->fill, &rect, &fill)) {
+               SDL_FillRect(dst, &fill, g_composite.lut[source->fill_index]);
+            }
+            continue;
+         }
+         Rect src_rect = { x0 - source->x, y0 - source->y, width, y1 - y0 };
+         composite_blit(source->surface, src_rect, dst, x0, y0, 255);
+      }
+      return;
+   }
+
+   if (!reserve_rows(width, 0)) return;
+   ui8* row = g_composite.scratch[jobs_get_thread_index()].indices;
+
+   ui8* dst_row = (ui8*)dst->pixels + y0 * dst->pitch + x0 * 4;
+   for (int y = y0; y < y1; y++, dst_row += dst->pitch) {
+      resolve_row(sources, count, y, x0, x1, row);
+      g_composite.row((ui32*)dst_row, row, width, 255);
+   }
+}
+
+bool composite_flatten_scaled(const CompositeSource* sources, int count, int src_w, int src_h,
+                              SDL_Surface* dst, Rect dst_rect) {
+   if (!g_composite.row) composite_init();
+   if (dst->format->BytesPerPixel != 4 || src_w <= 0 || src_h <= 0) return false;
+
+   // clip to dst
+   int x0 = dst_rect.x < 0 ? 0 : dst_rect.x;
+   int y0 = dst_rect.y < 0 ? 0 : dst_rect.y;
+   int x1 = dst_rect.x + dst_rect.w > dst->w ? dst->w : dst_rect.x + dst_rect.w;
+   int y1 = dst_rect.y + dst_rect.h > dst->h ? dst->h : dst_rect.y + dst_rect.h;
+   if (x1 <= x0 || y1 <= y0) return true;
+   int width = x1 - x0;
+
+   // src columns this rect touches, same mapping as composite_scale()
+   int src_x0 = (int)((ui64)x0 * src_w / dst->w);
+   int src_x1 = (int)((ui64)(x1 - 1) * src_w / dst->w) + 1;
+   int src_width = src_x1 - src_x0;
+
+   int factor = (dst->w % src_w == 0) ? dst->w / src_w : 0; // 0 = fractional
+   if (!factor && !build_scale_columns(src_w, dst->w)) return false;
+   if (!reserve_rows(src_width, src_width)) return false;
+   ui8* row = g_composite.scratch[jobs_get_thread_index()].indices;
+   ui32* colors = g_composite.scratch[jobs_get_thread_index()].colors;
+
+   int last_src_y = -1;
+   ui8* last_row = NULL;
+   ui8* dst_row = (ui8*)dst->pixels + y0 * dst->pitch + x0 * 4;
+   for (int y = y0; y < y1; y++, dst_row += dst->pitch) {
+      int src_y = (int)((ui64)y * src_h / dst->h);
+      if (src_y == last_src_y) {
+         memcpy(dst_row, last_row, width * 4);
+         continue;
+      }
+
+      // one src scanline of indices -> one of colors (stays in cache) -> scaled dst row
+      resolve_row(sources, count, src_y, src_x0, src_x1, row);
+      g_composite.row(colors, row, src_width, 255);
+
+      if (!factor) {
+         scale_row_columns((ui32*)dst_row, colors, g_composite.scale_columns + x0, width, src_x0);
+      }
+#ifdef COMPOSITE_X86
+      else if (g_composite.kernel != COMPOSITE_SCALAR) {
+         scale_row_whole_sse2((ui32*)dst_row, colors, x0 - src_x0 * factor, width, factor);
+      }
+#endif
+      else {
+         scale_row_whole((ui32*)dst_row, colors, x0 - src_x0 * factor, width, factor);
+      }
+      last_src_y = src_y;
+      last_row = dst_row;
+   }
+   return true;
+}
+
+void composite_scale(SDL_Surface* src, SDL_Surface* dst, Rect dst_rect) {
+   if (!g_composite.row) composite_init();
+
+   if (src->format->BytesPerPixel != 4 || dst->format->BytesPerPixel != 4 ||
+       src->format->format != dst->format->format) {
+      SDL_BlitScaled(src, NULL, dst, NULL); // can't do part of it without matching SDL's stepping
+      return;
+   }
+
+   // clip to dst
+   int x0 = dst_rect.x < 0 ? 0 : dst_rect.x;
+   int y0 = dst_rect.y < 0 ? 0 : dst_rect.y;
+   int x1 = dst_rect.x + dst_rect.w > dst->w ? dst->w : dst_rect.x + dst_rect.w;
+   int y1 = dst_rect.y + dst_rect.h > dst->h ? dst->h : dst_rect.y + dst_rect.h;
+   if (x1 <= x0 || y1 <= y0 || src->w <= 0 || src->h <= 0) return;
+   int width = x1 - x0;
+
+   int factor = (dst->w % src->w == 0) ? dst->w / src->w : 0; // 0 = fractional
+   if (!factor && !build_scale_columns(src->w, dst->w)) {
+      SDL_BlitScaled(src, NULL, dst, NULL);
+      return;
+   }
+
+   int last_src_y = -1;
+   ui8* last_row = NULL;
+   ui8* dst_row = (ui8*)dst->pixels + y0 * dst->pitch + x0 * 4;
+   for (int y = y0; y < y1; y++, dst_row += dst->pitch) {
+      int src_y = (int)((ui64)y * src->h / dst->h);
+      if (src_y == last_src_y) {
+         memcpy(dst_row, last_row, width * 4);
+         continue;
+      }
+
+      const ui32* src_row = (const ui32*)((const ui8*)src->pixels + src_y * src->pitch);
+      if (!factor) {
+         scale_row_columns((ui32*)dst_row, src_row, g_composite.scale_columns + x0, width, 0);
+      }
+#ifdef COMPOSITE_X86
+      else if (g_composite.kernel != COMPOSITE_SCALAR) {
+         scale_row_whole_sse2((ui32*)dst_row, src_row, x0, width, factor);
+      }
+#endif
+      else {
+         scale_row_whole((ui32*)dst_row, src_row, x0, width, factor);
+      }
+      last_src_y = src_y;
+      last_row = dst_row;
+   }
+}
+
+bool composite_prepare_scale(int src_w, int dst_w) {
+   if (src_w <= 0 || dst_w <= 0) return false;
+   if (dst_w % src_w == 0) return true; // whole number scales don't use the table
+   return build_scale_columns(src_w, dst_w);
+}
+
+void composite_run_bands(const Rect* rects, int count, CompositeBandFunc func, void* data) {
+   Rect bounds = { 0 };
+   for (int i = 0; i < count; i++) {
+      if (rects[i].w <= 0 || rects[i].h <= 0) continue;
+      if (bounds.w == 0) bounds = rects[i];
+      else SDL_UnionRect(&bounds, &rects[i], &bounds);
+   }
+   if (bounds.w <= 0 || bounds.h <= 0) return;
+
+   int band_count = (bounds.h + COMPOSITE_BAND_HEIGHT - 1) / COMPOSITE_BAND_HEIGHT;
+   if (band_count > g_composite.band_capacity) {
+      ui32* times = realloc(g_composite.band_times, sizeof(ui32) * band_count);
+      if (d_dne(times)) return;
+      g_composite.band_times = times;
+      g_composite.band_capacity = band_count;
+   }
+
+   g_composite.band_rects = rects;
+   g_composite.band_rect_count = count;
+   g_composite.band_bounds = bounds;
+   g_composite.band_func = func;
+   g_composite.band_data = data;
+   jobs_run(run_band, NULL, band_count);
+   timing_add_band_times(g_composite.band_times, band_count);
+}
+
+// INTERNAL
+static void run_band(int index, void* data) {
+   (void)data;
+   Uint64 start = SDL_GetPerformanceCounter();
+
+   Rect band = g_composite.band_bounds;
+   band.y += index * COMPOSITE_BAND_HEIGHT;
+   band.h = COMPOSITE_BAND_HEIGHT;
+   for (int i = 0; i < g_composite.band_rect_count; i++) {
+      Rect rect;
+      if (SDL_IntersectRect(&g_composite.band_rects[i], &band, &rect)) {
+         g_composite.band_func(rect, g_composite.band_data);
+      }
+   }
+
+   Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+   g_composite.band_times[index] = (ui32)(elapsed * 1000000 / SDL_GetPerformanceFrequency());
+}
+
+static inline ui32 blend_pixel(ui32 src, ui32 dst, ui8 alpha) {
+   // per channel round(src * a + dst * (255 - a)) / 255, same math as the simd paths
+   ui32 out = 0;
+   for (int shift = 0; shift < 32; shift += 8) {
+      ui32 t = ((src >> shift) & 0xFF) * alpha + ((dst >> shift) & 0xFF) * (255 - alpha) + 128;
+      out |= (((t + (t >> 8)) >> 8) & 0xFF) << shift;
+   }
+   return out;
+}
+
+static void composite_row_scalar(ui32* dst, const ui8* src, int count, ui8 opacity) {
+   const ui32* lut = g_composite.lut;
+   ui8 key = g_composite.transparent_index;
+
+   if (opacity == 255) {
+      for (int i = 0; i < count; i++) {
+         if (src[i] != key) dst[i] = lut[src[i]];
+      }
+   } else {
+      for (int i = 0; i < count; i++) {
+         if (src[i] != key) dst[i] = blend_pixel(lut[src[i]], dst[i], opacity);
+      }
+   }
+}
+
+static void composite_merge_scalar(ui8* dst, const ui8* src, int count) {
+   ui8 key = g_composite.transparent_index;
+   for (int i = 0; i < count; i++) {
+      if (src[i] != key) dst[i] = src[i];
+   }
+}
+
+static bool reserve_rows(int index_count, int color_count) {
+   // only ever touches the calling thread's scratch
+   CompositeScratch* scratch = &g_composite.scratch[jobs_get_thread_index()];
+   if (index_count > scratch->index_capacity) {
+      ui8* row = realloc(scratch->indices, index_count);
+      if (d_dne(row)) return false;
+      scratch->indices = row;
+      scratch->index_capacity = index_count;
+   }
+   if (color_count > scratch->color_capacity) {
+      ui32* row = realloc(scratch->colors, sizeof(ui32) * color_count);
+      if (d_dne(row)) return false;
+      scratch->colors = row;
+      scratch->color_capacity = color_count;
+   }
+   return true;
+}
+
+static void resolve_row(const CompositeSource* sources, int count, int y, int x0, int x1, ui8* row) {
+   memset(row, g_composite.transparent_index, x1 - x0);
+
+   // bottom to top, so whatever is left in row is the topmost opaque index
+   for (int i = 0; i < count; i++) {
+      const CompositeSource* source = &sources[i];
+      int span_x0, span_x1;
+      if (!source->surface) {
+         if (y < source->fill.y || y >= source->fill.y + source->fill.h) continue;
+         span_x0 = source->fill.x > x0 ? source->fill.x : x0;
+         span_x1 = source->fill.x + source->fill.w < x1 ? source->fill.x + source->fill.w : x1;
+         if (span_x1 > span_x0) memset(row + (span_x0 - x0), source->fill_index, span_x1 - span_x0);
+         continue;
+      }
+
+      int src_y = y - source->y;
+      if (src_y < 0 || src_y >= source->surface->h) continue;
+      span_x0 = source->x > x0 ? source->x : x0;
+      span_x1 = source->x + source->surface->w < x1 ? source->x + source->surface->w : x1;
+      if (span_x1 <= span_x0) continue;
+      const ui8* src = (const ui8*)source->surface->pixels + src_y * source->surface->pitch + (span_x0 - source->x);
+      g_composite.merge(row + (span_x0 - x0), src, span_x1 - span_x0);
+   }
+}
+
+static bool build_scale_columns(int src_w, int dst_w) {
+   if (g_composite.scale_columns && g_composite.scale_src_w == src_w && g_composite.scale_dst_w == dst_w) {
+      return true;
+   }
+   ui32* columns = realloc(g_composite.scale_columns, sizeof(ui32) * dst_w);
+   if (d_dne(columns)) return false;
+
+   // same rounding as the row mapping in composite_scale()
+   for (int x = 0; x < dst_w; x++) {
+      columns[x] = (ui32)((ui64)x * src_w / dst_w);
+   }
+   g_composite.scale_columns = columns;
+   g_composite.scale_src_w = src_w;
+   g_composite.scale_dst_w = dst_w;
+   return true;
+}
+
+static void scale_row_columns(ui32* dst, const ui32* src, const ui32* columns, int count, ui32 src_x0) {
+   // src starts at column src_x0
+   for (int i = 0; i < count; i++) {
+      dst[i] = src[columns[i] - src_x0];
+   }
+}
+
+static void scale_row_whole(ui32* dst, const ui32* src, int dst_x, int count, int factor) {
+   if (factor == 1) {
+      memcpy(dst, src + dst_x, count * 4);
+      return;
+   }
+
+   src += dst_x / factor;
+   int repeat = factor - dst_x % factor; // dst_x might start partway through a pixel
+   while (count > 0) {
+      int n = repeat < count ? repeat : count;
+      ui32 color = *src++;
+      for (int i = 0; i < n; i++) dst[i] = color;
+      dst += n;
+      count -= n;
+      repeat = factor;
+   }
+}
+
+#ifdef COMPOSITE_X86
+__attribute__((target("sse2")))
+static void scale_row_whole_sse2(ui32* dst, const ui32* src, int dst_x, int count, int factor) {
+   if (factor == 1) {
+      memcpy(dst, src + dst_x, count * 4);
+      return;
+   }
+
+   // line up with the start of a src pixel first
+   int head = (factor - dst_x % factor) % factor;
+   if (head > count) head = count;
+   scale_row_whole(dst, src, dst_x, head, factor);
+   dst += head;
+   count -= head;
+   src += (dst_x + head) / factor;
+
+   // 4 src pixels at a time
+   int block = factor * 4;
+   for (; count >= block; count -= block, dst += block, src += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)src);
+      __m128i* out = (__m128i*)dst;
+      switch (factor) {
+      case 2:
+         _mm_storeu_si128(out + 0, _mm_unpacklo_epi32(v, v));
+         _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(v, v));
+         break;
+      case 3:
+         _mm_storeu_si128(out + 0, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+         _mm_storeu_si128(out + 1, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+         _mm_storeu_si128(out + 2, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+         break;
+      case 4:
+         _mm_storeu_si128(out + 0, _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+         _mm_storeu_si128(out + 1, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+         _mm_storeu_si128(out + 2, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+         _mm_storeu_si128(out + 3, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+         break;
+      default: {
+         // splat each pixel, then overlapping stores cover the remainder
+         __m128i splat[4] = {
+            _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)),
+            _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3))
+         };
+         for (int p = 0; p < 4; p++) {
+            ui32* run = dst + p * factor;
+            int i = 0;
+            for (; i + 4 <= factor; i += 4) _mm_storeu_si128((__m128i*)(run + i), splat[p]);
+            if (i < factor) _mm_storeu_si128((__m128i*)(run + factor - 4), splat[p]);
+         }
+      }
+      }
+   }
+
+   scale_row_whole(dst, src, 0, count, factor);
+}
+
+__attribute__((target("sse2")))
+static void composite_merge_sse2(ui8* dst, const ui8* src, int count) {
+   const __m128i key = _mm_set1_epi8((char)g_composite.transparent_index);
+   int i = 0;
+   for (; i + 16 <= count; i += 16) {
+      __m128i over = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i keep = _mm_cmpeq_epi8(over, key);
+      int keep_bits = _mm_movemask_epi8(keep);
+      if (keep_bits == 0xFFFF) continue;
+      if (keep_bits == 0) {
+         _mm_storeu_si128((__m128i*)(dst + i), over);
+         continue;
+      }
+      __m128i under = _mm_loadu_si128((const __m128i*)(dst + i));
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(keep, under), _mm_andnot_si128(keep, over)));
+   }
+   composite_merge_scalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void composite_merge_avx2(ui8* dst, const ui8* src, int count) {
+   const __m256i key = _mm256_set1_epi8((char)g_composite.transparent_index);
+   int i = 0;
+   for (; i + 32 <= count; i += 32) {
+      __m256i over = _mm256_loadu_si256((const __m256i*)(src + i));
+      __m256i keep = _mm256_cmpeq_epi8(over, key);
+      ui32 keep_bits = (ui32)_mm256_movemask_epi8(keep);
+      if (keep_bits == 0xFFFFFFFFu) continue;
+      if (keep_bits == 0) {
+         _mm256_storeu_si256((__m256i*)(dst + i), over);
+         continue;
+      }
+      __m256i under = _mm256_loadu_si256((const __m256i*)(dst + i));
+      _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(over, under, keep));
+   }
+   composite_merge_scalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2(__m128i src, __m128i dst, __m128i alpha, __m128i inv_alpha) {
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i half = _mm_set1_epi16(128);
+
+   __m128i lo = _mm_add_epi16(_mm_add_epi16(
+                   _mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), alpha),
+                   _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), inv_alpha)), half);
+   __m128i hi = _mm_add_epi16(_mm_add_epi16(
+                   _mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), alpha),
+                   _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), inv_alpha)), half);
+   lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+   hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+   return _mm_packus_epi16(lo, hi);
+}
+
+__attribute__((target("sse2")))
+static void composite_row_sse2(ui32* dst, const ui8* src, int count, ui8 opacity) {
+   const ui32* lut = g_composite.lut;
+   const __m128i key = _mm_set1_epi8((char)g_composite.transparent_index);
+   const __m128i alpha = _mm_set1_epi16(opacity);
+   const __m128i inv_alpha = _mm_set1_epi16(255 - opacity);
+
+   int i = 0;
+   for (; i + 16 <= count; i += 16) {
+      __m128i indices = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i skip = _mm_cmpeq_epi8(indices, key);
+      int skip_bits = _mm_movemask_epi8(skip);
+      if (skip_bits == 0xFFFF) continue; // fully transparent run
+
+      // no gather before avx2, so the lookup itself stays scalar
+      ui32 colors[16];
+      for (int j = 0; j < 16; j++) colors[j] = lut[src[i + j]];
+
+      __m128i skip16[2] = { _mm_unpacklo_epi8(skip, skip), _mm_unpackhi_epi8(skip, skip) };
+      for (int q = 0; q < 4; q++) {
+         __m128i* out = (__m128i*)(dst + i + q * 4);
+         __m128i color = _mm_loadu_si128((const __m128i*)(colors + q * 4));
+         if (skip_bits == 0 && opacity == 255) {
+            _mm_storeu_si128(out, color);
+            continue;
+         }
+
+         __m128i under = _mm_loadu_si128(out);
+         if (opacity != 255) color = blend_sse2(color, under, alpha, inv_alpha);
+         __m128i mask = (q & 1) ? _mm_unpackhi_epi16(skip16[q >> 1], skip16[q >> 1])
+                                : _mm_unpacklo_epi16(skip16[q >> 1], skip16[q >> 1]);
+         _mm_storeu_si128(out, _mm_or_si128(_mm_and_si128(mask, under), _mm_andnot_si128(mask, color)));
+      }
+   }
+
+   composite_row_scalar(dst + i, src + i, count - i, opacity);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_avx2(__m256i src, __m256i dst, __m256i alpha, __m256i inv_alpha) {
+   const __m256i zero = _mm256_setzero_si256();
+   const __m256i half = _mm256_set1_epi16(128);
+
+   // unpack/pack both work within 128-bit lanes so pixel order survives the round trip
+   __m256i lo = _mm256_add_epi16(_mm256_add_epi16(
+                   _mm256_mullo_epi16(_mm256_unpacklo_epi8(src, zero), alpha),
+                   _mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), inv_alpha)), half);
+   __m256i hi = _mm256_add_epi16(_mm256_add_epi16(
+                   _mm256_mullo_epi16(_mm256_unpackhi_epi8(src, zero), alpha),
+                   _mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), inv_alpha)), half);
+   lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+   hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+   return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void composite_row_avx2(ui32* dst, const ui8* src, int count, ui8 opacity) {
+   const int* lut = (const int*)g_composite.lut;
+   const __m256i key8 = _mm256_set1_epi8((char)g_composite.transparent_index);
+   const __m256i key32 = _mm256_set1_epi32(g_composite.transparent_index);
+   const __m256i alpha = _mm256_set1_epi16(opacity);
+   const __m256i inv_alpha = _mm256_set1_epi16(255 - opacity);
+
+   int i = 0;
+   for (; i + 32 <= count; i += 32) {
+      __m256i indices = _mm256_loadu_si256((const __m256i*)(src + i));
+      ui32 skip_bits = (ui32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(indices, key8));
+      if (skip_bits == 0xFFFFFFFFu) continue; // fully transparent run
+
+      for (int q = 0; q < 4; q++) {
+         if (((skip_bits >> (q * 8)) & 0xFF) == 0xFF) continue;
+
+         __m256i* out = (__m256i*)(dst + i + q * 8);
+         __m256i index32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i + q * 8)));
+         __m256i color = _mm256_i32gather_epi32(lut, index32, 4);
+         if (((skip_bits >> (q * 8)) & 0xFF) == 0 && opacity == 255) {
+            _mm256_storeu_si256(out, color);
+            continue;
+         }
+
+         __m256i under = _mm256_loadu_si256(out);
+         if (opacity != 255) color = blend_avx2(color, under, alpha, inv_alpha);
+         __m256i mask = _mm256_cmpeq_epi32(index32, key32);
+         _mm256_storeu_si256(out, _mm256_blendv_epi8(color, under, mask));
+      }
+   }
+
+   composite_row_scalar(dst + i, src + i, count - i, opacity);
+}
+#endif
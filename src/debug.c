@@ -2,6 +2,9 @@
 #include "file.h"
 #include "input.h"
 #include "timing.h"
+#include "jobs.h"
+#include <stdlib.h>
+#include <string.h>
 
 int LOG_VERBOSITY = LOG_NORMAL;
 
@@ -89,7 +92,8 @@ const char* d_name_system_data(SystemData data) {
    static const char* names[] = {
       "SYS_CURRENT_FPS",
       "SYS_AVG_FPS",
-      "SYS_LAYER_COUNT",
+      "SYS_FRAME_GRAPH",
+      "SYS_FRAME_COUNTERS",
       "SYS_MAX"
    };
    return (data >= 0 && data < SYS_MAX) ? names[data] : "UNKNOWN!";
@@ -113,8 +117,9 @@ void d_print_renderer_dims(void) {
    d_var(g_renderer->last_windowed_width);
    d_var(g_renderer->last_windowed_height);
    for (ui32 i = 0; i < g_renderer->layer_count; i++) {
-      d_logl("(%u) layer %d: w = %d, h = %d", i,
-             g_renderer->layers[i].handle, g_renderer->layers[i].surface->w, g_renderer->layers[i].surface->h);
+      const Layer* layer = &g_renderer->layers[g_renderer->draw_order[i]];
+      d_logl("(%u) layer %u (slot %u, gen %u): w = %d, h = %d", i, layer->handle,
+             LAYER_HANDLE_SLOT(layer->handle), layer->generation, layer->surface->w, layer->surface->h);
       d_logl("\n");
    }
 }
@@ -136,35 +141,89 @@ const char* d_name_font(FontType type) {
 // TODO: make reverse where u can find enum from filename
 //       prolly should make filename array defined in file.h
 
+// COMPOSITE
+const char* d_name_composite_kernel(CompositeKernel kernel) {
+   static const char* names[] = {
+      "COMPOSITE_SCALAR",
+      "COMPOSITE_SSE2",
+      "COMPOSITE_AVX2",
+      "COMPOSITE_MAX"
+   };
+   return (kernel >= 0 && kernel < COMPOSITE_MAX) ? names[kernel] : "UNKNOWN!";
+}
+
 // TIMING
+const char* d_name_frame_stage(FrameStage stage) {
+   static const char* names[] = {
+      "STAGE_EVENTS",
+      "STAGE_UPDATE",
+      "STAGE_SCENE",
+      "STAGE_RENDER",
+      "STAGE_COMPOSITE",
+      "STAGE_PRESENT",
+      "STAGE_PRESENT_WAIT",
+      "STAGE_MAX"
+   };
+   return (stage >= 0 && stage < STAGE_MAX) ? names[stage] : "UNKNOWN!";
+}
+
 
 void d_timing_print_state(void) {
    const TimingState* t = timing_get_debug_state();
    d_log("");
    d_var(t->target_fps);
-   d_logl("    "); d_var(t->target_frame_time);
-   d_logl("    "); d_var(t->frame_start_time);
-   d_logl("    "); d_var(t->last_frame_time);
-   d_logl("    "); d_var(t->min_frame_time);
-   d_logl("    "); d_var(t->max_frame_time);
-   d_logl("    "); d_var(t->avg_frame_time);
+   d_logl("    "); d_var(t->target_frame_ns);
+   d_logl("    "); d_var(t->frame_start_ns);
+   d_logl("    "); d_var(t->last_frame_ns);
+   d_logl("    "); d_var(t->min_frame_ns);
+   d_logl("    "); d_var(t->max_frame_ns);
    d_logl("    "); d_var(t->frames_over_budget);
-   d_logl("    "); d_var(t->game_start_time);
-   d_logl("    "); d_var(t->total_game_time);
+   d_logl("    "); d_var(t->history_count);
+   d_logl("    "); d_var(t->game_start_ns);
+   d_logl("    "); d_var(t->total_game_ns);
+   d_logl("    "); d_var(t->deadline_ns);
+   d_logl("    "); d_var(t->spin_ns);
+   d_logl("    "); d_var(t->frames_missed);
+   d_logl("    "); d_var(t->sim_accumulator_ns);
+   d_logl("    "); d_var(t->sim_steps_total);
 }
 
 void d_print_performance_info(void) {
-   uint32_t min_ms = 0;
-   uint32_t max_ms = 0;
-   uint32_t avg_ms = 0;
-   uint32_t frames_over = 0;
-   timing_get_performance_info(&min_ms, &max_ms, &avg_ms, &frames_over);
+   TimingStats stats;
+   timing_get_frame_stats(&stats);
    d_log("======= FRAME %d ========", timing_get_frame_count());
-   d_log("   last_frame_time = %u ms", timing_get_last_frame_time());
-   d_log("    min_frame_time = %u ms", min_ms);
-   d_log("    max_frame_time = %u ms", max_ms);
-   d_log("    avg_frame_time = %u ms", avg_ms);
-   d_log("frames_over_budget = %u frames", frames_over);
+   d_log("   last_frame_time = %.3f ms", stats.last_ms);
+   d_log("    min_frame_time = %.3f ms", stats.min_ms);
+   d_log("    max_frame_time = %.3f ms", stats.max_ms);
+   d_log("    avg_frame_time = %.3f ms (last %u frames)", stats.avg_ms, stats.samples);
+   d_log("       p50/p95/p99 = %.3f / %.3f / %.3f ms", stats.p50_ms, stats.p95_ms, stats.p99_ms);
+   d_log("frames_over_budget = %u frames", stats.frames_over);
+   d_log("      frame pacing = %.3f ms late (avg %.3f, max %.3f), %u missed",
+         stats.pace_last_ms, stats.pace_avg_ms, stats.pace_max_ms, stats.frames_missed);
+   d_log("        simulation = %u steps last frame, %u total, %.2f ms dropped",
+         stats.sim_steps_last, stats.sim_steps_total, stats.sim_dropped_ms);
+   ui32 band_count = 0;
+   const ui32* band_times = timing_get_band_times(&band_count);
+   if (band_count > 0) {
+      ui32 band_min = UINT32_MAX, band_max = 0, band_total = 0;
+      for (ui32 i = 0; i < band_count; i++) {
+         if (band_times[i] < band_min) band_min = band_times[i];
+         if (band_times[i] > band_max) band_max = band_times[i];
+         band_total += band_times[i];
+      }
+      d_log("  composite_bands = %u on %d threads", band_count, jobs_get_thread_count());
+      d_log("       band_times = %u-%u us, %u us total", band_min, band_max, band_total);
+   }
+   const DrawList* list = &renderer_get_debug_state()->draw_list;
+   if (list->last_count > 0) {
+      d_log("    draw_commands = %u (%u merged, %u culled)", list->last_count, list->last_merged, list->last_culled);
+   }
+   const TextCache* cache = &renderer_get_debug_state()->text_cache;
+   d_log("       text_cache = %u hits, %u misses, %u evictions", cache->hits, cache->misses, cache->evictions);
+   d_log("                    %u runs, %zu / %zu KB", cache->run_count, cache->bytes / 1024, cache->max_bytes / 1024);
+   for (int i = 0; i < STAGE_MAX; i++) {
+      d_log("%18s = %u us", d_name_frame_stage(i), timing_get_stage_time(i));
+   }
    d_log("==========================");
 }
 
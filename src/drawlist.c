@@ -0,0 +1,165 @@
+#include "drawlist.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DRAWLIST_START_COMMANDS 256
+#define DRAWLIST_START_TEXT 2048
+
+static int compare_commands(const void* a, const void* b);
+static void cull_layer(DrawList* list, DrawCommand* commands, ui32 count);
+static void merge_layer(DrawList* list, DrawCommand* commands, ui32 count);
+static bool rect_contains(const SDL_Rect* outer, const SDL_Rect* inner);
+static bool rects_merge(const SDL_Rect* a, const SDL_Rect* b);
+
+bool drawlist_init(DrawList* list) {
+   memset(list, 0, sizeof(DrawList));
+   list->commands = malloc(sizeof(DrawCommand) * DRAWLIST_START_COMMANDS);
+   list->text = malloc(DRAWLIST_START_TEXT);
+   if (d_dne(list->commands) || d_dne(list->text)) {
+      drawlist_free(list);
+      return false;
+   }
+   list->capacity = DRAWLIST_START_COMMANDS;
+   list->text_capacity = DRAWLIST_START_TEXT;
+   return true;
+}
+
+void drawlist_free(DrawList* list) {
+   free(list->commands);
+   free(list->text);
+   memset(list, 0, sizeof(DrawList));
+}
+
+void drawlist_reset(DrawList* list) {
+   list->count = 0;
+   list->text_used = 0;
+}
+
+DrawCommand* drawlist_push(DrawList* list) {
+   if (list->count >= list->capacity) {
+      ui32 new_capacity = list->capacity ? list->capacity * 2 : DRAWLIST_START_COMMANDS;
+      DrawCommand* new_commands = realloc(list->commands, sizeof(DrawCommand) * new_capacity);
+      if (d_dne(new_commands)) return NULL;
+      list->commands = new_commands;
+      list->capacity = new_capacity;
+      d_logv(3, "draw list grew to %u commands", new_capacity);
+   }
+
+   DrawCommand* command = &list->commands[list->count];
+   memset(command, 0, sizeof(DrawCommand));
+   command->sequence = list->count++;
+   return command;
+}
+
+bool drawlist_push_text(DrawList* list, DrawCommand* command, const char* text, ui32 length) {
+   // text moves when it grows, so commands hold an offset rather than a pointer
+   if (length > UINT16_MAX) length = UINT16_MAX;
+   if (list->text_used + length > list->text_capacity) {
+      ui32 new_capacity = list->text_capacity ? list->text_capacity : DRAWLIST_START_TEXT;
+      while (list->text_used + length > new_capacity) new_capacity *= 2;
+      char* new_text = realloc(list->text, new_capacity);
+      if (d_dne(new_text)) return false;
+      list->text = new_text;
+      list->text_capacity = new_capacity;
+   }
+
+   memcpy(list->text + list->text_used, text, length);
+   command->text_offset = list->text_used;
+   command->text_length = (ui16)length;
+   list->text_used += length;
+   return true;
+}
+
+void drawlist_optimize(DrawList* list) {
+   list->last_count = list->count;
+   list->last_merged = 0;
+   list->last_culled = 0;
+   if (list->count == 0) return;
+
+   qsort(list->commands, list->count, sizeof(DrawCommand), compare_commands);
+
+   ui32 start = 0;
+   while (start < list->count) {
+      ui32 end = start + 1;
+      while (end < list->count && list->commands[end].layer == list->commands[start].layer) end++;
+      cull_layer(list, &list->commands[start], end - start);
+      merge_layer(list, &list->commands[start], end - start);
+      start = end;
+   }
+}
+
+// INTERNAL
+static int compare_commands(const void* a, const void* b) {
+   const DrawCommand* ca = a;
+   const DrawCommand* cb = b;
+   if (ca->layer != cb->layer) return (ca->layer < cb->layer) ? -1 : 1;
+   return (ca->sequence < cb->sequence) ? -1 : (ca->sequence > cb->sequence);
+}
+
+static void cull_layer(DrawList* list, DrawCommand* commands, ui32 count) {
+   /* walks backwards so everything opaque drawn later is already known. */
+   /* only the biggest DRAWLIST_MAX_OCCLUDERS are kept, which is plenty  */
+   /* for a fill or a couple of panels covering everything underneath    */
+   SDL_Rect occluders[DRAWLIST_MAX_OCCLUDERS];
+   int occluder_count = 0;
+
+   for (int i = (int)count - 1; i >= 0; i--) {
+      DrawCommand* command = &commands[i];
+      if (command->culled) continue; // recorded empty
+      bool covered = false;
+      for (int o = 0; o < occluder_count && !covered; o++) {
+         covered = rect_contains(&occluders[o], &command->bounds);
+      }
+      if (covered) {
+         command->culled = true;
+         list->last_culled++;
+         continue;
+      }
+      if (command->op == DRAW_GLYPHS || command->op == DRAW_SPRITE) continue; // glyphs and sprites have holes
+
+      if (occluder_count < DRAWLIST_MAX_OCCLUDERS) {
+         occluders[occluder_count++] = command->bounds;
+         continue;
+      }
+      int smallest = 0;
+      for (int o = 1; o < occluder_count; o++) {
+         if (occluders[o].w * occluders[o].h < occluders[smallest].w * occluders[smallest].h) smallest = o;
+      }
+      if (command->bounds.w * command->bounds.h > occluders[smallest].w * occluders[smallest].h) {
+         occluders[smallest] = command->bounds;
+      }
+   }
+}
+
+static void merge_layer(DrawList* list, DrawCommand* commands, ui32 count) {
+   // culled commands in between don't draw anything, so they don't get in the way
+   DrawCommand* prev = NULL;
+   for (ui32 i = 0; i < count; i++) {
+      DrawCommand* command = &commands[i];
+      if (command->culled) continue;
+
+      if (prev && prev->op == DRAW_RECT && command->op == DRAW_RECT &&
+          prev->color_index == command->color_index && rects_merge(&prev->bounds, &command->bounds)) {
+         SDL_UnionRect(&prev->bounds, &command->bounds, &prev->bounds);
+         command->culled = true;
+         list->last_merged++;
+         continue;
+      }
+      prev = command;
+   }
+}
+
+static bool rect_contains(const SDL_Rect* outer, const SDL_Rect* inner) {
+   return inner->x >= outer->x && inner->y >= outer->y &&
+          inner->x + inner->w <= outer->x + outer->w &&
+          inner->y + inner->h <= outer->y + outer->h;
+}
+
+static bool rects_merge(const SDL_Rect* a, const SDL_Rect* b) {
+   // true if the union of a and b is exactly the area they cover
+   if (rect_contains(a, b) || rect_contains(b, a)) return true;
+   if (a->y == b->y && a->h == b->h) return a->x <= b->x + b->w && b->x <= a->x + a->w;
+   if (a->x == b->x && a->w == b->w) return a->y <= b->y + b->h && b->y <= a->y + a->h;
+   return false;
+}
@@ -1,6 +1,9 @@
 #include "file.h"
 #include "renderer.h" // for palette
 #include "debug.h"
+#include "loader.h"
+#include "timing.h"
+#include "bundle.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -8,18 +11,90 @@
    #include <windows.h>
 #else
    #include <dirent.h>
+   #include <fcntl.h>
+   #include <sys/mman.h>
    #include <sys/stat.h>
+   #include <unistd.h>
 #endif
 
-static ImageData* load_bitmap(const char* fname);
-static int parse_sheet_filename(const char* fname, char* type, char* name, int* tile_w, int* tile_h);
+#define BMP_HEADERS_SIZE 54   // file header + BITMAPINFOHEADER
+#define BMP_MAX_DIM 16384     // px, anything bigger is a broken header
+#define BMP_BI_RGB 0          // uncompressed
+#define BMP_BI_BITFIELDS 3    // uncompressed, channel masks after BITMAPINFOHEADER (or inside V2+ headers)
+#define BMP_MASKS_SIZE 12     // r, g, b masks right after the 40 byte header, alpha after them in V3+
+#define PALETTE_LUT_BITS 5    // per channel, 32x32x32 cube
+#define PALETTE_LUT_SIZE (1 << (PALETTE_LUT_BITS * 3))
+#define PALETTE_EXACT_BITS 7  // open addressing slots for the palette colors themselves
+#define PALETTE_EXACT_SLOTS (1 << PALETTE_EXACT_BITS)
+#define PALETTE_EXACT_EMPTY 0xFFFFFFFF // not a 24 bit color
+#define PALETTE_BLACK_INDEX 4 // mono-black, what the sheets' #000000 is drawn as
+
+typedef struct {
+   LoadHandle handle;
+   bool is_font;
+} SheetLoad;
+
+typedef struct {
+   ui32 off_pixels;        // pixels whose color isn't in the palette
+   ui32 example_rgb;       // the first of them
+   ui8 example_index;      // and where it went
+} ColorStats;
+
+static struct {
+   FontArray* fonts;       // where finished loads land, by the index picked when they were queued
+   SpriteArray* sprites;
+   SheetLoad* loads;
+   int load_count;
+   int load_capacity;
+   int loads_finished;
+   ui64 start_us;
+   Bundle bundle;          // mapped while anything points into it
+   ui32 fonts_searched;    // bit per FontType the bundle has been asked for
+} g_sheets = { 0 };
+
+// source color -> palette index. palette colors hit the exact table, anything
+// else goes to the nearest entry for its cell of the cube
+static struct {
+   bool built;
+   ui8 cube[PALETTE_LUT_SIZE];
+   ui32 exact_rgb[PALETTE_EXACT_SLOTS];
+   ui8 exact_index[PALETTE_EXACT_SLOTS];
+} g_palette_lut = { 0 };
+
+static uint16_t read_u16(const uint8_t* bytes);
+static uint32_t read_u32(const uint8_t* bytes);
+static bool has_bgra_masks(const uint8_t* bytes, size_t size, uint32_t header_size, uint32_t pixel_offset);
+static uint8_t nearest_palette_index(uint32_t rgb);
 static int has_extension(const char* fname, const char* ext);
-static int process_sheet(const char* fname, FontArray* fonts, SpriteArray* sprites);
+static bool file_exists(const char* fname);
+static bool load_bundle(void);
+static bool reserve_capacity(int font_capacity, int sprite_capacity);
+static void resolve_font(FontType type);
+static int resolve_entry(const BundleEntry* entry);
+static void resolve_bundle(void);
+static int find_sprite(const SpriteArray* sprites, const char* name);
+static bool scan_sheets(const char* wanted_type, LoadPriority priority);
+static bool queue_sheet(const char* fname, const char* wanted_type, LoadPriority priority);
+static int reserve_sheet(bool is_font, const char* fname, const char* name, int tile_w, int tile_h);
+static void* load_sheet(const char* path, void* user);
+static void font_loaded(LoadHandle handle, LoadResult result, void* data, void* user);
+static void sprite_loaded(LoadHandle handle, LoadResult result, void* data, void* user);
+static void count_finished_load(LoadHandle handle);
+static bool sheet_loaded(const char* fname, LoadResult result, ImageData* image_data, int tile_w, int tile_h,
+                         int* image_w, int* image_h);
 static void cleanup_sheets(FontArray* fonts, SpriteArray* sprites);
-static void align_color(ui32* color);
-static void verify_image_colors(ImageData* image_data);
+static void free_image(ImageData* image_data);
+static void build_palette_lut(void);
+static void add_exact_color(ui32 rgb, ui8 index);
+static ui8 align_color(ui32 rgb, bool* off_palette);
+static void verify_image_colors(const char* fname, const ColorStats* stats);
+static void bake_glyph_rows(Font* font);
+static bool index_sprite(SpriteArray* sprites, int index);
+static bool insert_sprite_name(SpriteArray* sprites, int index);
+static ui32 hash_sprite_name(const char* name);
+static void bake_sprite_spans(Sprite* sprite);
+static int find_row_spans(const uint8_t* row, int width, SpriteSpan* spans, uint8_t* pixels, ui32* opaque);
 
-// TODO: switch font/sprite order
 int file_load_sheets(FontArray* fonts, SpriteArray* sprites) {
    if (!fonts || !sprites) {
       d_err("fonts or sprites do not exist");
@@ -31,6 +106,7 @@ int file_load_sheets(FontArray* fonts, SpriteArray* sprites) {
    fonts->fonts = malloc(sizeof(Font) * 8);
    fonts->font_count = 0;
    fonts->font_capacity = 8;
+   memset(fonts->by_type, 0, sizeof(fonts->by_type));
    if (d_dne(fonts->fonts)) {
       return 0;
    }
@@ -38,169 +114,242 @@ int file_load_sheets(FontArray* fonts, SpriteArray* sprites) {
    sprites->sprites = malloc(sizeof(Sprite) * 16);
    sprites->sprite_count = 0;
    sprites->sprite_capacity = 16;
+   sprites->lookup = NULL;
+   sprites->lookup_size = 0;
    if (d_dne(sprites->sprites)) {
       free(fonts->fonts);
       fonts->fonts = NULL;
       return 0;
    }
-   
-#ifdef _WIN32
-   WIN32_FIND_DATA find_data;
-   HANDLE find_handle;
-   char search_path[256];
-   snprintf(search_path, sizeof(search_path), "%s*.bmp", DIR_SHEETS);
-   
-   find_handle = FindFirstFile(search_path, &find_data);
-   if (find_handle == INVALID_HANDLE_VALUE) {
-      d_err("no bitmap files found in %s", DIR_SHEETS);
-      cleanup_sheets(fonts, sprites);
+
+   g_sheets.fonts = fonts;
+   g_sheets.sprites = sprites;
+   g_sheets.load_count = 0;
+   g_sheets.loads_finished = 0;
+   g_sheets.start_us = timing_get_time_us();
+
+   if (load_bundle()) return 1;
+
+   // fonts go first so the title screen has them, sprites stream in behind
+   build_palette_lut(); // here, so the I/O threads only ever read it
+   if (!scan_sheets("font", LOAD_URGENT) || !scan_sheets("sprite", LOAD_BACKGROUND)) {
+      file_unload_sheets(fonts, sprites);
       return 0;
    }
    
-   do {
-      if (has_extension(find_data.cFileName, ".bmp")) {
-         process_sheet(find_data.cFileName, fonts, sprites);
+   d_logv(2, "queued %d fonts and %d sprites from %s", 
+          fonts->font_count, sprites->sprite_count, DIR_SHEETS);
+   return 1;
+}
+
+bool file_wait_sheets(bool fonts_only) {
+   if (g_sheets.bundle.header) {
+      // nothing is queued, sheets come out of the bundle as they're looked up.
+      // fonts_only needs the default font (or any, if it's missing)
+      if (!fonts_only) resolve_bundle();
+      for (int t = 0; t < FONT_MAX && fonts_only; t++) {
+         if (file_get_font(g_sheets.fonts, (FontType)((FONT_DEFAULT + t) % FONT_MAX))) break;
       }
-   } while (FindNextFile(find_handle, &find_data));
-   FindClose(find_handle);
-   
-#else
-   DIR* dir = opendir(DIR_SHEETS);
-   if (d_dne(dir)) {
-      d_log("could not open directory: %s", DIR_SHEETS);
-      cleanup_sheets(fonts, sprites);
-      return 0;
    }
-   
-   struct dirent* entry;
-   while ((entry = readdir(dir)) != NULL) {
-      if (has_extension(entry->d_name, ".bmp")) {
-         process_sheet(entry->d_name, fonts, sprites);
-      }
+   for (int i = 0; i < g_sheets.load_count; i++) {
+      if (fonts_only && !g_sheets.loads[i].is_font) continue;
+      loader_wait(g_sheets.loads[i].handle);
    }
-   closedir(dir);
-#endif
-   
-   d_logv(2, "loaded %d fonts and %d sprites from %s", 
-          fonts->font_count, sprites->sprite_count, DIR_SHEETS);
-   return 1;
+   if (!g_sheets.fonts) return false;
+   for (int i = 0; i < g_sheets.fonts->font_count; i++) {
+      if (g_sheets.fonts->fonts[i].data) return true;
+   }
+   d_err("no fonts could be loaded from %s", DIR_SHEETS);
+   return false;
 }
 
 void file_unload_sheets(FontArray* fonts, SpriteArray* sprites) {
+   // nothing can land in the arrays once they're gone
+   for (int i = 0; i < g_sheets.load_count; i++) {
+      loader_cancel(g_sheets.loads[i].handle);
+      loader_wait(g_sheets.loads[i].handle);
+   }
+   SAFE_FREE(g_sheets.loads);
+   g_sheets.load_count = 0;
+   g_sheets.load_capacity = 0;
+   g_sheets.loads_finished = 0;
+   g_sheets.fonts = NULL;
+   g_sheets.sprites = NULL;
+
    int font_count = fonts->font_count;
    int sprite_count = sprites->sprite_count;
    cleanup_sheets(fonts, sprites);
+   bundle_close(&g_sheets.bundle);
+   g_sheets.fonts_searched = 0;
    d_logv(2, "unloaded %d fonts and %d sprites", font_count, sprite_count);
 }
 
-Font* file_get_font(FontArray* font_array, FontType type) { // TODO: redo this
-   const char* fname = d_name_font(type);
-   if (!fname) return NULL;
-   for (int i = 0; i < font_array->font_count; i++) {
-      if (strcmp(font_array->fonts[i].fname, fname) == 0) {
-         return &font_array->fonts[i];
-      }
-   }
-   return NULL;
+Font* file_get_font(FontArray* font_array, FontType type) {
+   // by_type is filled in as fonts are queued or first come out of the bundle, so this is just an index
+   if (type < 0 || type >= FONT_MAX) return NULL;
+   if (font_array->by_type[type] == 0 && font_array == g_sheets.fonts) resolve_font(type);
+   if (font_array->by_type[type] == 0) return NULL;
+   Font* font = &font_array->fonts[font_array->by_type[type] - 1];
+   return font->data ? font : NULL; // still loading
 }
 
 Sprite* file_get_sprite(SpriteArray* sprite_array, const char* sprite_name) {
-   // TODO: finish this pls
-   (void)sprite_array;
-   (void)sprite_name;
-   return NULL;
+   // the lookup is filled in as sprites are queued or first come out of the bundle,
+   // so it never has to be rebuilt while drawing
+   if (!sprite_name) return NULL;
+   int index = find_sprite(sprite_array, sprite_name);
+   if (index < 0 && sprite_array == g_sheets.sprites && g_sheets.bundle.header) {
+      index = resolve_entry(bundle_find(&g_sheets.bundle, BUNDLE_SPRITE, sprite_name));
+   }
+   if (index < 0) return NULL;
+   Sprite* sprite = &sprite_array->sprites[index];
+   return sprite->frame_count > 0 ? sprite : NULL; // still loading
 }
 
-// INTERNAL
-static ImageData* load_bitmap(const char* fname) {
-   /* bitmap is assumed to be in its simplest structure */
-   /* e.g. header, DIB header, pixel array. DIB assumed */
-   /* to be windows bitmap.                             */
-   FILE* image_file = NULL;
-   image_file = fopen(fname, "rb");
-   if (!image_file) {
-      d_err("coudln't open image file: %s", fname);
-      return NULL;
-   }
-
-   uint8_t file_header[16];
-   if (fread(&file_header, 1, 14, image_file) != 14) {
-      d_err("couldn't read file header: %s", fname);
-      fclose(image_file);
-      return NULL;
-   }
-   
-   if (((uint16_t*)file_header)[0] != 0x4D42) {
+ImageData* file_load_bitmap(const char* fname) {
+   /* windows bitmap, BITMAPINFOHEADER or newer, uncompressed 24 or 32 bit.  */
+   /* 32 bit BI_BITFIELDS is fine too as long as the masks are plain BGRA,   */
+   /* which is what most editors write. everything is read straight out of   */
+   /* the mapping and each pixel goes to its palette index on the way,       */
+   /* there's no RGBA copy in between                                        */
+   MappedFile mapped;
+   if (!file_map(fname, &mapped)) return NULL;
+   const uint8_t* bytes = mapped.bytes;
+   ImageData* image_data = NULL;
+
+   if (mapped.size < BMP_HEADERS_SIZE || read_u16(bytes) != 0x4D42) {
       d_err("file is not a valid bitmap: %s", fname);
-      fclose(image_file);
-      return NULL;
-   }
-
-   struct {
-      uint32_t header_size;
-      int32_t width;
-      int32_t height;
-      uint16_t planes;
-      uint16_t bitdepth;
-      uint32_t compression;
-      uint32_t byte_length;
-      int32_t length_per_meter;
-      int32_t height_per_meter;
-      uint32_t color_count;
-      uint32_t important_colors;
-   } dib_header; // dib = device-independent format
-   
-   if (fread(&dib_header, 1, sizeof(dib_header), image_file) != sizeof(dib_header)) {
-      d_err("couldn't read dib header: %s", fname);
-      fclose(image_file);
-      return NULL;
+      goto done;
    }
-   
-   ImageData *image_data;
-   uint32_t data_size = dib_header.width * dib_header.height * 4;
+   uint32_t pixel_offset = read_u32(bytes + 10);
+   uint32_t header_size = read_u32(bytes + 14);  // dib = device-independent format
+   int32_t width = (int32_t)read_u32(bytes + 18);
+   int32_t height = (int32_t)read_u32(bytes + 22); // negative = rows stored top-down
+   uint16_t bitdepth = read_u16(bytes + 28);
+   uint32_t compression = read_u32(bytes + 30);
+
+   if (header_size < 40 || (bitdepth != 24 && bitdepth != 32) ||
+       (compression != BMP_BI_RGB && (compression != BMP_BI_BITFIELDS || bitdepth != 32))) {
+      d_err("unsupported bitmap (dib %u, %u bpp, compression %u): %s", header_size, bitdepth, compression, fname);
+      goto done;
+   }
+   if (compression == BMP_BI_BITFIELDS && !has_bgra_masks(bytes, mapped.size, header_size, pixel_offset)) {
+      d_err("unsupported bitmap (channel masks aren't BGRA): %s", fname);
+      goto done;
+   }
+   bool top_down = height < 0;
+   if (top_down) height = -height;
+   if (width <= 0 || height <= 0 || width > BMP_MAX_DIM || height > BMP_MAX_DIM) {
+      d_err("bad bitmap dimensions %dx%d: %s", width, height, fname);
+      goto done;
+   }
+   size_t bytes_per_pixel = bitdepth / 8;
+   size_t bmp_pitch = (((size_t)width * bitdepth + 31) / 32) * 4; // rows are padded to 4 bytes
+   if (pixel_offset > mapped.size || bmp_pitch * height > mapped.size - pixel_offset) {
+      d_err("bitmap is cut off (%zu bytes): %s", mapped.size, fname);
+      goto done;
+   }
+
+   uint32_t data_size = (uint32_t)width * (uint32_t)height;
    image_data = malloc(sizeof(ImageData) + data_size);
    if (!image_data) {
       d_err("couldn't malloc ImageData: %s", fname);
-      fclose(image_file);
-      return NULL;
+      goto done;
    }
    image_data->size = data_size;
-   image_data->width = dib_header.width;
-   image_data->height = dib_header.height;
-   
-   // uint32_t bmp_pitch = dib_header.width * 3;
-   uint32_t bmp_pitch = ((dib_header.width * 3 + 3) / 4) * 4; // for some reason this fixes 9x8 tiles
-   uint32_t img_data_pitch = dib_header.width * 4;
-   uint8_t pixel_buffer[bmp_pitch];
-   uint8_t* pixel_data = image_data->data;
-   
-   for (uint32_t i = dib_header.height; i > 0; i--) {
-      if (fread(&pixel_buffer, 1, bmp_pitch, image_file) != bmp_pitch) {
-         d_err("couldn't read pixel data at row %u", i);
-         free(image_data);
-         fclose(image_file);
-         return NULL;
-      }
-         
-      uint8_t* row_start = pixel_data + (i - 1) * img_data_pitch;
-      // TODO: ensure dib_header.width is positive
-      //       apparently negative w/h values mean the pixel data is stored bottom-up?
-      for (uint32_t j = 0; j < (uint32_t)dib_header.width; j++) {
-         uint32_t buffer_offset = j * 3;
-         uint32_t data_offset = j * 4;
-         
-         row_start[data_offset + 0] = pixel_buffer[buffer_offset + 2];  // R
-         row_start[data_offset + 1] = pixel_buffer[buffer_offset + 1];  // G
-         row_start[data_offset + 2] = pixel_buffer[buffer_offset + 0];  // B
-         row_start[data_offset + 3] = 255;                              // A
+   image_data->width = width;
+   image_data->height = height;
+
+   // first call builds the cube, file_load_sheets() does that before any I/O thread gets here
+   if (!g_palette_lut.built) build_palette_lut();
+   ColorStats stats = { 0 };
+   uint32_t last_rgb = PALETTE_EXACT_EMPTY; // sheets are mostly runs of one color
+   uint8_t last_index = 0;
+   bool last_off = false;
+   for (int32_t y = 0; y < height; y++) {
+      const uint8_t* src = bytes + pixel_offset + bmp_pitch * (top_down ? y : height - 1 - y);
+      uint8_t* dest = image_data->data + (size_t)y * width;
+      for (int32_t x = 0; x < width; x++, src += bytes_per_pixel) {
+         uint32_t rgb = ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0]; // stored BGR
+         if (rgb != last_rgb) {
+            last_rgb = rgb;
+            last_index = align_color(rgb, &last_off);
+            if (last_off && stats.off_pixels == 0) {
+               stats.example_rgb = rgb;
+               stats.example_index = last_index;
+            }
+         }
+         stats.off_pixels += last_off;
+         dest[x] = last_index;
       }
    }
+   verify_image_colors(fname, &stats);
 
-   fclose(image_file);
+done:
+   file_unmap(&mapped);
    return image_data;
 }
 
-static int parse_sheet_filename(const char* fname, char* type, char* name, int* tile_w, int* tile_h) {
+bool file_map(const char* fname, MappedFile* mapped) {
+   memset(mapped, 0, sizeof(*mapped));
+#ifdef _WIN32
+   mapped->file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   if (mapped->file == INVALID_HANDLE_VALUE) {
+      d_err("couldn't open %s", fname);
+      return false;
+   }
+   LARGE_INTEGER size;
+   if (!GetFileSizeEx(mapped->file, &size) || size.QuadPart == 0) {
+      d_err("couldn't get the size of %s", fname);
+      CloseHandle(mapped->file);
+      return false;
+   }
+   mapped->size = (size_t)size.QuadPart;
+   mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+   if (mapped->mapping) mapped->bytes = MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+   if (!mapped->bytes) {
+      d_err("couldn't map %s", fname);
+      if (mapped->mapping) CloseHandle(mapped->mapping);
+      CloseHandle(mapped->file);
+      return false;
+   }
+#else
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) {
+      d_err("couldn't open %s", fname);
+      return false;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      d_err("couldn't get the size of %s", fname);
+      close(fd);
+      return false;
+   }
+   mapped->size = (size_t)st.st_size;
+   void* bytes = mmap(NULL, mapped->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd); // the mapping keeps the file around
+   if (bytes == MAP_FAILED) {
+      d_err("couldn't map %s", fname);
+      return false;
+   }
+   mapped->bytes = bytes;
+#endif
+   return true;
+}
+
+void file_unmap(MappedFile* mapped) {
+   if (!mapped->bytes) return;
+#ifdef _WIN32
+   UnmapViewOfFile(mapped->bytes);
+   CloseHandle(mapped->mapping);
+   CloseHandle(mapped->file);
+#else
+   munmap((void*)mapped->bytes, mapped->size);
+#endif
+   mapped->bytes = NULL;
+}
+
+int file_parse_sheet_filename(const char* fname, char* type, char* name, int* tile_w, int* tile_h) {
    // format: [type]_[name]_[w]x[h].bmp
    char* fname_copy = malloc(strlen(fname) + 1);
    strcpy(fname_copy, fname);
@@ -225,6 +374,47 @@ static int parse_sheet_filename(const char* fname, char* type, char* name, int*
    return 1;
 }
 
+// INTERNAL
+
+static uint16_t read_u16(const uint8_t* bytes) {
+   // little endian, no alignment assumed
+   return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t* bytes) {
+   return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static bool has_bgra_masks(const uint8_t* bytes, size_t size, uint32_t header_size, uint32_t pixel_offset) {
+   /* BITMAPINFOHEADER puts the masks right after itself, V2+ headers have  */
+   /* them at the same spot inside. alpha is only there from V3 on and can */
+   /* be left out, the pixels get read as BGR(A) either way                 */
+   bool has_alpha = header_size >= 56;
+   size_t masks_end = BMP_HEADERS_SIZE + BMP_MASKS_SIZE + (has_alpha ? 4 : 0);
+   if (size < masks_end || pixel_offset < masks_end) return false;
+   uint32_t alpha = has_alpha ? read_u32(bytes + BMP_HEADERS_SIZE + BMP_MASKS_SIZE) : 0;
+   return read_u32(bytes + BMP_HEADERS_SIZE) == 0x00FF0000 && read_u32(bytes + BMP_HEADERS_SIZE + 4) == 0x0000FF00 &&
+          read_u32(bytes + BMP_HEADERS_SIZE + 8) == 0x000000FF && (alpha == 0xFF000000 || alpha == 0);
+}
+
+static uint8_t nearest_palette_index(uint32_t rgb) {
+   // closest palette entry by squared distance, only used to fill the cube
+   int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+   uint8_t best = PALETTE_TRANSPARENT;
+   int best_distance = -1;
+   for (int i = 0; i < PALETTE_SIZE; i++) {
+      int dr = r - (int)((palette[i] >> 24) & 0xFF);
+      int dg = g - (int)((palette[i] >> 16) & 0xFF);
+      int db = b - (int)((palette[i] >> 8) & 0xFF);
+      int distance = dr * dr + dg * dg + db * db;
+      if (best_distance < 0 || distance < best_distance) {
+         best = (uint8_t)i;
+         best_distance = distance;
+      }
+   }
+   return best;
+}
+
 static int has_extension(const char* fname, const char* ext) {
    // TODO: replace const 4
    size_t len = strlen(fname);
@@ -236,100 +426,314 @@ static int has_extension(const char* fname, const char* ext) {
 #endif
 }
 
-static int process_sheet(const char* fname, FontArray* fonts, SpriteArray* sprites) {
-   char full_path[512];
-   snprintf(full_path, sizeof(full_path), "%s%s", DIR_SHEETS, fname);
+static bool file_exists(const char* fname) {
+#ifdef _WIN32
+   return GetFileAttributesA(fname) != INVALID_FILE_ATTRIBUTES;
+#else
+   struct stat st;
+   return stat(fname, &st) == 0;
+#endif
+}
+
+static bool load_bundle(void) {
+   /* maps the bundle and leaves every sheet in it until it's first looked   */
+   /* up, nothing to parse or decode. no bundle (or a stale one) falls back  */
+   /* to the bitmaps                                                          */
+   Bundle* bundle = &g_sheets.bundle;
+   if (!file_exists(BUNDLE_PATH)) {
+      d_logv(2, "no %s, loading the bitmaps", BUNDLE_PATH); // make bundle builds it
+      return false;
+   }
+   if (!bundle_open(bundle, BUNDLE_PATH)) return false;
+
+   // room for every entry now, so resolving one later never moves a Font or
+   // Sprite that was already handed out
+   const BundleHeader* header = bundle->header;
+   int font_total = 0;
+   for (ui32 i = 0; i < header->entry_count; i++) {
+      if (bundle->entries[i].type == BUNDLE_FONT) font_total++;
+   }
+   if (!reserve_capacity(font_total, (int)header->entry_count - font_total)) {
+      bundle_close(bundle);
+      return false;
+   }
+   g_sheets.fonts_searched = 0;
+   d_logv(2, "mapped %s in %.2f ms, %u sheets load as they're looked up", BUNDLE_PATH,
+          (timing_get_time_us() - g_sheets.start_us) / 1000.0, header->entry_count);
+   return true;
+}
+
+static bool reserve_capacity(int font_capacity, int sprite_capacity) {
+   FontArray* fonts = g_sheets.fonts;
+   SpriteArray* sprites = g_sheets.sprites;
+   if (font_capacity > fonts->font_capacity) {
+      Font* new_fonts = realloc(fonts->fonts, sizeof(Font) * font_capacity);
+      if (d_dne(new_fonts)) return false;
+      fonts->fonts = new_fonts;
+      fonts->font_capacity = font_capacity;
+   }
+   if (sprite_capacity > sprites->sprite_capacity) {
+      Sprite* new_sprites = realloc(sprites->sprites, sizeof(Sprite) * sprite_capacity);
+      if (d_dne(new_sprites)) return false;
+      sprites->sprites = new_sprites;
+      sprites->sprite_capacity = sprite_capacity;
+   }
+   return true;
+}
+
+static void resolve_font(FontType type) {
+   // only asks the bundle once per font, whether it's in there or not
+   ui32 bit = 1u << type;
+   if (!g_sheets.bundle.header || (g_sheets.fonts_searched & bit)) return;
+   g_sheets.fonts_searched |= bit;
+   resolve_entry(bundle_find(&g_sheets.bundle, BUNDLE_FONT, d_name_font(type)));
+}
+
+static int resolve_entry(const BundleEntry* entry) {
+   /* takes a slot for a bundle entry and hands it the image in the mapping, */
+   /* once its pixels checksum right. a bad checksum keeps the slot but not  */
+   /* the image, so the sheet is missing instead of garbage and isn't tried  */
+   /* again. -1 if there's no entry or no slot                                */
+   if (!entry) return -1;
+   bool is_font = (entry->type == BUNDLE_FONT);
+   int index = reserve_sheet(is_font, entry->fname, entry->name, entry->tile_w, entry->tile_h);
+   if (index < 0) return -1;
+   if (!bundle_verify_entry(&g_sheets.bundle, entry)) {
+      d_err("%s: checksum doesn't match for %s, run make bundle", BUNDLE_PATH, entry->fname);
+      return index;
+   }
+   LoadCallback callback = is_font ? font_loaded : sprite_loaded;
+   callback(INVALID_LOAD, LOAD_OK, bundle_get_image(&g_sheets.bundle, entry), (void*)(intptr_t)index);
+   return index;
+}
+
+static void resolve_bundle(void) {
+   // everything that hasn't been looked up yet. fonts that aren't a FontType
+   // can't be drawn with, so they stay in the bundle
+   const Bundle* bundle = &g_sheets.bundle;
+   for (ui32 i = 0; i < bundle->header->entry_count; i++) {
+      const BundleEntry* entry = &bundle->entries[i];
+      if (entry->type == BUNDLE_SPRITE) {
+         if (find_sprite(g_sheets.sprites, entry->name) < 0) resolve_entry(entry);
+         continue;
+      }
+      for (int t = 0; t < FONT_MAX; t++) {
+         if (strcmp(entry->fname, d_name_font((FontType)t)) == 0) resolve_font((FontType)t);
+      }
+   }
+}
+
+static bool scan_sheets(const char* wanted_type, LoadPriority priority) {
+   // queues every sheet of one type
+#ifdef _WIN32
+   WIN32_FIND_DATA find_data;
+   HANDLE find_handle;
+   char search_path[256];
+   snprintf(search_path, sizeof(search_path), "%s*.bmp", DIR_SHEETS);
+   
+   find_handle = FindFirstFile(search_path, &find_data);
+   if (find_handle == INVALID_HANDLE_VALUE) {
+      d_err("no bitmap files found in %s", DIR_SHEETS);
+      return false;
+   }
+   
+   do {
+      if (has_extension(find_data.cFileName, ".bmp")) {
+         queue_sheet(find_data.cFileName, wanted_type, priority);
+      }
+   } while (FindNextFile(find_handle, &find_data));
+   FindClose(find_handle);
+   
+#else
+   DIR* dir = opendir(DIR_SHEETS);
+   if (d_dne(dir)) {
+      d_log("could not open directory: %s", DIR_SHEETS);
+      return false;
+   }
+   
+   struct dirent* entry;
+   while ((entry = readdir(dir)) != NULL) {
+      if (has_extension(entry->d_name, ".bmp")) {
+         queue_sheet(entry->d_name, wanted_type, priority);
+      }
+   }
+   closedir(dir);
+#endif
+   return true;
+}
 
-   // parse filename
+static bool queue_sheet(const char* fname, const char* wanted_type, LoadPriority priority) {
+   // the slot is taken now and filled in when the load comes back,
+   // so indices don't depend on which load finishes first
    char type[64], name[128];
    int tile_w, tile_h;
-   if (!parse_sheet_filename(fname, type, name, &tile_w, &tile_h)) {
-      d_log("couldn't parse filename: %s", fname);
-      return 0;
+   if (!file_parse_sheet_filename(fname, type, name, &tile_w, &tile_h)) {
+      if (strcmp(wanted_type, "font") == 0) d_log("couldn't parse filename: %s", fname); // once is enough
+      return false;
+   }
+   if (strcmp(type, wanted_type) != 0) {
+      if (strcmp(wanted_type, "font") == 0 && strcmp(type, "sprite") != 0) {
+         d_log("unknown resource type '%s' in file %s", type, fname);
+      }
+      return false;
    }
 
-   ImageData* image_data = load_bitmap(full_path);
-   if (d_dne(image_data)) {
-      d_log("failed to load bitmap: %s", fname);
-      return 0;
+   if (g_sheets.load_count >= g_sheets.load_capacity) {
+      int new_capacity = g_sheets.load_capacity ? g_sheets.load_capacity * 2 : 16;
+      SheetLoad* new_loads = realloc(g_sheets.loads, sizeof(SheetLoad) * new_capacity);
+      if (d_dne(new_loads)) return false;
+      g_sheets.loads = new_loads;
+      g_sheets.load_capacity = new_capacity;
    }
 
-   int image_w = image_data->width / tile_w;
-   int image_h = image_data->height / tile_h;
+   bool is_font = (strcmp(type, "font") == 0);
+   int index = reserve_sheet(is_font, fname, name, tile_w, tile_h);
+   if (index < 0) return false;
+   LoadCallback callback = is_font ? font_loaded : sprite_loaded;
 
-   if (image_data->width % tile_w != 0 || image_data->height % tile_h != 0) {
-      d_log("WARNING: %s has partial tiles - truncating to %dx%d tiles",
-            fname, image_w, image_h);
-      d_logl("      (not implemented yet)\n");
-   }
+   char full_path[512];
+   snprintf(full_path, sizeof(full_path), "%s%s", DIR_SHEETS, fname);
+   LoadHandle handle = loader_request(full_path, priority, load_sheet, callback, (void*)(intptr_t)index);
+   if (handle == INVALID_LOAD) return false; // the slot stays empty, lookups skip it
+   g_sheets.loads[g_sheets.load_count++] = (SheetLoad){ handle, is_font };
+   return true;
+}
 
-   verify_image_colors(image_data);
+static int reserve_sheet(bool is_font, const char* fname, const char* name, int tile_w, int tile_h) {
+   // takes the next font/sprite slot, data stays NULL until an image is handed over. -1 on failure
+   char* fname_copy = malloc(strlen(fname) + 1);
+   if (d_dne(fname_copy)) {
+      d_err("couldn't allocate sheet filename");
+      return -1;
+   }
+   strcpy(fname_copy, fname);
 
-   if (strcmp(type, "font") == 0) {
+   int index;
+   if (is_font) {
+      FontArray* fonts = g_sheets.fonts;
       // expand font array if needed
       if (fonts->font_count >= fonts->font_capacity) {
-         fonts->font_capacity *= 2;
-         Font* new_fonts = realloc(fonts->fonts, sizeof(Font) * fonts->font_capacity);
+         Font* new_fonts = realloc(fonts->fonts, sizeof(Font) * fonts->font_capacity * 2);
          if (d_dne(new_fonts)) {
             d_err("couldn't resize font array");
-            free(image_data);
-            return 0;
+            free(fname_copy);
+            return -1;
          }
          fonts->fonts = new_fonts;
+         fonts->font_capacity *= 2;
       }
-
-      Font* font = &fonts->fonts[fonts->font_count++];
-      font->fname = malloc(strlen(fname) + 1);
-      if (d_dne(font->fname)) {
-         d_err("couldn't allocate font filename");
-         free(image_data);
-         return 0;
-      }
-      strcpy((char*)font->fname, fname);
+      index = fonts->font_count++;
+      Font* font = &fonts->fonts[index];
+      memset(font, 0, sizeof(Font));
+      font->fname = fname_copy;
       font->tile_w = tile_w;
       font->tile_h = tile_h;
-      font->image_w = image_w;
-      font->image_h = image_h;
-      font->data = image_data;
       font->ascii_start = 33;
-   } else if (strcmp(type, "sprite") == 0) {
+      font->type = FONT_MAX;
+      for (int t = 0; t < FONT_MAX; t++) {
+         if (strcmp(fname, d_name_font((FontType)t)) != 0) continue;
+         font->type = (FontType)t;
+         if (fonts->by_type[t] == 0) fonts->by_type[t] = index + 1; // the first sheet keeps it
+         break;
+      }
+   } else {
+      SpriteArray* sprites = g_sheets.sprites;
       if (sprites->sprite_count >= sprites->sprite_capacity) {
-         sprites->sprite_capacity *= 2;
-         Sprite* new_sprites = realloc(sprites->sprites, sizeof(Sprite) * sprites->sprite_capacity);
+         Sprite* new_sprites = realloc(sprites->sprites, sizeof(Sprite) * sprites->sprite_capacity * 2);
          if (d_dne(new_sprites)) {
             d_err("couldn't resize sprite array");
-            free(image_data);
-            return 0;
+            free(fname_copy);
+            return -1;
          }
          sprites->sprites = new_sprites;
+         sprites->sprite_capacity *= 2;
       }
-
-      Sprite* sprite = &sprites->sprites[sprites->sprite_count++];
-      sprite->fname = malloc(strlen(fname) + 1);
-      if (d_dne(sprite->fname)) {
-         d_err("couldn't allocate sprite filename");
-         free(image_data);
-         return 0;
-      }
-      strcpy((char*)sprite->fname, fname);
+      index = sprites->sprite_count++;
+      Sprite* sprite = &sprites->sprites[index];
+      memset(sprite, 0, sizeof(Sprite));
+      sprite->fname = fname_copy;
       sprite->tile_w = tile_w;
       sprite->tile_h = tile_h;
-      sprite->image_w = image_w;
-      sprite->image_h = image_h;
-      sprite->data = image_data;
-      strcpy(sprite->name, name);
-   } else {
-      d_log("unknown resource type '%s' in file %s", type, fname);
-      free(image_data);
+      snprintf(sprite->name, sizeof(sprite->name), "%s", name);
+      if (!index_sprite(sprites, index)) d_log("WARNING: %s can't be looked up by name", fname);
    }
-   return 1;
+   return index;
+}
+
+static void* load_sheet(const char* path, void* user) {
+   // I/O thread, only reads the file
+   (void)user;
+   ui64 start_us = timing_get_time_us();
+   ImageData* image_data = file_load_bitmap(path);
+   if (!image_data) return NULL;
+   d_logv(3, "decoded %s (%dx%d, %u bytes) in %.2f ms", path, image_data->width, image_data->height,
+          image_data->size, (timing_get_time_us() - start_us) / 1000.0);
+   return image_data;
+}
+
+static void font_loaded(LoadHandle handle, LoadResult result, void* data, void* user) {
+   count_finished_load(handle);
+   if (result == LOAD_CANCELLED) {
+      free(data);
+      return;
+   }
+   Font* font = &g_sheets.fonts->fonts[(intptr_t)user];
+   if (!sheet_loaded(font->fname, result, data, font->tile_w, font->tile_h, &font->image_w, &font->image_h)) return;
+   font->data = data;
+   bake_glyph_rows(font);
+}
+
+static void sprite_loaded(LoadHandle handle, LoadResult result, void* data, void* user) {
+   count_finished_load(handle);
+   if (result == LOAD_CANCELLED) {
+      free(data);
+      return;
+   }
+   Sprite* sprite = &g_sheets.sprites->sprites[(intptr_t)user];
+   if (!sheet_loaded(sprite->fname, result, data, sprite->tile_w, sprite->tile_h, &sprite->image_w, &sprite->image_h)) return;
+   sprite->data = data;
+   sprite->frame_count = sprite->image_w * sprite->image_h;
+   bake_sprite_spans(sprite);
+   if (sprite->pixels) {
+      // the packed runs are all drawing needs, test_sprite_blit (test/) decodes its own copy to check against
+      free_image(sprite->data);
+      sprite->data = NULL;
+   }
+}
+
+static void count_finished_load(LoadHandle handle) {
+   // every queued load comes back exactly once, whether it worked, failed or was cancelled.
+   // sheets out of the bundle never went through the loader
+   if (handle == INVALID_LOAD) return;
+   if (++g_sheets.loads_finished == g_sheets.load_count) {
+      d_logv(2, "%d sheet loads finished in %.2f ms (%d fonts, %d sprites)", g_sheets.load_count,
+             (timing_get_time_us() - g_sheets.start_us) / 1000.0, g_sheets.fonts->font_count, g_sheets.sprites->sprite_count);
+   }
+}
+
+static bool sheet_loaded(const char* fname, LoadResult result, ImageData* image_data, int tile_w, int tile_h,
+                         int* image_w, int* image_h) {
+   // the part both callbacks share. false = nothing to hand over
+   if (result == LOAD_OK) d_logv(3, "%s came in after %.2f ms", fname, (timing_get_time_us() - g_sheets.start_us) / 1000.0);
+   else d_log("failed to load bitmap: %s", fname);
+   if (result != LOAD_OK) return false;
+
+   *image_w = image_data->width / tile_w;
+   *image_h = image_data->height / tile_h;
+   if (image_data->width % tile_w != 0 || image_data->height % tile_h != 0) {
+      d_log("WARNING: %s has partial tiles - truncating to %dx%d tiles",
+            fname, *image_w, *image_h);
+      d_logl("      (not implemented yet)\n");
+   }
+   return true;
 }
 
 static void cleanup_sheets(FontArray* fonts, SpriteArray* sprites) {
    if (fonts && fonts->fonts) {
       for (int i = 0; i < fonts->font_count; i++) {
          free((char*)fonts->fonts[i].fname);
-         free(fonts->fonts[i].data);
+         free_image(fonts->fonts[i].data);
+         free(fonts->fonts[i].glyph_rows);
       }
       free(fonts->fonts);
       fonts->fonts = NULL;
@@ -340,26 +744,220 @@ static void cleanup_sheets(FontArray* fonts, SpriteArray* sprites) {
    if (sprites && sprites->sprites) {
       for (int i = 0; i < sprites->sprite_count; i++) {
          free((char*)sprites->sprites[i].fname);
-         free(sprites->sprites[i].data);
+         free_image(sprites->sprites[i].data);
+         free(sprites->sprites[i].spans);
+         free(sprites->sprites[i].rows);
+         free(sprites->sprites[i].pixels);
       }
       free(sprites->sprites);
       sprites->sprites = NULL;
       sprites->sprite_count = 0;
       sprites->sprite_capacity = 0;
+      SAFE_FREE(sprites->lookup);
+      sprites->lookup_size = 0;
    }
 }
 
-static void align_color(ui32* color) {
-   (void)color;
-   // if color is not in palette, change to nearest color
+static void free_image(ImageData* image_data) {
+   if (!bundle_owns(&g_sheets.bundle, image_data)) free(image_data);
+}
+
+static void build_palette_lut(void) {
+   if (g_palette_lut.built) return;
+   ui64 start_us = timing_get_time_us();
+   memset(g_palette_lut.exact_rgb, 0xFF, sizeof(g_palette_lut.exact_rgb)); // all PALETTE_EXACT_EMPTY
+   for (int i = 0; i < PALETTE_SIZE; i++) add_exact_color(palette[i] >> 8, (ui8)i); // RRGGBBAA
+   // every sheet is drawn with pure black, which isn't in the palette. it's
+   // meant as mono-black, so it shouldn't warn like a color that's actually wrong
+   add_exact_color(0x000000, PALETTE_BLACK_INDEX);
+
+   // each cell goes to whatever is nearest its center
+   const int shift = 8 - PALETTE_LUT_BITS;
+   const int half = 1 << (shift - 1);
+   for (ui32 cell = 0; cell < PALETTE_LUT_SIZE; cell++) {
+      ui32 r = ((cell >> (PALETTE_LUT_BITS * 2)) << shift) | half;
+      ui32 g = (((cell >> PALETTE_LUT_BITS) & ((1 << PALETTE_LUT_BITS) - 1)) << shift) | half;
+      ui32 b = ((cell & ((1 << PALETTE_LUT_BITS) - 1)) << shift) | half;
+      g_palette_lut.cube[cell] = nearest_palette_index((r << 16) | (g << 8) | b);
+   }
+   g_palette_lut.built = true;
+   d_logv(3, "built the palette cube (%d cells) in %.2f ms", PALETTE_LUT_SIZE,
+          (timing_get_time_us() - start_us) / 1000.0);
 }
 
-static void verify_image_colors(ImageData* image_data) {
-   // TODO: finish this pls
-   (void)image_data;
-   ui32 color = 0; // temp
-   align_color(&color);
-   // load ImageData, make sure all colors match palette
-   // if not, warn and change colors to closest matching in image_data
+static void add_exact_color(ui32 rgb, ui8 index) {
+   ui32 slot = (rgb * 2654435761u) >> (32 - PALETTE_EXACT_BITS);
+   while (g_palette_lut.exact_rgb[slot] != PALETTE_EXACT_EMPTY && g_palette_lut.exact_rgb[slot] != rgb) {
+      slot = (slot + 1) & (PALETTE_EXACT_SLOTS - 1);
+   }
+   if (g_palette_lut.exact_rgb[slot] == rgb) return; // same color twice, the first index wins
+   g_palette_lut.exact_rgb[slot] = rgb;
+   g_palette_lut.exact_index[slot] = index;
+}
+
+static ui8 align_color(ui32 rgb, bool* off_palette) {
+   // palette colors come back as themselves, everything else as the nearest one
+   ui32 slot = (rgb * 2654435761u) >> (32 - PALETTE_EXACT_BITS);
+   *off_palette = false;
+   while (g_palette_lut.exact_rgb[slot] != PALETTE_EXACT_EMPTY) {
+      if (g_palette_lut.exact_rgb[slot] == rgb) return g_palette_lut.exact_index[slot];
+      slot = (slot + 1) & (PALETTE_EXACT_SLOTS - 1);
+   }
+
+   const int shift = 8 - PALETTE_LUT_BITS;
+   ui32 cell = (((rgb >> 16) & 0xFF) >> shift) << (PALETTE_LUT_BITS * 2) |
+               (((rgb >> 8) & 0xFF) >> shift) << PALETTE_LUT_BITS |
+               ((rgb & 0xFF) >> shift);
+   *off_palette = true;
+   return g_palette_lut.cube[cell];
+}
+
+static void verify_image_colors(const char* fname, const ColorStats* stats) {
+   // the pixels are already moved to the palette, this just says so
+   if (stats->off_pixels == 0) return;
+   d_log("WARNING: %s has %u pixels off the palette (first one #%06X, now index %u)",
+         fname, stats->off_pixels, stats->example_rgb, stats->example_index);
    // later we can call modify_image_colors() to change the actual file
-}
\ No newline at end of file
+}
+
+static void bake_glyph_rows(Font* font) {
+   /* one bit per pixel, same test renderer_blit_masked() does per pixel: */
+   /* anything but the transparent index is ink                          */
+   font->glyph_rows = NULL;
+   font->glyph_count = font->image_w * font->image_h;
+   if (font->tile_w > 16) {
+      d_log("%s is too wide to bake (%d px), drawing it from the bitmap", font->fname, font->tile_w);
+      return;
+   }
+
+   font->glyph_rows = malloc(sizeof(uint16_t) * font->glyph_count * font->tile_h);
+   if (d_dne(font->glyph_rows)) return;
+
+   ImageData* image = font->data;
+   for (int g = 0; g < font->glyph_count; g++) {
+      int tile_x = (g % font->image_w) * font->tile_w;
+      int tile_y = (g / font->image_w) * font->tile_h;
+      for (int y = 0; y < font->tile_h; y++) {
+         const uint8_t* row = image->data + (tile_y + y) * image->width + tile_x;
+         uint16_t mask = 0;
+         for (int x = 0; x < font->tile_w; x++) {
+            if (row[x] != PALETTE_TRANSPARENT) mask |= (uint16_t)(1u << x);
+         }
+         font->glyph_rows[g * font->tile_h + y] = mask;
+      }
+   }
+   d_logv(3, "baked %d glyphs for %s (%zu bytes)", font->glyph_count, font->fname,
+          sizeof(uint16_t) * font->glyph_count * font->tile_h);
+}
+
+static int find_sprite(const SpriteArray* sprites, const char* name) {
+   // index into sprites, -1 if nothing has that name yet
+   if (!sprites->lookup) return -1;
+   ui32 mask = (ui32)sprites->lookup_size - 1;
+   for (ui32 slot = hash_sprite_name(name) & mask; sprites->lookup[slot] != 0; slot = (slot + 1) & mask) {
+      int index = sprites->lookup[slot] - 1;
+      if (strcmp(sprites->sprites[index].name, name) == 0) return index;
+   }
+   return -1;
+}
+
+static bool index_sprite(SpriteArray* sprites, int index) {
+   // sprites up to index are already in. growing rehashes all of them
+   if ((index + 1) * 2 > sprites->lookup_size) {
+      int new_size = sprites->lookup_size ? sprites->lookup_size * 2 : 32;
+      int* new_lookup = calloc(new_size, sizeof(int));
+      if (d_dne(new_lookup)) return false;
+      free(sprites->lookup);
+      sprites->lookup = new_lookup;
+      sprites->lookup_size = new_size;
+      for (int i = 0; i < index; i++) insert_sprite_name(sprites, i);
+   }
+   return insert_sprite_name(sprites, index);
+}
+
+static bool insert_sprite_name(SpriteArray* sprites, int index) {
+   // false if the name is already taken, the first sprite keeps it
+   const char* name = sprites->sprites[index].name;
+   ui32 mask = (ui32)sprites->lookup_size - 1;
+   ui32 slot = hash_sprite_name(name) & mask;
+   while (sprites->lookup[slot] != 0) {
+      if (strcmp(sprites->sprites[sprites->lookup[slot] - 1].name, name) == 0) return false;
+      slot = (slot + 1) & mask;
+   }
+   sprites->lookup[slot] = index + 1;
+   return true;
+}
+
+static ui32 hash_sprite_name(const char* name) {
+   return bundle_checksum(name, strlen(name)); // fnv-1a, same as the bundle checksums
+}
+
+static void bake_sprite_spans(Sprite* sprite) {
+   /* opaque runs of every row of every frame, so drawing never has to look */
+   /* at a transparent pixel. with SPRITE_RLE the runs' pixels are copied   */
+   /* out as well and the sheet isn't needed after this. everything is     */
+   /* counted first, then filled in                                         */
+   sprite->spans = NULL;
+   sprite->rows = NULL;
+   sprite->pixels = NULL;
+   int row_count = sprite->frame_count * sprite->tile_h;
+   if (row_count == 0) return;
+
+   const ImageData* image = sprite->data;
+   ui32 span_count = 0, pixel_count = 0;
+   for (int pass = 0; pass < 2; pass++) {
+      span_count = 0;
+      pixel_count = 0;
+      for (int f = 0; f < sprite->frame_count; f++) {
+         const uint8_t* frame_pixels = image->data + (size_t)(f / sprite->image_w) * sprite->tile_h * image->width +
+                                       (f % sprite->image_w) * sprite->tile_w;
+         for (int y = 0; y < sprite->tile_h; y++) {
+            if (sprite->rows) sprite->rows[f * sprite->tile_h + y] = (SpriteRow){ span_count, pixel_count };
+            ui32 opaque;
+            span_count += find_row_spans(frame_pixels + (size_t)y * image->width, sprite->tile_w,
+                                         sprite->spans ? sprite->spans + span_count : NULL,
+                                         sprite->pixels ? sprite->pixels + pixel_count : NULL, &opaque);
+            pixel_count += opaque;
+         }
+      }
+      if (pass == 1) break;
+
+      sprite->rows = malloc(sizeof(SpriteRow) * (row_count + 1));
+      sprite->spans = malloc(sizeof(SpriteSpan) * (span_count ? span_count : 1));
+      if (SPRITE_RLE) sprite->pixels = malloc(pixel_count ? pixel_count : 1);
+      if (d_dne(sprite->rows) || d_dne(sprite->spans) || (SPRITE_RLE && d_dne(sprite->pixels))) {
+         SAFE_FREE(sprite->rows);
+         SAFE_FREE(sprite->spans);
+         SAFE_FREE(sprite->pixels);
+         d_log("%s has no runs, drawing it from the bitmap", sprite->fname);
+         return;
+      }
+   }
+   sprite->rows[row_count] = (SpriteRow){ span_count, pixel_count };
+
+   size_t dense_bytes = sizeof(ImageData) + image->size;
+   size_t run_bytes = sizeof(SpriteSpan) * span_count + sizeof(SpriteRow) * (row_count + 1) +
+                      (sprite->pixels ? pixel_count : 0);
+   d_logv(3, "%s: %d frames, %u runs, %u of %d pixels opaque. %zu bytes of runs%s, %zu dense (%.1f%%)",
+          sprite->fname, sprite->frame_count, span_count, pixel_count, row_count * sprite->tile_w, run_bytes,
+          sprite->pixels ? " and pixels" : "", dense_bytes, 100.0 * run_bytes / dense_bytes);
+}
+
+static int find_row_spans(const uint8_t* row, int width, SpriteSpan* spans, uint8_t* pixels, ui32* opaque) {
+   // runs of anything but the transparent index. spans/pixels NULL just counts
+   int count = 0;
+   int last_end = 0;
+   *opaque = 0;
+   for (int x = 0; x < width;) {
+      while (x < width && row[x] == PALETTE_TRANSPARENT) x++;
+      int start = x;
+      while (x < width && row[x] != PALETTE_TRANSPARENT) x++;
+      if (x == start) break;
+      if (spans) spans[count] = (SpriteSpan){ (uint16_t)(start - last_end), (uint16_t)(x - start) };
+      if (pixels) memcpy(pixels + *opaque, row + start, x - start);
+      *opaque += x - start;
+      last_end = x;
+      count++;
+   }
+   return count;
+}
@@ -0,0 +1,76 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "def.h"
+#include "file.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// every sheet in one file, built offline by tools/pack.c (make bundle).
+// pixels are already palette indices and laid out as ImageData, so the
+// game maps the file and points fonts/sprites straight into it
+//
+// layout: BundleHeader, BundleEntry[entry_count], ui32 index[index_size],
+// then each entry's ImageData at image_offset (BUNDLE_ALIGN aligned). the
+// game only maps it at startup, each sheet is found through the index the
+// first time it's looked up
+
+#define BUNDLE_PATH "assets/sheets.bundle"
+#define BUNDLE_MAGIC "TFGB"
+#define BUNDLE_VERSION 3          // bump whenever the layout changes
+#define BUNDLE_NAME_MAX 64
+#define BUNDLE_ALIGN 16
+
+typedef enum {
+   BUNDLE_FONT,
+   BUNDLE_SPRITE
+} BundleType;
+
+typedef struct {
+   char magic[4];                 // BUNDLE_MAGIC
+   ui32 version;
+   ui32 palette_checksum;         // pixels are palette indices, another palette means a stale bundle
+   ui32 entry_count;
+   ui32 index_size;               // hash slots, power of two
+   ui32 table_checksum;           // entries + index
+} BundleHeader;
+
+typedef struct {
+   char fname[BUNDLE_NAME_MAX];   // sheet file name, what fonts are found by
+   char name[BUNDLE_NAME_MAX];    // parsed from fname, e.g. "guy-run", what sprites are found by
+   ui32 type;                     // BundleType
+   si32 tile_w;
+   si32 tile_h;
+   ui32 image_offset;             // ImageData, from the start of the file
+   ui32 image_size;               // sizeof(ImageData) + pixels
+   ui32 checksum;                 // over the ImageData
+} BundleEntry;
+
+typedef struct {
+   MappedFile file;
+   const BundleHeader* header;
+   const BundleEntry* entries;
+   const ui32* index;             // entry + 1, 0 = empty slot
+} Bundle;
+
+typedef struct {
+   const char* fname;
+   const char* name;
+   BundleType type;
+   int tile_w;
+   int tile_h;
+   const ImageData* image;
+} BundleSource;
+
+bool bundle_open(Bundle* bundle, const char* path); // checks the header and tables, not the pixels
+void bundle_close(Bundle* bundle);
+const BundleEntry* bundle_find(const Bundle* bundle, BundleType type, const char* key); // fonts by fname, sprites by name. NULL if it isn't in there
+ImageData* bundle_get_image(const Bundle* bundle, const BundleEntry* entry); // points into the mapping, don't free
+bool bundle_verify_entry(const Bundle* bundle, const BundleEntry* entry); // checksums the pixels
+bool bundle_owns(const Bundle* bundle, const void* pointer);
+
+bool bundle_write(const char* path, const BundleSource* sources, ui32 count); // tools/pack.c
+ui32 bundle_checksum(const void* bytes, size_t size);
+ui32 bundle_palette_checksum(void);
+
+#endif
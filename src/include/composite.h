@@ -0,0 +1,75 @@
+#ifndef COMPOSITE_H
+#define COMPOSITE_H
+
+#include "def.h"
+#include "renderer.h" // for Rect, PALETTE_SIZE
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+// expands 8-bit indexed layer pixels into a 32-bit surface
+// picked once at startup based on what the cpu supports
+
+typedef enum {
+   COMPOSITE_SCALAR,
+   COMPOSITE_SSE2,     // 16 pixels per iteration
+   COMPOSITE_AVX2,     // 32 pixels per iteration
+   COMPOSITE_MAX
+} CompositeKernel;
+
+// dst[i] = palette[src[i]] unless src[i] is transparent, blended by opacity (255 = copy)
+typedef void (*CompositeRowFunc)(ui32* dst, const ui8* src, int count, ui8 opacity);
+// dst[i] = src[i] unless src[i] is transparent (index to index, used by flatten)
+typedef void (*CompositeMergeFunc)(ui8* dst, const ui8* src, int count);
+
+#define COMPOSITE_BAND_HEIGHT 32 // rows per band handed to the job pool
+
+// called once per rect per band, with the rect clipped to the band
+typedef void (*CompositeBandFunc)(Rect rect, void* data);
+
+// one input to composite_flatten(), listed bottom to top
+typedef struct CompositeSource {
+   SDL_Surface* surface;   // 8-bit indexed, or NULL for a solid fill
+   int x, y;               // where the surface's (0,0) lands on dst
+   Rect fill;              // dst coords, only used when surface is NULL
+   ui8 fill_index;
+} CompositeSource;
+
+void composite_init(void); // picks the best kernel, called in renderer_init()
+void composite_cleanup(void);
+void composite_set_palette(const ui32* colors, int count, ui8 transparent_index); // colors in dst pixel format
+bool composite_set_kernel(CompositeKernel kernel); // false if the cpu can't run it
+CompositeKernel composite_get_kernel(void);
+bool composite_kernel_supported(CompositeKernel kernel);
+
+/* same clipping rules as SDL_BlitSurface. dst has to be 32-bit, otherwise */
+/* this falls back to SDL (using the surface's colorkey and alpha mod)     */
+void composite_blit(SDL_Surface* src, Rect src_rect, SDL_Surface* dst, int dst_x, int dst_y, ui8 opacity);
+void composite_row(ui32* dst, const ui8* src, int count, ui8 opacity);
+void composite_merge(ui8* dst, const ui8* src, int count); // index to index, skips transparent src pixels
+
+/* resolves the topmost non-transparent index of every source per pixel,  */
+/* then does one palette lookup and one write per pixel of rect. sources  */
+/* are treated as fully opaque, pixels no source covers are left alone    */
+void composite_flatten(const CompositeSource* sources, int count, SDL_Surface* dst, Rect rect);
+
+/* nearest-neighbour stretch of all of src over all of dst, like          */
+/* SDL_BlitScaled(src, NULL, dst, NULL), but only writes dst_rect. whole  */
+/* number scales replicate pixels, anything else uses a column table, and */
+/* rows that map to the same src row are memcpy'd from the one above      */
+void composite_scale(SDL_Surface* src, SDL_Surface* dst, Rect dst_rect);
+
+/* composite_flatten() and composite_scale() in one go, without the 32-bit */
+/* intermediate. sources are laid out on a virtual src_w x src_h surface   */
+/* and have to cover all of it, so start with a fill (uncovered pixels    */
+/* are undefined). false if dst isn't 32-bit                               */
+bool composite_flatten_scaled(const CompositeSource* sources, int count, int src_w, int src_h,
+                              SDL_Surface* dst, Rect dst_rect);
+bool composite_prepare_scale(int src_w, int dst_w); // call before scaling from more than one thread
+
+/* splits the rows covered by rects into bands and runs them on the job   */
+/* pool. each band calls func for every rect it crosses, in order, so no  */
+/* two threads touch the same row and the output matches a serial run.    */
+/* band times go to timing_add_band_times()                               */
+void composite_run_bands(const Rect* rects, int count, CompositeBandFunc func, void* data);
+
+#endif
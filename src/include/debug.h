@@ -35,6 +35,9 @@ static inline void d__var_int(int x, const char* name) {
 static inline void d__var_uint(unsigned int x, const char* name) {
    printf("%s = %u\n", name, x);
 }
+static inline void d__var_u64(ui64 x, const char* name) {
+   printf("%s = %llu\n", name, (unsigned long long)x);
+}
 static inline void d__var_float(double x, const char* name) {
    printf("%s = %f\n", name, x);
 }
@@ -54,6 +57,7 @@ static inline void d__var_ptr(void* x, const char* name) {
    int: d__var_int, \
    unsigned int: d__var_uint, \
    ui8: d__var_uint, \
+   ui64: d__var_u64, \
    float: d__var_float, \
    double: d__var_float, \
    char: d__var_char, \
@@ -72,11 +76,17 @@ const char* d_name_window_mode(WindowMode mode);
 const char* d_name_system_data(SystemData data);
 void d_print_renderer_dims(void);
 
+// COMPOSITE
+#include "composite.h" // for CompositeKernel
+const char* d_name_composite_kernel(CompositeKernel kernel);
+
 // FILE
 #include "file.h" // for FontType
 const char* d_name_font(FontType type);
 
 // TIMING
+#include "timing.h" // for FrameStage
+const char* d_name_frame_stage(FrameStage stage);
 void d_timing_print_state(void);
 void d_print_performance_info(void);
 
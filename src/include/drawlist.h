@@ -0,0 +1,64 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "def.h"
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+// per-frame buffer of layer draw calls, recorded instead of rasterized when
+// the renderer is in recording mode. memory is kept between frames, so after
+// the first few frames recording doesn't allocate
+
+#define DRAWLIST_MAX_OCCLUDERS 16 // opaque rects tracked per layer while culling
+
+typedef enum {
+   DRAW_RECT,     // solid rect, bounds is exactly what gets filled
+   DRAW_FILL,     // whole layer
+   DRAW_GLYPHS,   // text run, bounds covers every glyph
+   DRAW_SPRITE,   // one sprite frame, bounds covers the whole frame
+   DRAW_OP_MAX
+} DrawOp;
+
+typedef struct {
+   ui8 op;              // DrawOp
+   ui8 color_index;
+   ui8 font;            // FontType, DRAW_GLYPHS only
+   bool culled;         // set by drawlist_optimize(), skip it
+   ui16 layer;          // index into the renderer's layer array
+   ui16 text_length;    // DRAW_GLYPHS only
+   ui32 text_offset;    // into DrawList.text
+   ui32 sequence;       // submission order, keeps the sort stable
+   int x, y;            // DRAW_GLYPHS pen position or DRAW_SPRITE corner, as passed in
+   ui16 sprite;         // DRAW_SPRITE only, index into the renderer's sprite array
+   ui8 sprite_flags;    // SpriteFlags
+   ui32 frame;
+   SDL_Rect bounds;     // layer surface coords
+} DrawCommand;
+
+typedef struct {
+   DrawCommand* commands;
+   ui32 count;
+   ui32 capacity;
+   char* text;          // glyph runs, not null terminated
+   ui32 text_used;
+   ui32 text_capacity;
+
+   // what the last drawlist_optimize() did
+   ui32 last_count;
+   ui32 last_merged;
+   ui32 last_culled;
+} DrawList;
+
+bool drawlist_init(DrawList* list);
+void drawlist_free(DrawList* list);
+void drawlist_reset(DrawList* list); // keeps the memory
+
+DrawCommand* drawlist_push(DrawList* list); // NULL if it couldn't grow
+bool drawlist_push_text(DrawList* list, DrawCommand* command, const char* text, ui32 length);
+
+/* sorts by layer (submission order within a layer), then culls anything a */
+/* later opaque rect or fill on the same layer covers completely, and      */
+/* merges same-color rects that are next to each other into one           */
+void drawlist_optimize(DrawList* list);
+
+#endif
@@ -2,12 +2,15 @@
 #define FILE_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
 #define DIR_SHEETS "assets/sheets/" // includes fonts, sprites, and other tile textures
+#define SPRITE_RLE 1 // sprite frames kept as runs of opaque pixels, 0 keeps the dense sheet and runs point into it
 
-typedef struct { // TODO: make sure the data is 8-bit indexed colors
-   uint32_t size;
+typedef struct {
+   uint32_t size;    // bytes in data, one palette index per pixel, top row first
    int32_t width;
    int32_t height;
    uint8_t data[];
@@ -28,29 +31,46 @@ typedef enum {
 #define FONT_DEFAULT FONT_ACER_8_8
 
 typedef struct {
-   FontType type; // TODO: add to file_load_sheets 
+   FontType type; // FONT_MAX if the sheet isn't one of the FontTypes
    const char* fname;
    int tile_w;
    int tile_h;
    int image_w;
    int image_h;
-   ImageData* data;
+   ImageData* data; // NULL until its load comes back
    int ascii_start;
+   uint16_t* glyph_rows; // baked from data, tile_h masks per glyph, bit 0 = leftmost pixel. NULL if tile_w > 16
+   int glyph_count;
 } Font;
 
 typedef struct {
    Font* fonts;
    int font_count;
    int font_capacity;
+   int by_type[FONT_MAX]; // font index + 1 by FontType, 0 = no sheet for it
 } FontArray;
 
+typedef struct {
+   uint16_t skip;    // transparent pixels since the end of the last run (or the frame's left edge)
+   uint16_t length;  // opaque pixels to copy
+} SpriteSpan;
+
+typedef struct {
+   uint32_t first_span;  // into Sprite.spans, the row's runs go up to the next row's first_span
+   uint32_t first_pixel; // into Sprite.pixels, its opaque pixels back to back
+} SpriteRow;
+
 typedef struct {
    const char* fname;
    int tile_w;
    int tile_h;
    int image_w;
    int image_h;
-   ImageData* data;
+   ImageData* data; // NULL until its load comes back, sprites stream in after the first frame. dropped once packed into runs
+   int frame_count; // tiles, left to right then top to bottom. 0 until it has loaded
+   SpriteSpan* spans; // opaque runs of every frame row. NULL if they couldn't be built, data is sampled instead
+   SpriteRow* rows; // frame_count * tile_h + 1, row y of frame f is [f * tile_h + y]
+   uint8_t* pixels; // what the runs copy, NULL = straight out of data (SPRITE_RLE 0)
    char name[128]; // parsed name from filename (e.g., "guy-run")
 } Sprite;
 
@@ -58,11 +78,27 @@ typedef struct {
    Sprite* sprites;
    int sprite_count;
    int sprite_capacity;
+   int* lookup; // sprite index + 1 by name hash, 0 = empty slot. at most half full
+   int lookup_size; // power of two
 } SpriteArray;
 
-int file_load_sheets(FontArray* fonts, SpriteArray* sprites); // called once in renderer_init(), returns 0 on failure
+typedef struct {
+   const uint8_t* bytes;
+   size_t size;
+   void* file;     // windows handles, unused elsewhere
+   void* mapping;
+} MappedFile;
+
+int file_load_sheets(FontArray* fonts, SpriteArray* sprites); // called once in renderer_init(), queues on the loader. returns 0 on failure
+bool file_wait_sheets(bool fonts_only); // blocks until they're in, false if there's no font at all
 void file_unload_sheets(FontArray* fonts, SpriteArray* sprites);
 Font* file_get_font(FontArray* font_array, FontType type);
-Sprite* file_get_sprite(SpriteArray* sprites, const char* sprite_name);
+Sprite* file_get_sprite(SpriteArray* sprites, const char* sprite_name); // by parsed name, NULL while it's still loading
+
+// also used by tools/pack.c
+ImageData* file_load_bitmap(const char* fname); // palette indices, caller frees
+int file_parse_sheet_filename(const char* fname, char* type, char* name, int* tile_w, int* tile_h); // [type]_[name]_[w]x[h].bmp
+bool file_map(const char* fname, MappedFile* mapped); // read only
+void file_unmap(MappedFile* mapped);
 
 #endif
\ No newline at end of file
@@ -108,6 +108,9 @@ typedef struct {
    int player1_device;
    int player2_device;
    
+   // input_inject(), for scripted runs
+   bool injected[MAX_INPUT_DEVICES][INPUT_MAX];
+
    // input buffering for reliability
    bool input_buffer_enabled;
    float input_buffer_time;  // time to buffer inputs (in ms)
@@ -126,6 +129,7 @@ void input_cleanup_disconnected_devices(void);
 // mapping functions
 void input_setup_default_mappings(void);
 void input_add_mapping(int raw_key, InputEvent event, int device_id);
+void input_inject(InputEvent event, int device_id, bool held); // synthetic press, reads like a mapped key until released
 
 // context system
 void input_setup_handlers(void);
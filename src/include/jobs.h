@@ -0,0 +1,24 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "def.h"
+#include <stdbool.h>
+
+// persistent worker pool, started once in game_init()
+// jobs_run() hands out indices from a shared counter, so workers that
+// finish early just grab the next one. only one thread may call it at a
+// time (the render thread when pipelined, the main thread otherwise)
+
+#define JOBS_MAX_THREADS 32   // including the main thread
+#define JOBS_AUTO -1          // one worker per core, minus the main thread
+
+typedef void (*JobFunc)(int index, void* data);
+
+bool jobs_init(int worker_count); // 0 = everything runs on the main thread
+void jobs_cleanup(void);
+void jobs_run(JobFunc func, void* data, int count); // blocks until every index is done, main thread helps
+
+int jobs_get_thread_count(void); // workers + main thread
+int jobs_get_thread_index(void); // 0 on the main thread, 1.. on workers
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "def.h"
+#include <stdbool.h>
+
+// background file loading. loader_request() queues a path, one of the I/O
+// threads runs the request's LoadFunc on it (open, read, decode), and the
+// result comes back to the main thread through its LoadCallback, which only
+// ever runs inside loader_update() or loader_wait(). so callbacks can touch
+// game state without locking, and LoadFuncs shouldn't touch it at all
+//
+// higher priority requests are picked first, same priority goes in order
+
+#define LOADER_THREADS 1          // I/O threads started by game_init(), 0 = load inside loader_request()
+#define LOADER_MAX_THREADS 4
+#define LOADER_MAX_REQUESTS 128   // queued + in flight + waiting on their callback
+#define LOADER_MAX_PATH 256
+#define LOADER_SLOT_BITS 8        // LOADER_MAX_REQUESTS has to fit
+
+typedef ui32 LoadHandle;          // slot in the low bits, generation in the high bits
+#define INVALID_LOAD 0            // generations start at 1
+
+typedef enum {
+   LOAD_URGENT,         // needed for the next frame, e.g. the fonts
+   LOAD_NORMAL,
+   LOAD_BACKGROUND,     // streams in behind everything else
+   LOAD_PRIORITY_MAX
+} LoadPriority;
+
+typedef enum {
+   LOAD_FINISHED,       // callback already ran, or the handle was never valid
+   LOAD_QUEUED,
+   LOAD_RUNNING,        // on an I/O thread
+   LOAD_READY           // done, callback runs on the next loader_update()
+} LoadStatus;
+
+typedef enum {
+   LOAD_OK,
+   LOAD_FAILED,         // LoadFunc returned NULL
+   LOAD_CANCELLED       // data is NULL unless the LoadFunc had already finished, the callback owns it either way
+} LoadResult;
+
+typedef void* (*LoadFunc)(const char* path, void* user); // I/O thread, NULL = failed
+typedef void (*LoadCallback)(LoadHandle handle, LoadResult result, void* data, void* user); // main thread
+
+bool loader_init(int thread_count);
+void loader_cleanup(void); // anything still pending gets cancelled and called back
+
+LoadHandle loader_request(const char* path, LoadPriority priority, LoadFunc load, LoadCallback callback, void* user);
+void loader_cancel(LoadHandle handle); // skips the LoadFunc if it hasn't started, callback still runs
+LoadStatus loader_poll(LoadHandle handle);
+void loader_wait(LoadHandle handle); // blocks until it's done, then runs every ready callback
+ui32 loader_update(void); // runs ready callbacks, once per frame. returns how many ran
+ui32 loader_get_pending(void); // requests whose callback hasn't run yet
+
+#endif
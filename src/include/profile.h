@@ -0,0 +1,39 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "def.h"
+#include <stdbool.h>
+
+// zone profiler. PROFILE_BEGIN/PROFILE_END mark a named scope on whichever
+// thread runs them, and zones nest. every thread writes its finished zones
+// into its own ring, so recording never takes a lock. profile_export()
+// writes what's in the rings as chrome trace events (chrome://tracing or
+// ui.perfetto.dev)
+//
+// off unless profile_init() gets a path. while off, a zone is one branch on
+// g_profile_enabled. building with -DPROFILE_DISABLED removes them entirely
+
+#define PROFILE_RING_SIZE 16384   // zones kept per thread, power of two. older ones get overwritten
+#define PROFILE_MAX_THREADS 40    // main + render + job workers, anything past this isn't recorded
+#define PROFILE_MAX_DEPTH 32      // zones nested deeper than this aren't recorded
+
+#ifdef PROFILE_DISABLED
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END() ((void)0)
+#else
+extern bool g_profile_enabled;
+// name has to outlive the profiler, only the pointer is kept. use string literals
+#define PROFILE_BEGIN(name) do { if (__builtin_expect(g_profile_enabled, 0)) profile_begin(name); } while (0)
+#define PROFILE_END() do { if (__builtin_expect(g_profile_enabled, 0)) profile_end(); } while (0)
+#endif
+
+bool profile_init(const char* trace_path); // NULL leaves it off. call on the main thread
+void profile_cleanup(void); // other threads have to be done recording
+bool profile_export(void); // writes trace_path, fine to call while other threads record
+
+void profile_set_thread_name(const char* name); // shows up in the trace, call at the top of a thread
+
+void profile_begin(const char* name); // use the macros
+void profile_end(void);
+
+#endif
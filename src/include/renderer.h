@@ -8,8 +8,13 @@
 #define Rect SDL_Rect
 #define WINDOW_TITLE "teafeds cool game"
 
-typedef ui32 LayerHandle;
-#define INVALID_LAYER 0
+typedef ui32 LayerHandle;      // slot in the low bits, generation in the high bits
+#define INVALID_LAYER 0        // generations start at 1, so no live layer has this handle
+#define LAYER_SLOT_BITS 16
+#define LAYER_MAX_SLOTS (1 << LAYER_SLOT_BITS)
+#define LAYER_HANDLE_SLOT(handle) ((handle) & (LAYER_MAX_SLOTS - 1))
+#define LAYER_HANDLE_GENERATION(handle) ((handle) >> LAYER_SLOT_BITS)
+#define LAYER_NO_SLOT UINT32_MAX
 #define PALETTE_SIZE 36
 #define PALETTE_TRANSPARENT 35
 
@@ -19,6 +24,10 @@ typedef ui32 LayerHandle;
 #define GAME_HEIGHT_FWVGA 480
 
 #define RESIZE_DELAY 150 // ms
+#define MAX_DIRTY_RECTS 32          // per layer per frame, overflow grows the nearest rect
+#define DIRTY_FULL_THRESHOLD 60     // % of composite area dirty before falling back to full-frame
+#define SYSTEM_GRAPH_FRAMES 240     // columns in the frame time graph, one per frame. at most TIMING_HISTORY
+#define SYSTEM_GRAPH_HEIGHT 64      // px, the budget line sits halfway up
 
 typedef enum {
    RES_VGA,             // 640x480 (4:3)
@@ -42,17 +51,35 @@ typedef enum {
 typedef enum {
    SYS_CURRENT_FPS,  // -> timing_get_current_fps()
    SYS_AVG_FPS,      // -> timing_get_performance_info()
-   SYS_LAYER_COUNT,  // -> g_renderer
+   SYS_FRAME_GRAPH,  // -> timing_get_stage_history(), stacked bar per frame with a budget line
+   SYS_FRAME_COUNTERS, // -> g_renderer, layers / pixels composited / glyphs drawn last frame
    SYS_MAX
 } SystemData;
 
+typedef enum {
+   SPRITE_FLIP_NONE = 0,
+   SPRITE_FLIP_X = 1 << 0,    // mirrored left to right
+   SPRITE_FLIP_Y = 1 << 1     // upside down
+} SpriteFlags;
+
 typedef struct {
-   LayerHandle handle;
+   LayerHandle handle;        // INVALID_LAYER while the slot is free
+   ui16 generation;           // bumped every time the slot is freed, so old handles stop matching
+   ui32 next_free;            // free list link while the slot is free
    bool can_draw_outside_viewport;
    bool visible;
    ui8 opacity;     // 255 = fully opaque
    ui8 size;        // 2 = default (pixel size)
    SDL_Surface* surface;
+   SDL_Surface* mirror;                      // what the render thread reads when pipelined, NULL otherwise
+
+   // dirty tracking (surface coords)
+   Rect dirty_rects[MAX_DIRTY_RECTS];        // drawn since last renderer_clear()
+   ui32 dirty_count;
+   Rect prev_dirty_rects[MAX_DIRTY_RECTS];   // drawn last frame, cleared by renderer_clear()
+   ui32 prev_dirty_count;
+   ui8 base_color;                           // what renderer_clear() restores to, set by renderer_draw_fill()
+   bool base_resolved;                       // false until the first draw of the frame confirms base_color
 
    // TODO: other kind of float scaling based on perspective
    // TODO: group layers - layers can be part of multiple groups, and groups can have properties that affect all
@@ -62,11 +89,43 @@ typedef struct {
    // 
 // } LayerGroup;
 
+typedef struct {
+   SDL_Surface* surface;   // layer surface, or its mirror when pipelined
+   int x, y;               // where it sits on the composite
+   ui8 opacity;
+} FrameLayer;
+
+typedef struct {
+   /* everything compositing and presenting a frame needs, so the render thread */
+   /* never has to look at the layers the next frame is being drawn into        */
+   FrameLayer* layers;                      // visible layers in draw order, system layer last
+   ui32 layer_count;                        // room for layer_capacity
+   struct CompositeSource* sources;         // composite_rect() scratch, source_stride per job thread
+   ui32 source_stride;                      // layer_capacity + MAX_DIRTY_RECTS + 1
+   Rect dirty_rects[MAX_DIRTY_RECTS];       // composite coords
+   ui32 dirty_count;
+   Rect raw_rects[MAX_DIRTY_RECTS];
+   ui8 raw_rect_colors[MAX_DIRTY_RECTS];
+   ui32 raw_rect_count;
+   ui8 clear_color_index;
+   bool full_redraw;
+   bool fused;
+
+   // filled in by the render thread, handed to SDL_UpdateWindowSurfaceRects() on the main thread
+   Rect window_rects[MAX_DIRTY_RECTS];
+   int window_rect_count;
+   bool full_window;
+} FrameSnapshot;
+
 #include "file.h"
+#include "drawlist.h"
+#include "spritebatch.h"
+#include "textcache.h"
 typedef struct {
    bool initialized;
-   SDL_Window* window;
-   SDL_Surface* window_surface;     // window's surface for blitting
+   SDL_Window* window;              // NULL when headless
+   SDL_Surface* window_surface;     // window's surface for blitting, or a plain one when headless
+   bool headless;                   // never shown, SDL_UpdateWindowSurface() is skipped
    SDL_Surface* composite_surface;  // composite of all layers, same pixel format as window
    
    DisplayResolution display_resolution;
@@ -85,13 +144,49 @@ typedef struct {
    ui8 clear_color_index;
    ui8 transparent_color_index;
    
-   Layer* layers;                   // 8-bit indexed surfaces to be compiled on composite_surface
-   ui32 layer_count;
-   ui32 layer_capacity;
-   LayerHandle next_layer_handle;
+   Layer* layers;                   // slot table of 8-bit indexed surfaces, slots never move
+   ui32* draw_order;                // slots of live layers, bottom to top
+   ui32 layer_count;                // live layers
+   ui32 layer_capacity;             // slots allocated
+   ui32 slot_count;                 // slots handed out so far, free ones included
+   ui32 free_slot;                  // head of the free list, LAYER_NO_SLOT if empty
    LayerHandle system_layer_handle;
    bool system_layer_data[SYS_MAX];
 
+   Rect dirty_rects[MAX_DIRTY_RECTS];       // union of layer dirty rects this frame (composite coords)
+   ui32 dirty_count;
+   bool full_redraw;                        // set when something invalidates the whole composite
+   bool fused_present;                      // draw layers straight into window_surface when they're all opaque
+   bool composite_stale;                    // composite_surface skipped by a fused frame, rebuild before reading it
+   Rect raw_rects[MAX_DIRTY_RECTS];         // renderer_draw_rect_raw() calls this frame
+   ui8 raw_rect_colors[MAX_DIRTY_RECTS];
+   ui32 raw_rect_count;
+   Rect prev_raw_rects[MAX_DIRTY_RECTS];    // last frame's, they're gone this frame unless drawn again
+   ui32 prev_raw_rect_count;
+   bool raw_rects_overflowed;               // warned once that some were dropped
+
+   FrameSnapshot frame;                     // last frame handed off, owned by the render thread while in flight
+   bool pipelined;                          // composite frame N on render_thread while frame N+1 gets drawn
+   bool frame_in_flight;
+   bool render_thread_quit;
+   SDL_Thread* render_thread;
+   SDL_sem* frame_ready;                    // main -> render thread, frame is set up
+   SDL_sem* frame_done;                     // render thread -> main, window surface is done
+
+   DrawList draw_list;                      // layer draw calls waiting for flush_draw_list()
+   bool recording;                          // record draw calls instead of drawing them straight away
+   TextCache text_cache;                    // strings already rasterized, see draw_cached_run()
+   SpriteBatch sprite_batch;                // renderer_push_sprite() calls waiting for renderer_submit_sprites()
+
+   // SYS_FRAME_COUNTERS, the system layer's own drawing isn't counted
+   ui32 glyphs_drawn;                       // characters since renderer_present() started
+   ui32 last_glyphs_drawn;                  // the whole previous frame
+   ui32 last_pixels_composited;             // composite pixels in the last frame's dirty rects
+
+   // SYS_AVG_FPS, the percentile line only gets formatted again when they move
+   char percentile_text[64];
+   double percentile_text_ms[3];            // p50, p95, p99 it was formatted from
+
    FontArray font_array;
    SpriteArray sprite_array;
 } RendererState;
@@ -138,7 +233,7 @@ static const ui32 palette[PALETTE_SIZE] = {
 };
 
 // core functions
-bool renderer_init(float scale_factor);
+bool renderer_init(float scale_factor, bool headless); // headless renders into plain memory, no window
 void renderer_cleanup(void);
 void renderer_clear(void);
 void renderer_present(void); // call every frame
@@ -149,6 +244,10 @@ void renderer_set_display_resolution(DisplayResolution res);
 void renderer_set_window_mode(WindowMode mode);
 void renderer_set_resize_mode(ResizeMode mode);
 void renderer_set_clear_color(ui8 color_index);
+void renderer_set_fused_present(bool fused); // default true, false always goes through composite_surface
+void renderer_set_pipelined(bool pipelined); // default false, true adds a frame of latency
+void renderer_set_recording(bool recording); // default false, true defers layer draws to renderer_present()
+void renderer_set_text_cache_bytes(size_t max_bytes); // default TEXTCACHE_MAX_BYTES, 0 draws every string glyph by glyph
 int* renderer_get_display_resolution(void);
 int* renderer_get_window_mode(void);
 int* renderer_get_resize_mode(void);
@@ -170,6 +269,11 @@ void renderer_draw_fill(LayerHandle handle, ui8 color_index);
 #include "file.h"
 void renderer_draw_char(LayerHandle handle, FontType font_type, char c, int x, int y, ui8 color_index);
 void renderer_draw_string(LayerHandle handle, FontType font_type, const char* str, int x, int y, ui8 color_index);
+Sprite* renderer_get_sprite(const char* name); // e.g. "guy-run", NULL until it has loaded
+void renderer_draw_sprite(LayerHandle handle, const Sprite* sprite, int frame, int x, int y, ui8 flags); // SpriteFlags, scaled by the layer size
+void renderer_begin_sprites(void);
+void renderer_push_sprite(LayerHandle handle, const Sprite* sprite, int frame, int x, int y, ui8 flags); // same as renderer_draw_sprite(), later
+void renderer_submit_sprites(void); // sorts what was pushed by layer and sheet (see spritebatch.h), culls and draws it
 
 // system layer
 void renderer_toggle_system_data(SystemData data, bool display);
@@ -22,8 +22,8 @@ typedef enum {
 
 typedef struct {
    void (*init)(void);
-   void (*update)(float delta_time);
-   void (*render)(void);
+   void (*update)(float delta_time);   // one fixed step, delta_time is always timing_get_sim_delta()
+   void (*render)(float alpha);        // alpha is how far between the last two steps to draw, 0 to 1
    void (*destroy)(void);
 } Scene;
 
@@ -53,15 +53,19 @@ void scene_destroy(void);
 void scene_change_to(SceneType type);
 void scene_start_game_session(GameModeType mode);
 void scene_reset_session(void);
+SceneType scene_get_current(void);
 
 // note: init() sets up scene but doesn't draw
 //       render() always draws scene state
 //       update() modifies what render() will draw
+//       update() can run 0 or several times between renders, so anything
+//       that moves should keep where it was last step and render() draws
+//       in between using alpha
 
 // TITLE
 void title_scene_init(void);
 void title_scene_update(float delta_time);
-void title_scene_render(void);
+void title_scene_render(float alpha);
 void title_scene_destroy(void);
 
 void title_scene_handle_input(InputEvent event, InputState state, int device_id);
@@ -69,7 +73,7 @@ void title_scene_handle_input(InputEvent event, InputState state, int device_id)
 // MAIN MENU
 void main_menu_scene_init(void);
 void main_menu_scene_update(float delta_time);
-void main_menu_scene_render(void);
+void main_menu_scene_render(float alpha);
 void main_menu_scene_destroy(void);
 
 void main_menu_handle_scene_change(SceneType new_scene);
@@ -78,7 +82,7 @@ void main_menu_handle_game_setup(GameModeType mode);
 // CHARACTER SELECT
 void character_select_scene_init(void);
 void character_select_scene_update(float delta_time);
-void character_select_scene_render(void);
+void character_select_scene_render(float alpha);
 void character_select_scene_destroy(void);
 
 void device_select_handle_input(InputEvent event, InputState state, int device_id);
@@ -87,7 +91,7 @@ void character_select_handle_scene_change(SceneType new_scene);
 // SETTINGS
 void settings_scene_init(void);
 void settings_scene_update(float delta_time);
-void settings_scene_render(void);
+void settings_scene_render(float alpha);
 void settings_scene_destroy(void);
 
 void settings_handle_scene_change(SceneType new_scene);
@@ -95,7 +99,7 @@ void settings_handle_scene_change(SceneType new_scene);
 // GAMEPLAY
 void gameplay_scene_init(void);
 void gameplay_scene_update(float delta_time);
-void gameplay_scene_render(void);
+void gameplay_scene_render(float alpha);
 void gameplay_scene_destroy(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include "def.h"
+#include "file.h"
+#include <stdbool.h>
+
+// sprites pushed between renderer_begin_sprites() and renderer_submit_sprites().
+// pushing only appends, the submit sorts them by layer then sheet so every
+// layer is looked up and bounds checked once, and a sheet's runs stay in
+// cache while its sprites are drawn. memory is kept between batches
+//
+// sprites from the same sheet keep their push order on a layer, different
+// sheets don't. overlapping sprites from different sheets that have to stack
+// a certain way go on different layers or in separate batches
+
+#define SPRITEBATCH_START_SPRITES 256
+#define SPRITEBATCH_NO_SHEET UINT16_MAX  // not from the renderer's sprite array, sorts after the rest
+
+typedef struct {
+   ui64 key;            // layer slot, sheet, push order. what the batch sorts on
+   ui32 layer;          // LayerHandle
+   const Sprite* sprite;
+   int frame;
+   int x, y;            // as pushed, viewport coords
+   ui8 flags;           // SpriteFlags
+} SpriteInstance;
+
+typedef struct {
+   SpriteInstance* sprites;
+   ui32 count;
+   ui32 capacity;
+   bool open;           // between begin and submit
+
+   // what the last submit did
+   ui32 last_count;
+   ui32 last_culled;    // entirely outside what their layer can draw on
+   ui32 last_layers;
+} SpriteBatch;
+
+bool spritebatch_init(SpriteBatch* batch);
+void spritebatch_free(SpriteBatch* batch);
+void spritebatch_reset(SpriteBatch* batch); // keeps the memory
+
+SpriteInstance* spritebatch_push(SpriteBatch* batch, ui16 layer_slot, ui16 sheet); // NULL if it couldn't grow
+void spritebatch_sort(SpriteBatch* batch); // by layer slot, then sheet, then push order
+
+#endif
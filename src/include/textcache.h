@@ -0,0 +1,60 @@
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include "def.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+// bounded lru of rasterized text runs, keyed by font, text, color and layer
+// size. a run is one 8-bit strip of palette indices, transparent wherever
+// there's no ink, so drawing the same string again is a masked copy per row
+
+#define TEXTCACHE_MAX_BYTES (512 * 1024) // strip pixels + key text
+#define TEXTCACHE_MAX_RUNS 256
+#define TEXTCACHE_BUCKETS 512            // power of two
+#define TEXTCACHE_NONE UINT16_MAX
+
+typedef struct {
+   ui32 hash;
+   ui8 font;            // index into the font array
+   ui8 color_index;
+   ui8 size;            // layer size the strip was rasterized at
+   ui16 length;
+   int w, h;
+   ui8* pixels;         // w * h, pitch is w. NULL if the slot is free
+   char* text;          // right after the pixels, not null terminated
+   ui16 prev, next;     // lru order, most recent at the head. next is the free list when unused
+   ui16 bucket_next;
+} TextRun;
+
+typedef struct {
+   TextRun runs[TEXTCACHE_MAX_RUNS];
+   ui16 buckets[TEXTCACHE_BUCKETS];
+   ui16 head, tail;
+   ui16 free_run;
+   ui32 run_count;
+   size_t bytes;
+   size_t max_bytes;
+
+   // since textcache_init(), textcache_clear() keeps them
+   ui32 hits;
+   ui32 misses;
+   ui32 evictions;
+} TextCache;
+
+void textcache_init(TextCache* cache, size_t max_bytes);
+void textcache_free(TextCache* cache);
+void textcache_clear(TextCache* cache);
+void textcache_set_max_bytes(TextCache* cache, size_t max_bytes); // evicts down to the new cap
+
+// NULL on a miss. a hit becomes the most recently used run
+const TextRun* textcache_find(TextCache* cache, ui8 font, ui8 color_index, ui8 size,
+                              const char* text, ui32 length);
+
+/* adds a w x h run with uninitialized pixels for the caller to fill,     */
+/* evicting the least recently used runs until it fits. NULL if it can't */
+/* fit at all or the allocation failed                                    */
+TextRun* textcache_insert(TextCache* cache, ui8 font, ui8 color_index, ui8 size,
+                          const char* text, ui32 length, int w, int h);
+
+#endif
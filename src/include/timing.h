@@ -7,44 +7,144 @@
 
 // #define time float
 
+#define TIMING_MAX_BANDS 256 // compositor bands kept per frame
+#define TIMING_HISTORY 512   // frame times kept for percentiles, about 8 seconds at 60 fps
+#define TIMING_PERCENTILE_FRAMES 30 // the history is only re-sorted once it has moved this far
+#define TIMING_NS_PER_MS 1000000ull
+#define TIMING_NS_PER_SEC 1000000000ull
+#define TIMING_SPIN_NS 1000000ull     // the limiter stops sleeping this long before the deadline, then spins
+#define TIMING_SPIN_MAX_NS 4000000ull // cap on how far a sleepy OS can push that out
+#define TIMING_SPIN_DECAY 16          // each on-time sleep takes 1/16 of the extra spin back off
+#define TIMING_SIM_HZ 60              // fixed simulation rate, independent of target_fps
+#define TIMING_MAX_SIM_STEPS 5        // per rendered frame, anything past this is dropped instead of caught up
+#define TIMING_SNAP_NS 200000ull      // frame times this close to a whole number of frames count as exactly that
+
+typedef enum {
+   STAGE_EVENTS,        // game_handle_events()
+   STAGE_UPDATE,        // game_update()
+   STAGE_SCENE,         // scene_render(), inside renderer_present()
+   STAGE_RENDER,        // the rest of renderer_present() on the main thread, minus waiting and presenting
+   STAGE_COMPOSITE,     // compositing + scaling, on the render thread when pipelined
+   STAGE_PRESENT,       // SDL_UpdateWindowSurface(Rects), 0 when headless
+   STAGE_PRESENT_WAIT,  // main thread blocked on the render thread
+   STAGE_MAX
+} FrameStage;
+
+// everything in ms, but fractional. percentiles are over the last TIMING_HISTORY frames,
+// as of up to TIMING_PERCENTILE_FRAMES ago
+typedef struct {
+   double last_ms;
+   double min_ms;          // since timing_init()
+   double max_ms;
+   double avg_ms;          // mean of the history
+   double p50_ms;
+   double p95_ms;
+   double p99_ms;
+   ui32 frames_over;       // since timing_init()
+   ui32 samples;           // frames in the history
+
+   // frame limiter, how far past the deadline timing_wait_for_next_frame() returned
+   double pace_last_ms;
+   double pace_avg_ms;     // since timing_init()
+   double pace_max_ms;
+   ui32 frames_missed;     // deadline had already passed before waiting
+
+   // fixed timestep
+   ui32 sim_steps_last;    // steps run for the last frame
+   ui32 sim_steps_total;
+   double sim_dropped_ms;  // simulation time thrown away by TIMING_MAX_SIM_STEPS
+} TimingStats;
+
 typedef struct {
    ui32 target_fps;
-   ui32 target_frame_time; // ms per frame
-   ui32 frame_start_time;
-   ui32 last_frame_time;
+   ui64 target_frame_ns;
+   ui64 frame_start_ns;
+   ui64 prev_frame_start_ns; // for timing_get_delta_time()
+   ui64 last_frame_ns;
    ui32 frame_count;
    
    // performance tracking
-   ui32 min_frame_time;
-   ui32 max_frame_time;
-   ui32 avg_frame_time;
-   ui32 frames_over_budget; // incremented if frame took longer than target_frame_time
+   ui64 min_frame_ns;
+   ui64 max_frame_ns;
+   ui32 frames_over_budget; // incremented if frame took longer than target_frame_ns
+
+   ui64 frame_history[TIMING_HISTORY]; // ring of frame times in ns, oldest gets overwritten
+   ui32 stage_history[TIMING_HISTORY][STAGE_MAX]; // us, stage times as of each frame's end, same ring position
+   ui32 history_next;
+   ui32 history_count;
+   TimingStats stats;                  // cached by timing_get_frame_stats(), once per frame
+   ui32 stats_frame;
+   ui32 percentile_frame;              // when the history was last sorted for stats
    
-   ui32 game_start_time;
-   ui32 total_game_time; // updated on frame end
+   ui64 game_start_ns;
+   ui64 total_game_ns; // updated on frame end
+
+   // frame limiter
+   ui64 deadline_ns;        // absolute, when the next frame should start. 0 until the first wait
+   ui64 spin_ns;            // grows if sleeps overshoot, eases back while they don't. starts at TIMING_SPIN_NS
+   ui64 pace_last_ns;
+   ui64 pace_max_ns;
+   ui64 pace_total_ns;
+   ui32 pace_count;
+   ui32 frames_missed;
+
+   // fixed timestep, see timing_advance_simulation()
+   ui64 sim_step_ns;
+   ui64 sim_accumulator_ns; // real time not simulated yet, always < sim_step_ns after advancing
+   ui64 sim_dropped_ns;
+   ui32 sim_steps_last;
+   ui32 sim_steps_total;
+   float sim_alpha;
+
+   // compositor bands, reset on frame start
+   ui32 band_times[TIMING_MAX_BANDS]; // us
+   ui32 band_count;
+
+   ui32 stage_times[STAGE_MAX]; // us, most recent of each
 } TimingState;
 
 typedef struct {
-   ui32 start_time;
+   ui64 start_ns;
 } Timer;
 
 void timing_init(ui32 target_fps);
 void timing_frame_start(void);
 void timing_frame_end(void);
 bool timing_should_limit_frame(void); // true if last frame was quicker than target frame time
+void timing_wait_for_next_frame(void); // sleeps, then spins, until the next frame's deadline
 
-ui32 timing_get_last_frame_time(void);
-ui32 timing_get_frame_duration(void);
-float timing_get_delta_time(void); // last frame time in seconds
+ui32 timing_get_last_frame_time(void); // ms, rounded down
+ui64 timing_get_last_frame_ns(void);
+ui32 timing_get_frame_duration(void); // ms left in the frame budget, rounded down
+float timing_get_delta_time(void); // seconds between the last two frame starts, fractional
 ui32 timing_get_frame_count(void);
+
+/* fixed timestep. once per frame after timing_frame_start(), returns how */
+/* many steps of timing_get_sim_delta() to simulate (0 to                 */
+/* TIMING_MAX_SIM_STEPS). render then draws between the previous and the  */
+/* latest simulated state using timing_get_sim_alpha()                    */
+ui32 timing_advance_simulation(void);
+float timing_get_sim_delta(void); // seconds per step
+float timing_get_sim_alpha(void); // 0 = previous step, 1 = latest. 1 if nothing is advancing the simulation
 ui32 timing_get_game_time_ms(void);
 float timing_get_current_fps(void);
 
 
 Timer* timer_start(void);
-ui32 timer_end(Timer* timer);
+ui32 timer_end(Timer* timer); // ms
+
+ui64 timing_get_time_ns(void); // performance counter, for anything finer than a frame
+ui64 timing_get_time_us(void);
+void timing_record_stage(FrameStage stage, ui32 us); // safe from the render thread
+ui32 timing_get_stage_time(FrameStage stage);
+const ui32* timing_get_stage_history(ui32 frames_ago); // STAGE_MAX us times, 0 = last finished frame. NULL past the history
+ui64 timing_get_target_frame_ns(void);
+
+void timing_add_band_times(const ui32* band_us, ui32 count); // anything past TIMING_MAX_BANDS is dropped
+const ui32* timing_get_band_times(ui32* count); // this frame's so far
 
-void timing_get_performance_info(ui32* min_ms, ui32* max_ms, ui32* avg_ms, ui32* frames_over);
+void timing_get_performance_info(ui32* min_ms, ui32* max_ms, ui32* avg_ms, ui32* frames_over); // rounded down
+void timing_get_frame_stats(TimingStats* stats);
 const TimingState* timing_get_debug_state(void); // read-only pointer
 
 #endif
\ No newline at end of file
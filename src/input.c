@@ -1,6 +1,7 @@
 #include "timing.h"
 #include "input.h"
 #include "debug.h"
+#include "profile.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -33,6 +34,7 @@ void input_init(void) {
 
 extern void game_escape(uint32_t timer);
 void input_update(float delta_time) {
+   PROFILE_BEGIN("input_update");
    input_scan_devices(); // TODO: call this only if detect device activity?
 
    // update all input states for all devices
@@ -82,6 +84,7 @@ void input_update(float delta_time) {
    if (timing_get_frame_count() % 1800 == 0) {  // every 30 seconds at 60fps
       input_cleanup_disconnected_devices();
    }
+   PROFILE_END();
 }
 
 void input_shutdown(void) {
@@ -245,6 +248,13 @@ void input_add_mapping(int raw_key, InputEvent event, int device_id) {
    g_input.mapping_count++;
 }
 
+void input_inject(InputEvent event, int device_id, bool held) {
+   // goes through the same edge detection and context handlers as a real key
+   if (event <= INPUT_NONE || event >= INPUT_MAX) return;
+   if (device_id < 0 || device_id >= MAX_INPUT_DEVICES) return;
+   g_input.injected[device_id][event] = held;
+}
+
 // context system
 extern void scene_handle_input(InputEvent event, InputState state, int device_id);
 extern void menu_handle_input(InputEvent event, InputState state, int device_id);
@@ -307,6 +317,8 @@ void input_cache_device_state(int device_id) {
 }
 
 bool input_is_raw_pressed(InputEvent event, int device_id) {
+   if (g_input.injected[device_id][event]) return true;
+
    // look for mappings that match this event and device
    for (int i = 0; i < g_input.mapping_count; i++) {
       InputMapping* mapping = &g_input.mappings[i];
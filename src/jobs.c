@@ -0,0 +1,152 @@
+#include "jobs.h"
+#include "debug.h"
+#include "profile.h"
+#include <SDL2/SDL.h>
+#include <string.h>
+
+static struct {
+   bool initialized;
+   SDL_Thread* threads[JOBS_MAX_THREADS];
+   int worker_count;
+
+   SDL_mutex* lock;
+   SDL_cond* wake;         // workers wait here for the next batch
+   SDL_cond* finished;     // jobs_run() waits here for the batch to drain
+   ui32 generation;        // bumped per batch so workers don't run one twice
+   int active;             // workers still inside the current batch
+   bool quit;
+
+   JobFunc func;
+   void* data;
+   int count;
+   SDL_atomic_t next;      // next index to hand out
+   SDL_atomic_t done;      // indices finished
+} g_jobs = { 0 };
+
+static __thread int t_thread_index = 0;
+
+static int worker_main(void* arg);
+static void run_batch(void);
+
+bool jobs_init(int worker_count) {
+   if (g_jobs.initialized) {
+      d_err("the job pool is already running");
+      return false;
+   }
+
+   if (worker_count < 0) worker_count = SDL_GetCPUCount() - 1;
+   if (worker_count < 0) worker_count = 0;
+   if (worker_count > JOBS_MAX_THREADS - 1) worker_count = JOBS_MAX_THREADS - 1;
+
+   g_jobs.lock = SDL_CreateMutex();
+   g_jobs.wake = SDL_CreateCond();
+   g_jobs.finished = SDL_CreateCond();
+   if (d_dne(g_jobs.lock) || d_dne(g_jobs.wake) || d_dne(g_jobs.finished)) {
+      jobs_cleanup();
+      return false;
+   }
+   g_jobs.initialized = true;
+
+   for (int i = 0; i < worker_count; i++) {
+      g_jobs.threads[i] = SDL_CreateThread(worker_main, "worker", (void*)(intptr_t)(i + 1));
+      if (d_dne(g_jobs.threads[i])) break; // run with what we've got
+      g_jobs.worker_count++;
+   }
+
+   d_logv(2, "job pool: %d workers", g_jobs.worker_count);
+   return true;
+}
+
+void jobs_cleanup(void) {
+   if (g_jobs.lock) {
+      SDL_LockMutex(g_jobs.lock);
+      g_jobs.quit = true;
+      SDL_CondBroadcast(g_jobs.wake);
+      SDL_UnlockMutex(g_jobs.lock);
+   }
+   for (int i = 0; i < g_jobs.worker_count; i++) {
+      SDL_WaitThread(g_jobs.threads[i], NULL);
+   }
+
+   if (g_jobs.finished) SDL_DestroyCond(g_jobs.finished);
+   if (g_jobs.wake) SDL_DestroyCond(g_jobs.wake);
+   if (g_jobs.lock) SDL_DestroyMutex(g_jobs.lock);
+   memset(&g_jobs, 0, sizeof(g_jobs));
+}
+
+void jobs_run(JobFunc func, void* data, int count) {
+   if (count <= 0) return;
+   if (!g_jobs.initialized || g_jobs.worker_count == 0 || count == 1) {
+      for (int i = 0; i < count; i++) func(i, data);
+      return;
+   }
+
+   SDL_LockMutex(g_jobs.lock);
+   g_jobs.func = func;
+   g_jobs.data = data;
+   g_jobs.count = count;
+   SDL_AtomicSet(&g_jobs.next, 0);
+   SDL_AtomicSet(&g_jobs.done, 0);
+   g_jobs.generation++;
+   SDL_CondBroadcast(g_jobs.wake);
+   SDL_UnlockMutex(g_jobs.lock);
+
+   run_batch();
+
+   // wait for the stragglers, and for every worker to leave the batch so
+   // none of them can pick up an index from the next one with stale data
+   SDL_LockMutex(g_jobs.lock);
+   while (SDL_AtomicGet(&g_jobs.done) < count || g_jobs.active > 0) {
+      SDL_CondWait(g_jobs.finished, g_jobs.lock);
+   }
+   g_jobs.func = NULL;
+   SDL_UnlockMutex(g_jobs.lock);
+}
+
+int jobs_get_thread_count(void) {
+   return g_jobs.worker_count + 1;
+}
+
+int jobs_get_thread_index(void) {
+   return t_thread_index;
+}
+
+// INTERNAL
+static int worker_main(void* arg) {
+   t_thread_index = (int)(intptr_t)arg;
+   profile_set_thread_name("worker");
+   ui32 seen = 0;
+
+   SDL_LockMutex(g_jobs.lock);
+   while (true) {
+      while (!g_jobs.quit && (g_jobs.generation == seen || !g_jobs.func)) {
+         SDL_CondWait(g_jobs.wake, g_jobs.lock);
+      }
+      if (g_jobs.quit) break;
+      seen = g_jobs.generation;
+      g_jobs.active++;
+      SDL_UnlockMutex(g_jobs.lock);
+
+      run_batch();
+
+      SDL_LockMutex(g_jobs.lock);
+      g_jobs.active--;
+      if (g_jobs.active == 0) SDL_CondSignal(g_jobs.finished);
+   }
+   SDL_UnlockMutex(g_jobs.lock);
+   return 0;
+}
+
+static void run_batch(void) {
+   // func/data/count only change while nobody is active, so reading them here is fine
+   while (true) {
+      int index = SDL_AtomicAdd(&g_jobs.next, 1);
+      if (index >= g_jobs.count) break;
+      g_jobs.func(index, g_jobs.data);
+      if (SDL_AtomicAdd(&g_jobs.done, 1) == g_jobs.count - 1) {
+         SDL_LockMutex(g_jobs.lock);
+         SDL_CondSignal(g_jobs.finished);
+         SDL_UnlockMutex(g_jobs.lock);
+      }
+   }
+}
@@ -0,0 +1,289 @@
+#include "loader.h"
+#include "debug.h"
+#include "profile.h"
+#include <SDL2/SDL.h>
+#include <string.h>
+
+typedef struct {
+   LoadHandle handle;      // INVALID_LOAD while the slot is free
+   ui32 generation;        // kept when the slot is freed, so old handles stay stale
+   LoadStatus status;
+   LoadPriority priority;
+   ui32 sequence;          // request order, oldest goes first within a priority
+   bool cancelled;
+   char path[LOADER_MAX_PATH];
+   LoadFunc load;
+   LoadCallback callback;
+   void* user;
+   void* data;             // LoadFunc's result, once LOAD_READY
+} LoadRequest;
+
+typedef struct {
+   LoadHandle handle;
+   LoadResult result;
+   LoadCallback callback;
+   void* data;
+   void* user;
+} LoadDelivery;
+
+static struct {
+   bool initialized;
+   SDL_Thread* threads[LOADER_MAX_THREADS];
+   int thread_count;
+
+   SDL_mutex* lock;        // everything below
+   SDL_cond* wake;         // I/O threads wait here for a queued request
+   SDL_cond* finished;     // loader_wait() waits here for one to leave the threads
+   bool quit;
+
+   LoadRequest requests[LOADER_MAX_REQUESTS];
+   ui32 next_sequence;
+   ui32 pending;
+} g_loader = { 0 };
+
+static int io_thread_main(void* arg);
+static LoadRequest* find_request(LoadHandle handle);
+static LoadRequest* next_request(void);
+static void run_request(LoadRequest* request);
+
+bool loader_init(int thread_count) {
+   if (g_loader.initialized) {
+      d_err("the loader is already running");
+      return false;
+   }
+   if (thread_count < 0) thread_count = 0;
+   if (thread_count > LOADER_MAX_THREADS) thread_count = LOADER_MAX_THREADS;
+
+   g_loader.lock = SDL_CreateMutex();
+   g_loader.wake = SDL_CreateCond();
+   g_loader.finished = SDL_CreateCond();
+   if (d_dne(g_loader.lock) || d_dne(g_loader.wake) || d_dne(g_loader.finished)) {
+      loader_cleanup();
+      return false;
+   }
+   g_loader.initialized = true;
+
+   for (int i = 0; i < thread_count; i++) {
+      g_loader.threads[i] = SDL_CreateThread(io_thread_main, "loader", NULL);
+      if (d_dne(g_loader.threads[i])) break; // 0 still works, requests just load on the spot
+      g_loader.thread_count++;
+   }
+
+   d_logv(2, "loader: %d I/O threads", g_loader.thread_count);
+   return true;
+}
+
+void loader_cleanup(void) {
+   if (g_loader.lock) {
+      SDL_LockMutex(g_loader.lock);
+      g_loader.quit = true;
+      SDL_CondBroadcast(g_loader.wake);
+      SDL_UnlockMutex(g_loader.lock);
+   }
+   for (int i = 0; i < g_loader.thread_count; i++) {
+      SDL_WaitThread(g_loader.threads[i], NULL);
+   }
+
+   if (g_loader.initialized) {
+      // the threads are gone, so nothing is running. whatever is queued gets called back as cancelled
+      SDL_LockMutex(g_loader.lock);
+      for (int i = 0; i < LOADER_MAX_REQUESTS; i++) {
+         LoadRequest* request = &g_loader.requests[i];
+         if (request->handle == INVALID_LOAD || request->status != LOAD_QUEUED) continue;
+         request->cancelled = true;
+         request->status = LOAD_READY;
+      }
+      SDL_UnlockMutex(g_loader.lock);
+      ui32 delivered = loader_update();
+      if (delivered > 0) d_logv(2, "cancelled %u loads on the way out", delivered);
+   }
+
+   if (g_loader.finished) SDL_DestroyCond(g_loader.finished);
+   if (g_loader.wake) SDL_DestroyCond(g_loader.wake);
+   if (g_loader.lock) SDL_DestroyMutex(g_loader.lock);
+   memset(&g_loader, 0, sizeof(g_loader));
+}
+
+LoadHandle loader_request(const char* path, LoadPriority priority, LoadFunc load, LoadCallback callback, void* user) {
+   if (!g_loader.initialized) {
+      d_err("loader_request() before loader_init()");
+      return INVALID_LOAD;
+   }
+   if (!path || !load || !callback || priority < 0 || priority >= LOAD_PRIORITY_MAX) {
+      d_err("bad load request for %s", path ? path : "(null)");
+      return INVALID_LOAD;
+   }
+   if (strlen(path) >= LOADER_MAX_PATH) {
+      d_err("load path is too long: %s", path);
+      return INVALID_LOAD;
+   }
+
+   SDL_LockMutex(g_loader.lock);
+   LoadRequest* request = NULL;
+   ui32 slot = 0;
+   for (; slot < LOADER_MAX_REQUESTS; slot++) {
+      if (g_loader.requests[slot].handle == INVALID_LOAD) {
+         request = &g_loader.requests[slot];
+         break;
+      }
+   }
+   if (!request) {
+      SDL_UnlockMutex(g_loader.lock);
+      d_err("more than %d loads in flight, dropping %s", LOADER_MAX_REQUESTS, path);
+      return INVALID_LOAD;
+   }
+
+   request->generation++;
+   if ((request->generation << LOADER_SLOT_BITS) == 0) request->generation = 1; // wrapped, skip INVALID_LOAD
+   request->handle = slot | (request->generation << LOADER_SLOT_BITS);
+   request->status = LOAD_QUEUED;
+   request->priority = priority;
+   request->sequence = g_loader.next_sequence++;
+   request->cancelled = false;
+   strcpy(request->path, path);
+   request->load = load;
+   request->callback = callback;
+   request->user = user;
+   request->data = NULL;
+   g_loader.pending++;
+   LoadHandle handle = request->handle;
+
+   if (g_loader.thread_count == 0) {
+      request->status = LOAD_RUNNING;
+      SDL_UnlockMutex(g_loader.lock);
+      run_request(request);
+      return handle;
+   }
+   SDL_CondSignal(g_loader.wake);
+   SDL_UnlockMutex(g_loader.lock);
+   return handle;
+}
+
+void loader_cancel(LoadHandle handle) {
+   if (!g_loader.initialized) return;
+   SDL_LockMutex(g_loader.lock);
+   LoadRequest* request = find_request(handle);
+   if (request) {
+      request->cancelled = true;
+      if (request->status == LOAD_QUEUED) request->status = LOAD_READY; // never gets to a thread
+   }
+   SDL_UnlockMutex(g_loader.lock);
+}
+
+LoadStatus loader_poll(LoadHandle handle) {
+   if (!g_loader.initialized) return LOAD_FINISHED;
+   SDL_LockMutex(g_loader.lock);
+   LoadRequest* request = find_request(handle);
+   LoadStatus status = request ? request->status : LOAD_FINISHED;
+   SDL_UnlockMutex(g_loader.lock);
+   return status;
+}
+
+void loader_wait(LoadHandle handle) {
+   if (!g_loader.initialized) return;
+   PROFILE_BEGIN("loader_wait");
+   SDL_LockMutex(g_loader.lock);
+   LoadRequest* request;
+   while ((request = find_request(handle)) &&
+          (request->status == LOAD_QUEUED || request->status == LOAD_RUNNING)) {
+      SDL_CondWait(g_loader.finished, g_loader.lock);
+   }
+   SDL_UnlockMutex(g_loader.lock);
+   loader_update();
+   PROFILE_END();
+}
+
+ui32 loader_update(void) {
+   if (!g_loader.initialized) return 0;
+
+   // pull everything ready out first, callbacks are free to queue more
+   LoadDelivery deliveries[LOADER_MAX_REQUESTS];
+   ui32 count = 0;
+   SDL_LockMutex(g_loader.lock);
+   for (int i = 0; i < LOADER_MAX_REQUESTS; i++) {
+      LoadRequest* request = &g_loader.requests[i];
+      if (request->handle == INVALID_LOAD || request->status != LOAD_READY) continue;
+      LoadDelivery* delivery = &deliveries[count++];
+      delivery->handle = request->handle;
+      delivery->result = request->cancelled ? LOAD_CANCELLED : (request->data ? LOAD_OK : LOAD_FAILED);
+      delivery->callback = request->callback;
+      delivery->data = request->data;
+      delivery->user = request->user;
+      request->handle = INVALID_LOAD;
+      request->data = NULL;
+      g_loader.pending--;
+   }
+   SDL_UnlockMutex(g_loader.lock);
+
+   for (ui32 i = 0; i < count; i++) {
+      LoadDelivery* delivery = &deliveries[i];
+      delivery->callback(delivery->handle, delivery->result, delivery->data, delivery->user);
+   }
+   return count;
+}
+
+ui32 loader_get_pending(void) {
+   if (!g_loader.initialized) return 0;
+   SDL_LockMutex(g_loader.lock);
+   ui32 pending = g_loader.pending;
+   SDL_UnlockMutex(g_loader.lock);
+   return pending;
+}
+
+// INTERNAL
+static int io_thread_main(void* arg) {
+   (void)arg;
+   profile_set_thread_name("loader");
+
+   SDL_LockMutex(g_loader.lock);
+   while (true) {
+      LoadRequest* request = NULL;
+      while (!g_loader.quit && !(request = next_request())) {
+         SDL_CondWait(g_loader.wake, g_loader.lock);
+      }
+      if (g_loader.quit) break;
+      request->status = LOAD_RUNNING;
+      SDL_UnlockMutex(g_loader.lock);
+
+      run_request(request);
+
+      SDL_LockMutex(g_loader.lock);
+   }
+   SDL_UnlockMutex(g_loader.lock);
+   return 0;
+}
+
+static LoadRequest* find_request(LoadHandle handle) {
+   // lock held. stale handles point at a slot that has moved on to a newer generation
+   ui32 slot = handle & ((1u << LOADER_SLOT_BITS) - 1);
+   if (handle == INVALID_LOAD || slot >= LOADER_MAX_REQUESTS) return NULL;
+   LoadRequest* request = &g_loader.requests[slot];
+   return (request->handle == handle) ? request : NULL;
+}
+
+static LoadRequest* next_request(void) {
+   // lock held. highest priority first, then oldest
+   LoadRequest* best = NULL;
+   for (int i = 0; i < LOADER_MAX_REQUESTS; i++) {
+      LoadRequest* request = &g_loader.requests[i];
+      if (request->handle == INVALID_LOAD || request->status != LOAD_QUEUED) continue;
+      if (!best || request->priority < best->priority ||
+          (request->priority == best->priority && (si32)(request->sequence - best->sequence) < 0)) {
+         best = request;
+      }
+   }
+   return best;
+}
+
+static void run_request(LoadRequest* request) {
+   // lock not held. a running slot isn't freed or rewritten, so path/load/user are safe to read
+   PROFILE_BEGIN("load_file");
+   void* data = request->load(request->path, request->user);
+   PROFILE_END();
+
+   SDL_LockMutex(g_loader.lock);
+   request->data = data;
+   request->status = LOAD_READY;
+   SDL_CondBroadcast(g_loader.finished);
+   SDL_UnlockMutex(g_loader.lock);
+}
@@ -3,6 +3,9 @@
 #include "input.h"
 #include "scene.h"
 #include "debug.h"
+#include "jobs.h"
+#include "loader.h"
+#include "profile.h"
 #include <SDL2/SDL.h>
 
 extern int LOG_VERBOSITY;
@@ -14,27 +17,33 @@ typedef enum {
 
 typedef struct {
    GameState state;
+   bool show_frame_graph; // F2, frame time graph + counters on the system layer
 } Game;
 
 Game g_game = { 0 };
 
-bool game_init(float scale_factor, int framerate);
+bool game_init(float scale_factor, int framerate, int workers, bool pipelined, bool recording, bool headless, const char* trace_path);
 void game_update(float delta_time);
 void game_render(void);
 void game_handle_events(float delta_time);
 void game_escape(uint32_t timer);
 void game_shutdown(void);
-bool game_handle_flags(int argc, char *argv[], int* logging_mode, float* scale_factor, int* framerate);
+bool game_handle_flags(int argc, char *argv[], int* logging_mode, float* scale_factor, int* framerate, int* workers, bool* pipelined, bool* recording, bool* headless, const char** trace_path);
 
 int main(int argc, char* argv[]) {
    // initialize w flags
    int logging_mode = LOG_VERBOSITY;
    float scale_factor = 1.0f;
    int framerate = 60;
-   if (!game_handle_flags(argc, argv, &logging_mode, &scale_factor, &framerate))
+   int workers = JOBS_AUTO;
+   bool pipelined = false;
+   bool recording = false;
+   bool headless = false;
+   const char* trace_path = NULL;
+   if (!game_handle_flags(argc, argv, &logging_mode, &scale_factor, &framerate, &workers, &pipelined, &recording, &headless, &trace_path))
       return 1;
    
-   if (!game_init(scale_factor, framerate)) {
+   if (!game_init(scale_factor, framerate, workers, pipelined, recording, headless, trace_path)) {
       d_err("failed to initialize game");
       return 1;
    }
@@ -42,29 +51,42 @@ int main(int argc, char* argv[]) {
    while (g_game.state == GAME_RUNNING) {
       timing_frame_start();
       float delta_time = timing_get_delta_time();
+      ui32 sim_steps = timing_advance_simulation();
 
+      ui64 stage_start = timing_get_time_us();
+      loader_update();                 // finished loads land here, on the main thread
       game_handle_events(delta_time);  // input & devices
-      game_update(delta_time);         // calculations for next frame
-      game_render();                   // render next frame
+      ui64 update_start = timing_get_time_us();
+      timing_record_stage(STAGE_EVENTS, (ui32)(update_start - stage_start));
+      for (ui32 i = 0; i < sim_steps && g_game.state == GAME_RUNNING; i++) {
+         game_update(timing_get_sim_delta()); // fixed steps, however long the frame was
+      }
+      timing_record_stage(STAGE_UPDATE, (ui32)(timing_get_time_us() - update_start));
+      game_render();                   // render next frame, records its own stages
       
       timing_frame_end();
       
-      if (timing_should_limit_frame()) { SDL_Delay(timing_get_frame_duration()); }
+      timing_wait_for_next_frame();
       // if (timing_get_frame_count() == 3) { game_shutdown(); }
    }
 
    return 0;
 }
 
-bool game_init(float scale_factor, int framerate) {
-   // init SDL
-   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0) {
+bool game_init(float scale_factor, int framerate, int workers, bool pipelined, bool recording, bool headless, const char* trace_path) {
+   // init SDL, headless doesn't need a display at all
+   if (SDL_Init((headless ? 0 : SDL_INIT_VIDEO) | SDL_INIT_GAMECONTROLLER) < 0) {
       d_err("SDL could not initialize! SDL_Error: %s", SDL_GetError());
       return false;
    }
 
    timing_init(framerate);   
-   if (!renderer_init(scale_factor)) return false;
+   if (!profile_init(trace_path)) return false;
+   if (!jobs_init(workers)) return false;
+   if (!loader_init(LOADER_THREADS)) return false;
+   if (!renderer_init(scale_factor, headless)) return false;
+   renderer_set_pipelined(pipelined);
+   renderer_set_recording(recording);
    input_init();
    scene_init();
 
@@ -85,6 +107,15 @@ void game_handle_events(float delta_time) {
       case SDL_WINDOWEVENT:
          renderer_handle_window_event(&e);
          break;
+      case SDL_KEYDOWN:
+         if (e.key.repeat) break;
+         if (e.key.keysym.sym == SDLK_F9) profile_export(); // trace so far, -x sets where
+         if (e.key.keysym.sym == SDLK_F2) {
+            g_game.show_frame_graph = !g_game.show_frame_graph;
+            renderer_toggle_system_data(SYS_FRAME_GRAPH, g_game.show_frame_graph);
+            renderer_toggle_system_data(SYS_FRAME_COUNTERS, g_game.show_frame_graph);
+         }
+         break;
       case SDL_APP_LOWMEMORY:
          d_log("THE GAME IS LOW ON MEMORY!!!!!!!!");
          break;
@@ -119,10 +150,14 @@ void game_shutdown(void) {
    scene_destroy();
    input_shutdown();
    renderer_cleanup();
+   loader_cleanup();
+   jobs_cleanup();
+   profile_export();
+   profile_cleanup();
    SDL_Quit();
 }
 
-bool game_handle_flags(int argc, char *argv[], int* logging_mode, float* scale_factor, int* framerate) {
+bool game_handle_flags(int argc, char *argv[], int* logging_mode, float* scale_factor, int* framerate, int* workers, bool* pipelined, bool* recording, bool* headless, const char** trace_path) {
    for (int i = 1; i < argc; i++) {
       if (argv[i][0] == '-') {
          char flag = argv[i][1];
@@ -142,6 +177,21 @@ bool game_handle_flags(int argc, char *argv[], int* logging_mode, float* scale_f
          case 'f':
             *framerate = atoi(argv[++i]);
             break;
+         case 't':
+            *workers = atoi(argv[++i]); // compositor worker threads, -1 = one per core
+            break;
+         case 'p':
+            *pipelined = atoi(argv[++i]) != 0; // composite on a render thread, one frame behind
+            break;
+         case 'r':
+            *recording = atoi(argv[++i]) != 0; // record layer draws, run them sorted/merged/culled at present
+            break;
+         case 'h':
+            *headless = atoi(argv[++i]) != 0; // no window, frames only go to memory. -f sets how fast
+            break;
+         case 'x':
+            *trace_path = argv[++i]; // profile zones, chrome trace written on exit and on F9
+            break;
          default:
             fprintf(stderr, "Unknown flag: -%c\n", flag);
             return false;
@@ -0,0 +1,190 @@
+#include "profile.h"
+#include "timing.h"
+#include "debug.h"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+   const char* name;
+   ui64 start_ns;
+   ui64 duration_ns;
+} ProfileZone;
+
+typedef struct {
+   ProfileZone* zones;     // PROFILE_RING_SIZE, only the owning thread writes
+   SDL_atomic_t written;   // zones finished so far, bumped after the zone is in the ring
+   const char* name;
+   int id;                 // tid in the trace
+
+   // open zones, only touched by the owning thread
+   const char* open_names[PROFILE_MAX_DEPTH];
+   ui64 open_starts[PROFILE_MAX_DEPTH];
+   ui32 depth;             // can go past PROFILE_MAX_DEPTH, those zones just aren't kept
+} ProfileThread;
+
+bool g_profile_enabled = false;
+
+static struct {
+   const char* trace_path;
+   ui64 start_ns;                           // trace timestamps count from here
+   ProfileThread threads[PROFILE_MAX_THREADS];
+   SDL_atomic_t thread_count;               // slots handed out, can go past PROFILE_MAX_THREADS
+   ProfileZone* export_zones;               // scratch for profile_export()
+} g_profile = { 0 };
+
+static __thread ProfileThread* t_profile = NULL;
+static __thread const char* t_profile_name = NULL;
+static __thread bool t_profile_full = false; // no slot left for this thread
+
+static ProfileThread* get_thread(void);
+static ui32 copy_ring(ProfileThread* thread, ProfileZone* out, ui32* dropped);
+static void write_zone(FILE* file, const ProfileThread* thread, const ProfileZone* zone, bool* first);
+
+bool profile_init(const char* trace_path) {
+   if (!trace_path) return true;
+#ifdef PROFILE_DISABLED
+   d_log("built with PROFILE_DISABLED, no trace for %s", trace_path);
+   return true;
+#endif
+   g_profile.export_zones = malloc(sizeof(ProfileZone) * PROFILE_RING_SIZE);
+   if (d_dne(g_profile.export_zones)) return false;
+   g_profile.trace_path = trace_path;
+   g_profile.start_ns = timing_get_time_ns();
+   SDL_AtomicSet(&g_profile.thread_count, 0);
+   profile_set_thread_name("main");
+   g_profile_enabled = true;
+   d_logv(1, "profiling, trace goes to %s", trace_path);
+   return true;
+}
+
+void profile_cleanup(void) {
+   // whoever is still inside a zone sees this before touching their ring again
+   g_profile_enabled = false;
+   int count = SDL_AtomicGet(&g_profile.thread_count);
+   if (count > PROFILE_MAX_THREADS) count = PROFILE_MAX_THREADS;
+   for (int i = 0; i < count; i++) SAFE_FREE(g_profile.threads[i].zones);
+   SAFE_FREE(g_profile.export_zones);
+   g_profile.trace_path = NULL;
+   t_profile = NULL;
+}
+
+bool profile_export(void) {
+   if (!g_profile_enabled || !g_profile.trace_path) return false;
+   FILE* file = fopen(g_profile.trace_path, "w");
+   if (!file) {
+      d_err("couldn't open %s for the profile trace", g_profile.trace_path);
+      return false;
+   }
+
+   int count = SDL_AtomicGet(&g_profile.thread_count);
+   if (count > PROFILE_MAX_THREADS) count = PROFILE_MAX_THREADS;
+   ui32 total = 0, dropped = 0;
+   bool first = true;
+   fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+   for (int i = 0; i < count; i++) {
+      ProfileThread* thread = &g_profile.threads[i];
+      if (!thread->zones) continue; // still being set up
+      fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",\n", thread->id, thread->name ? thread->name : "thread");
+      first = false;
+
+      ui32 zone_count = copy_ring(thread, g_profile.export_zones, &dropped);
+      for (ui32 z = 0; z < zone_count; z++) write_zone(file, thread, &g_profile.export_zones[z], &first);
+      total += zone_count;
+   }
+   fprintf(file, "\n]}\n");
+   fclose(file);
+
+   d_log("wrote %u zones from %d threads to %s", total, count, g_profile.trace_path);
+   if (dropped > 0) d_logv(1, "%u older zones were already overwritten", dropped);
+   return true;
+}
+
+void profile_set_thread_name(const char* name) {
+   t_profile_name = name;
+   if (t_profile) t_profile->name = name;
+}
+
+void profile_begin(const char* name) {
+   ProfileThread* thread = get_thread();
+   if (!thread) return;
+   if (thread->depth < PROFILE_MAX_DEPTH) {
+      thread->open_names[thread->depth] = name;
+      thread->open_starts[thread->depth] = timing_get_time_ns();
+   }
+   thread->depth++;
+}
+
+void profile_end(void) {
+   ProfileThread* thread = t_profile;
+   if (!thread || thread->depth == 0) return; // profiling started inside this zone
+   thread->depth--;
+   if (thread->depth >= PROFILE_MAX_DEPTH) return;
+
+   /* single writer, so the slot is ours. it only counts as written once */
+   /* written moves past it, which SDL_AtomicSet() does after the store  */
+   int written = SDL_AtomicGet(&thread->written);
+   ProfileZone* zone = &thread->zones[(ui32)written & (PROFILE_RING_SIZE - 1)];
+   zone->name = thread->open_names[thread->depth];
+   zone->start_ns = thread->open_starts[thread->depth];
+   zone->duration_ns = timing_get_time_ns() - zone->start_ns;
+   SDL_AtomicSet(&thread->written, written + 1);
+}
+
+// INTERNAL
+static ProfileThread* get_thread(void) {
+   if (t_profile) return t_profile;
+   if (t_profile_full) return NULL;
+
+   int slot = SDL_AtomicAdd(&g_profile.thread_count, 1);
+   if (slot >= PROFILE_MAX_THREADS) {
+      d_log("more than %d threads, not profiling this one", PROFILE_MAX_THREADS);
+      t_profile_full = true;
+      return NULL;
+   }
+   ProfileThread* thread = &g_profile.threads[slot];
+   thread->id = slot;
+   thread->name = t_profile_name;
+   thread->depth = 0;
+   SDL_AtomicSet(&thread->written, 0);
+   ProfileZone* zones = malloc(sizeof(ProfileZone) * PROFILE_RING_SIZE);
+   if (d_dne(zones)) {
+      t_profile_full = true;
+      return NULL;
+   }
+   SDL_MemoryBarrierRelease(); // profile_export() skips the thread until zones shows up
+   thread->zones = zones;
+   t_profile = thread;
+   return thread;
+}
+
+static ui32 copy_ring(ProfileThread* thread, ProfileZone* out, ui32* dropped) {
+   /* the owner keeps writing while this copies. a slot is only rewritten */
+   /* once written has moved PROFILE_RING_SIZE past it, so after copying, */
+   /* anything that close to the new written count may be torn            */
+   ui32 end = (ui32)SDL_AtomicGet(&thread->written);
+   ui32 start = (end > PROFILE_RING_SIZE) ? end - PROFILE_RING_SIZE : 0;
+   for (ui32 i = start; i < end; i++) out[i - start] = thread->zones[i & (PROFILE_RING_SIZE - 1)];
+   SDL_MemoryBarrierAcquire();
+
+   ui32 after = (ui32)SDL_AtomicGet(&thread->written);
+   ui32 safe_start = (after >= PROFILE_RING_SIZE) ? after - PROFILE_RING_SIZE + 1 : 0;
+   ui32 skip = (safe_start > start) ? safe_start - start : 0;
+   if (skip > end - start) skip = end - start;
+   *dropped += start + skip;
+
+   ui32 count = end - start - skip;
+   if (skip > 0) memmove(out, out + skip, sizeof(ProfileZone) * count);
+   return count;
+}
+
+static void write_zone(FILE* file, const ProfileThread* thread, const ProfileZone* zone, bool* first) {
+   // complete events, ts and dur in us. nesting comes from the times
+   double ts = (double)(zone->start_ns - g_profile.start_ns) / 1000.0;
+   double dur = (double)zone->duration_ns / 1000.0;
+   fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+           *first ? "" : ",\n", zone->name, thread->id, ts, dur);
+   *first = false;
+}
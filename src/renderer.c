@@ -2,29 +2,94 @@
 #include "timing.h"
 #include "file.h"
 #include "debug.h"
+#include "composite.h"
+#include "jobs.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <string.h>
 
 static RendererState g_renderer = { 0 };
+
+typedef struct {
+   const CompositeSource* sources;
+   int count;
+} FusedSources; // fused_band() data
 ui32 palette_map[PALETTE_SIZE]; // for blitting on non-indexed surfaces
 
+// SYS_FRAME_GRAPH colors, stages of the same subsystem share one
+#define GRAPH_BACKGROUND 4  // mono-black
+#define GRAPH_BUDGET 11     // red-ivwy
+static const ui8 graph_stage_colors[STAGE_MAX] = {
+   [STAGE_EVENTS] = 15,       // input, teal-frankie
+   [STAGE_UPDATE] = 34,       // update, yellow-neon
+   [STAGE_SCENE] = 19,        // render, blue-sky
+   [STAGE_RENDER] = 19,
+   [STAGE_COMPOSITE] = 7,     // composite, orange-normal
+   [STAGE_PRESENT] = 23,      // present, pink-deep
+   [STAGE_PRESENT_WAIT] = 23,
+};
+
 static void draw_system_header(int* x, int* y);
 static void draw_system_data(SystemData data, int* x, int* y, ui8 color);
+static void draw_system_counter(const char* label, ui32 value, int x, int y, ui8 color);
+static void draw_frame_graph(Layer* layer, int* x, int* y);
 static void calculate_mapping(void);
 static Layer* find_layer(LayerHandle handle);
 static Layer* find_layer_by_index(ui32 index);
+static Layer* allocate_layer_slot(void);
+static void release_layer_slot(Layer* layer);
 static SDL_Surface* create_composite_surface(void);
+static SDL_Surface* get_window_surface(void);
 static SDL_Surface* create_layer_surface(bool can_draw_outside);
 static void resize_all_surfaces(void);
 static SDL_Color* get_palette_colors(void);
 static void align_coords(int* x, int* y, ui8 size);
 static void align_rect(Rect* rect, ui8 size);
 static void blit_rect(Layer* layer, Rect* rect, ui8 color_index);
-static void renderer_blit_masked(LayerHandle handle, ImageData* source, Rect src_rect,
+static void adjust_layer_rect(Layer* layer, Rect* rect);
+static void fill_layer_rect(Layer* layer, Rect* rect, ui8 color_index);
+static void fill_layer(Layer* layer, ui8 color_index);
+static void draw_glyphs(Layer* layer, Font* font, const char* str, ui32 length, int x, int y, ui8 color_index);
+static void draw_sprite(Layer* layer, const Sprite* sprite, int frame, int dest_x, int dest_y, ui8 flags);
+static ui32 draw_batched_sprites(Layer* layer, const SpriteInstance* sprites, ui32 count);
+static DrawCommand* record_command(Layer* layer, DrawOp op, ui8 color_index);
+static void flush_draw_list(void);
+static void add_dirty_rect(Rect* rects, ui32* count, Rect rect);
+static void mark_layer_dirty(Layer* layer, const Rect* rect);
+static void reset_layer_dirty(Layer* layer);
+static void resolve_layer_base(Layer* layer);
+static void build_frame_dirty_rects(void);
+static void fill_frame_layers(FrameSnapshot* frame, bool use_mirrors);
+static bool resize_frame_sources(ui32 layer_capacity);
+static void build_frame_snapshot(bool fused);
+static void composite_rect(const FrameSnapshot* frame, const Rect* rect);
+static void render_frame(FrameSnapshot* frame);
+static void present_frame(const FrameSnapshot* frame);
+static ui32 finish_frame(void);
+static int render_thread_main(void* data);
+static void stop_render_thread(void);
+static bool update_layer_mirror(Layer* layer);
+static void copy_to_mirror(Layer* layer, const FrameSnapshot* frame);
+static void composite_band(Rect rect, void* data);
+static void scale_band(Rect rect, void* data);
+static void fused_band(Rect rect, void* data);
+static bool can_fuse_present(void);
+static void refresh_stale_composite(void);
+static void renderer_blit_masked(Layer* layer, ImageData* source, Rect src_rect,
                                  int dest_x, int dest_y, ui8 color_index);
+static bool clip_masked_rect(Layer* layer, Rect* dest_rect, int* src_clip_left, int* src_clip_top);
+static void draw_glyph(Layer* layer, const Font* font, int glyph, int dest_x, int dest_y, ui8 color_index);
+static void expand_glyph(ui8* dest_row, int pitch, int w, int h, const ui16* rows, int tile_w,
+                         int src_clip_left, int src_clip_top, int size, ui8 color_index);
+static bool draw_cached_run(Layer* layer, Font* font, const char* str, ui32 length, int x, int y, ui8 color_index);
+static void rasterize_run(TextRun* run, const Font* font, const char* str, ui32 length, int size, ui8 color_index);
+static void blit_sprite_spans(ui8* dest_row, int pitch, int w, int h, const Sprite* sprite, int frame,
+                              int src_clip_left, int src_clip_top, int size, ui8 flags);
+static void blit_sprite_sampled(ui8* dest_row, int pitch, int w, int h, const Sprite* sprite, int frame,
+                                int src_clip_left, int src_clip_top, int size, ui8 flags);
 
 // CORE FUNCTIONS
-bool renderer_init(float scale_factor) {
+bool renderer_init(float scale_factor, bool headless) {
    if (g_renderer.initialized) {
       d_err("the renderer is already initialized...");
       return false;
@@ -35,24 +100,37 @@ bool renderer_init(float scale_factor) {
       return false;
    }
    
-   g_renderer.window = SDL_CreateWindow(
-      WINDOW_TITLE,
-      SDL_WINDOWPOS_CENTERED,
-      SDL_WINDOWPOS_CENTERED,
-      (int)(GAME_WIDTH_FWVGA * scale_factor),
-      (int)(GAME_HEIGHT_FWVGA * scale_factor),
-      SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE
-   );
-   if (d_dne(g_renderer.window)) {
-      renderer_cleanup();
-      return false;
+   g_renderer.headless = headless;
+   if (headless) {
+      // nothing to show it on, the "window" is just memory in a usual window format
+      g_renderer.window_surface = SDL_CreateRGBSurfaceWithFormat(
+         0,
+         (int)(GAME_WIDTH_FWVGA * scale_factor),
+         (int)(GAME_HEIGHT_FWVGA * scale_factor),
+         32,
+         SDL_PIXELFORMAT_ARGB8888
+      );
+      d_log("running headless, nothing goes up on a window");
+   } else {
+      g_renderer.window = SDL_CreateWindow(
+         WINDOW_TITLE,
+         SDL_WINDOWPOS_CENTERED,
+         SDL_WINDOWPOS_CENTERED,
+         (int)(GAME_WIDTH_FWVGA * scale_factor),
+         (int)(GAME_HEIGHT_FWVGA * scale_factor),
+         SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE
+      );
+      if (d_dne(g_renderer.window)) {
+         renderer_cleanup();
+         return false;
+      }
+      SDL_SetWindowMinimumSize(g_renderer.window, GAME_WIDTH_VGA, GAME_HEIGHT_VGA);
+      g_renderer.window_surface = SDL_GetWindowSurface(g_renderer.window);
    }
    
    g_renderer.scale_factor = scale_factor;
    g_renderer.display_resolution = RES_VGA;
-   SDL_SetWindowMinimumSize(g_renderer.window, GAME_WIDTH_VGA, GAME_HEIGHT_VGA);
    
-   g_renderer.window_surface = SDL_GetWindowSurface(g_renderer.window);
    if (d_dne(g_renderer.window_surface)) {
       renderer_cleanup();
       return false;
@@ -78,18 +156,33 @@ bool renderer_init(float scale_factor) {
       ui8 a = palette[i] & 0xFF;
       palette_map[i] = SDL_MapRGBA(g_renderer.window_surface->format, r, g, b, a);
    }
+   composite_init();
+   composite_set_palette(palette_map, PALETTE_SIZE, g_renderer.transparent_color_index);
 
    g_renderer.composite_surface = create_composite_surface();
 
    g_renderer.layer_capacity = 16; // start with space for 16 layers
    g_renderer.layers = malloc(sizeof(Layer) * g_renderer.layer_capacity);
-   if (d_dne(g_renderer.layers)) {
+   g_renderer.draw_order = malloc(sizeof(ui32) * g_renderer.layer_capacity);
+   g_renderer.frame.layers = malloc(sizeof(FrameLayer) * g_renderer.layer_capacity);
+   if (d_dne(g_renderer.layers) || d_dne(g_renderer.draw_order) || d_dne(g_renderer.frame.layers) ||
+       !resize_frame_sources(g_renderer.layer_capacity)) {
       renderer_cleanup();
       return false;
    }
    memset(g_renderer.layers, 0, sizeof(Layer) * g_renderer.layer_capacity);
    g_renderer.layer_count = 0;
-   g_renderer.next_layer_handle = 1;
+   g_renderer.slot_count = 0;
+   g_renderer.free_slot = LAYER_NO_SLOT;
+   if (!drawlist_init(&g_renderer.draw_list)) {
+      renderer_cleanup();
+      return false;
+   }
+   textcache_init(&g_renderer.text_cache, TEXTCACHE_MAX_BYTES);
+   if (!spritebatch_init(&g_renderer.sprite_batch)) {
+      renderer_cleanup();
+      return false;
+   }
    
    LayerHandle system_layer = renderer_create_layer(true);
    if (system_layer == INVALID_LAYER) {
@@ -103,12 +196,17 @@ bool renderer_init(float scale_factor) {
    }
    renderer_set_layer_size(g_renderer.system_layer_handle, 1);
    
-   if (file_load_sheets(&g_renderer.font_array, &g_renderer.sprite_array) == 0) {
+   PROFILE_BEGIN("file_load_sheets");
+   int sheets_loaded = file_load_sheets(&g_renderer.font_array, &g_renderer.sprite_array);
+   PROFILE_END();
+   if (sheets_loaded == 0 || !file_wait_sheets(true)) { // text from the first frame on, sprites can wait
       renderer_cleanup();
       return false;
    }
    
    g_renderer.initialized = true;
+   g_renderer.full_redraw = true;
+   g_renderer.fused_present = true;
 
    // debug display toggles
    renderer_toggle_system_data(SYS_CURRENT_FPS, true);
@@ -121,6 +219,7 @@ bool renderer_init(float scale_factor) {
 
 void renderer_cleanup(void) {
    if (!g_renderer.initialized) return;
+   renderer_set_pipelined(false); // puts the last frame up and joins the render thread
 
    // unload assets
    file_unload_sheets(&g_renderer.font_array, &g_renderer.sprite_array);
@@ -128,19 +227,31 @@ void renderer_cleanup(void) {
    // destroy layers
    if (g_renderer.layers) {
       while (g_renderer.layer_count > 0) {
-         renderer_destroy_layer(g_renderer.layers[0].handle);
+         renderer_destroy_layer(g_renderer.layers[g_renderer.draw_order[0]].handle);
       }
       free(g_renderer.layers);
       g_renderer.layers = NULL;
       g_renderer.layer_capacity = 0;
    }
+   free(g_renderer.draw_order);
+   g_renderer.draw_order = NULL;
+   free(g_renderer.frame.layers);
+   g_renderer.frame.layers = NULL;
+   free(g_renderer.frame.sources);
+   g_renderer.frame.sources = NULL;
+   g_renderer.frame.source_stride = 0;
+   drawlist_free(&g_renderer.draw_list);
+   textcache_free(&g_renderer.text_cache);
+   spritebatch_free(&g_renderer.sprite_batch);
 
    // free composite surface
+   composite_cleanup();
    if (g_renderer.composite_surface) {
       SDL_FreeSurface(g_renderer.composite_surface);
       g_renderer.composite_surface = NULL;
    }
-   g_renderer.window_surface = NULL; // SDL will handle freeing
+   if (g_renderer.headless) SDL_FreeSurface(g_renderer.window_surface);
+   g_renderer.window_surface = NULL; // SDL will handle freeing the window's
 
    // destory the window
    if (g_renderer.window) {
@@ -155,18 +266,31 @@ void renderer_cleanup(void) {
 
 void renderer_clear(void) {
    if (!g_renderer.initialized) return;
-   SDL_FillRect(g_renderer.composite_surface, NULL, palette_map[g_renderer.clear_color_index]); // clear composite
+   flush_draw_list(); // anything recorded before the clear lands before it, same as drawing straight away
+   // only restore what was drawn since the last clear. the composite gets cleared
+   // per dirty rect in renderer_present()
    for (ui32 i = 0; i < g_renderer.layer_count; i++) {
       Layer* layer = find_layer_by_index(i);
       if (!layer) continue;
-      renderer_draw_fill(layer->handle, g_renderer.transparent_color_index);
+      layer->prev_dirty_count = 0;
+      for (ui32 r = 0; r < layer->dirty_count; r++) {
+         SDL_FillRect(layer->surface, &layer->dirty_rects[r], layer->base_color);
+         add_dirty_rect(layer->prev_dirty_rects, &layer->prev_dirty_count, layer->dirty_rects[r]);
+      }
+      layer->dirty_count = 0;
+      layer->base_resolved = false;
    }
 }
 
 extern void scene_render(void);
 void renderer_present(void) {
    if (!g_renderer.initialized) return;
+   PROFILE_BEGIN("renderer_present");
+   ui64 start_us = timing_get_time_us();
+   g_renderer.last_glyphs_drawn = g_renderer.glyphs_drawn;
+   g_renderer.glyphs_drawn = 0;
    if (g_renderer.resize_in_progress) {
+      finish_frame();
       ui32 current_time = timing_get_game_time_ms();
       ui32 time_since_resize = current_time - g_renderer.resize_start_time;
       
@@ -176,31 +300,24 @@ void renderer_present(void) {
          g_renderer.resize_in_progress = false;
       } else {
          // just stretch it !
-         g_renderer.window_surface = SDL_GetWindowSurface(g_renderer.window);
+         refresh_stale_composite();
+         g_renderer.window_surface = get_window_surface();
          if (d_dne(g_renderer.window_surface)) d_err("can't get window surface");
-         SDL_BlitScaled(g_renderer.composite_surface, NULL,
-                       g_renderer.window_surface, NULL);
-         SDL_UpdateWindowSurface(g_renderer.window);
+         composite_scale(g_renderer.composite_surface, g_renderer.window_surface,
+                         (Rect){ 0, 0, g_renderer.window_surface->w, g_renderer.window_surface->h });
+         if (!g_renderer.headless) SDL_UpdateWindowSurface(g_renderer.window);
+         PROFILE_END();
          return;
       }
    }
    
    renderer_clear();
+   ui64 scene_start_us = timing_get_time_us();
+   PROFILE_BEGIN("scene_render");
    scene_render(); // get all rendering calls from current scene
-   
-   // composite all visible layers
-   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
-      Layer* layer = find_layer_by_index(i);
-      if (!layer || !layer->visible || layer->handle == g_renderer.system_layer_handle) continue;
-      
-      SDL_SetSurfaceAlphaMod(layer->surface, layer->opacity);
-      
-      if (layer->can_draw_outside_viewport) {
-         SDL_BlitSurface(layer->surface, NULL, g_renderer.composite_surface, NULL);
-      } else {
-         SDL_BlitSurface(layer->surface, NULL, g_renderer.composite_surface, &g_renderer.unit_map);
-      }
-   }
+   PROFILE_END();
+   ui32 scene_us = (ui32)(timing_get_time_us() - scene_start_us);
+   timing_record_stage(STAGE_SCENE, scene_us);
    
    // draw system layer
    Layer* system_layer = find_layer(g_renderer.system_layer_handle);
@@ -218,19 +335,49 @@ void renderer_present(void) {
 
       // system data
       for (int i = 0; i < SYS_MAX; i++) {
-         if (g_renderer.system_layer_data[i]) {
+         if (i == SYS_FRAME_GRAPH && g_renderer.system_layer_data[i]) {
+            draw_frame_graph(system_layer, &x, &y); // no shadow, it has its own background
+         } else if (g_renderer.system_layer_data[i]) {
             int x_shadow = x + 1;
             int y_shadow = y + 1;
             draw_system_data(i, &x_shadow, &y_shadow, 1);
             draw_system_data(i, &x, &y, 0);
          }
       }
-      SDL_BlitSurface(system_layer->surface, NULL, g_renderer.composite_surface, NULL);
    }
    
-   SDL_BlitScaled(g_renderer.composite_surface, NULL,
-                 g_renderer.window_surface, NULL);
-   SDL_UpdateWindowSurface(g_renderer.window);
+   PROFILE_BEGIN("flush_draw_list");
+   flush_draw_list();
+   PROFILE_END();
+
+   // composite all visible layers, but only where something changed
+   bool fused = can_fuse_present();
+   if (!fused && g_renderer.composite_stale) g_renderer.full_redraw = true;
+   build_frame_dirty_rects();
+
+   // the snapshot and window surface are the render thread's until the last frame is done
+   ui64 finish_start_us = timing_get_time_us();
+   PROFILE_BEGIN("finish_frame");
+   ui32 wait_us = finish_frame();
+   PROFILE_END();
+   ui32 finish_us = (ui32)(timing_get_time_us() - finish_start_us); // waiting + putting the last frame up
+   build_frame_snapshot(fused);
+   g_renderer.last_pixels_composited = 0;
+   for (ui32 i = 0; i < g_renderer.frame.dirty_count; i++) {
+      g_renderer.last_pixels_composited += g_renderer.frame.dirty_rects[i].w * g_renderer.frame.dirty_rects[i].h;
+   }
+   timing_record_stage(STAGE_PRESENT_WAIT, wait_us);
+   timing_record_stage(STAGE_RENDER, (ui32)(timing_get_time_us() - start_us) - scene_us - finish_us);
+
+   if (g_renderer.pipelined) {
+      // goes up on the window next call, once the render thread is through with it
+      g_renderer.frame_in_flight = true;
+      SDL_SemPost(g_renderer.frame_ready);
+   } else {
+      render_frame(&g_renderer.frame);
+      present_frame(&g_renderer.frame);
+   }
+   PROFILE_END();
 }
 
 void renderer_handle_window_event(SDL_Event* event) {
@@ -238,7 +385,9 @@ void renderer_handle_window_event(SDL_Event* event) {
    
    switch (event->window.event) {
    case SDL_WINDOWEVENT_SIZE_CHANGED:
-      g_renderer.window_surface = SDL_GetWindowSurface(g_renderer.window); // updates w/h
+      finish_frame(); // the old window surface is about to go away
+      refresh_stale_composite(); // while the layers still match the old mapping
+      g_renderer.window_surface = get_window_surface(); // updates w/h
       if (d_dne(g_renderer.window_surface)) d_err("HELP! can't get the window surface");
       calculate_mapping();
       break;
@@ -253,7 +402,7 @@ void renderer_handle_window_event(SDL_Event* event) {
       break;
 
    case SDL_WINDOWEVENT_EXPOSED:
-      // hello
+      g_renderer.full_redraw = true;
       break;
       
    case SDL_WINDOWEVENT_MINIMIZED:
@@ -269,6 +418,7 @@ void renderer_handle_window_event(SDL_Event* event) {
 // CONFIG OPTIONS
 void renderer_set_display_resolution(DisplayResolution res) {
    if (!g_renderer.initialized) return;
+   finish_frame();
    
    g_renderer.display_resolution = res;
    calculate_mapping();
@@ -276,6 +426,11 @@ void renderer_set_display_resolution(DisplayResolution res) {
 
 void renderer_set_window_mode(WindowMode mode) {
    if (!g_renderer.initialized || mode == g_renderer.window_mode) return;
+   if (g_renderer.headless) {
+      g_renderer.window_mode = mode; // no window to change, just remember it
+      return;
+   }
+   finish_frame();
 
    // going to fullscreen
    if (g_renderer.window_mode == WINDOW_WINDOWED) {
@@ -312,7 +467,7 @@ void renderer_set_resize_mode(ResizeMode mode) {
    if (!g_renderer.initialized) return;
 
    // might actually make this so you have to specify scale_factor
-   if (mode == RESIZE_FIXED) {
+   if (mode == RESIZE_FIXED && !g_renderer.headless) {
       switch (g_renderer.display_resolution) {
       case RES_VGA: {
          int w = GAME_WIDTH_VGA * g_renderer.scale_factor;
@@ -337,9 +492,61 @@ void renderer_set_resize_mode(ResizeMode mode) {
 void renderer_set_clear_color(ui8 color_index) {
    if (!g_renderer.initialized) return;
    
+   if (color_index != g_renderer.clear_color_index) g_renderer.full_redraw = true;
    g_renderer.clear_color_index = color_index;
 }
 
+void renderer_set_fused_present(bool fused) {
+   if (!g_renderer.initialized) return;
+   g_renderer.fused_present = fused;
+}
+
+void renderer_set_recording(bool recording) {
+   if (!g_renderer.initialized) return;
+   if (!recording) flush_draw_list();
+   g_renderer.recording = recording;
+}
+
+void renderer_set_text_cache_bytes(size_t max_bytes) {
+   if (!g_renderer.initialized) return;
+   textcache_set_max_bytes(&g_renderer.text_cache, max_bytes);
+}
+
+void renderer_set_pipelined(bool pipelined) {
+   if (!g_renderer.initialized || pipelined == g_renderer.pipelined) return;
+
+   if (!pipelined) {
+      stop_render_thread();
+      g_renderer.pipelined = false;
+      for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+         update_layer_mirror(&g_renderer.layers[g_renderer.draw_order[i]]); // frees them now that pipelined is off
+      }
+      d_logv(2, "pipelined rendering off");
+      return;
+   }
+
+   g_renderer.pipelined = true;
+   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+      if (!update_layer_mirror(&g_renderer.layers[g_renderer.draw_order[i]])) {
+         renderer_set_pipelined(false);
+         return;
+      }
+   }
+   g_renderer.frame_ready = SDL_CreateSemaphore(0);
+   g_renderer.frame_done = SDL_CreateSemaphore(0);
+   if (d_dne(g_renderer.frame_ready) || d_dne(g_renderer.frame_done)) {
+      renderer_set_pipelined(false);
+      return;
+   }
+   g_renderer.render_thread = SDL_CreateThread(render_thread_main, "render", NULL);
+   if (d_dne(g_renderer.render_thread)) {
+      renderer_set_pipelined(false);
+      return;
+   }
+   g_renderer.full_redraw = true; // mirrors start out transparent
+   d_logv(2, "pipelined rendering on");
+}
+
 int* renderer_get_display_resolution(void) {
    if (!g_renderer.initialized) return NULL;
    return (int*)&g_renderer.display_resolution;
@@ -357,37 +564,35 @@ int* renderer_get_resize_mode(void) {
 
 // LAYER MANAGEMENT
 LayerHandle renderer_create_layer(bool can_draw_outside) {
-   if (g_renderer.layer_count >= g_renderer.layer_capacity) {
-      int new_capacity = g_renderer.layer_capacity * 2;
-      Layer* new_layers = realloc(g_renderer.layers, sizeof(Layer) * new_capacity);
-      if (d_dne(new_layers)) {
-         d_err("couldn't resize layer array");
-         return INVALID_LAYER;
-      }
-      g_renderer.layers = new_layers;
-      g_renderer.layer_capacity = new_capacity;
-      memset(&g_renderer.layers[g_renderer.layer_count], 0, 
-            sizeof(Layer) * (new_capacity - g_renderer.layer_count));
-   }
-   
-   // find next available slot
-   Layer* layer = &g_renderer.layers[g_renderer.layer_count];
+   finish_frame();
+   Layer* layer = allocate_layer_slot();
+   if (!layer) return INVALID_LAYER;
    
    layer->surface = create_layer_surface(can_draw_outside);
    if (d_dne(layer->surface)) {
       d_err("couldn't create layer surface");
+      release_layer_slot(layer);
       return INVALID_LAYER;
    }
-   
-   layer->handle = g_renderer.next_layer_handle++;
    layer->can_draw_outside_viewport = can_draw_outside;
+   if (!update_layer_mirror(layer)) {
+      SDL_FreeSurface(layer->surface);
+      layer->surface = NULL;
+      release_layer_slot(layer);
+      return INVALID_LAYER;
+   }
+   
+   ui32 slot = (ui32)(layer - g_renderer.layers);
+   layer->handle = ((LayerHandle)layer->generation << LAYER_SLOT_BITS) | slot;
    layer->size = 2;
    layer->visible = true;
    layer->opacity = 255;
+   reset_layer_dirty(layer);
       
-   g_renderer.layer_count++;
+   g_renderer.draw_order[g_renderer.layer_count++] = slot; // new layers go on top
+   g_renderer.full_redraw = true;
    
-   d_logv(2, "created layer %u (total %d)", layer->handle, g_renderer.layer_count);
+   d_logv(2, "created layer %u (slot %u, total %d)", layer->handle, slot, g_renderer.layer_count);
    
    return layer->handle;
 }
@@ -396,34 +601,35 @@ LayerHandle renderer_create_layer(bool can_draw_outside) {
 void renderer_destroy_layer(LayerHandle handle) {
    if (handle == INVALID_LAYER) return;
    
-   // get layer
-   int layer_index = -1;
-   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
-      if (g_renderer.layers[i].handle == handle) {
-         layer_index = (int)i;
-         break;
-      }
-   }
-   if (layer_index == -1) {
+   Layer* layer = find_layer(handle);
+   if (!layer) {
       d_log("attempted to destroy invalid layer %u", handle);
       return;
    }
-   
-   Layer* layer = &g_renderer.layers[layer_index];
+   finish_frame();
+   flush_draw_list(); // recorded commands might point at this slot
 
    // free   
    if (layer->surface) {
       SDL_FreeSurface(layer->surface);
       layer->surface = NULL;
    }
+   if (layer->mirror) {
+      SDL_FreeSurface(layer->mirror);
+      layer->mirror = NULL;
+   }
    
-   // remove from array, shift elements
-   for (ui32 i = layer_index; i < g_renderer.layer_count - 1; i++) {
-      g_renderer.layers[i] = g_renderer.layers[i + 1];
+   // only the draw order shifts, the slot itself just goes on the free list
+   ui32 slot = LAYER_HANDLE_SLOT(handle);
+   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+      if (g_renderer.draw_order[i] != slot) continue;
+      memmove(&g_renderer.draw_order[i], &g_renderer.draw_order[i + 1],
+              sizeof(ui32) * (g_renderer.layer_count - i - 1));
+      break;
    }
    g_renderer.layer_count--;
-   
-   memset(&g_renderer.layers[g_renderer.layer_count], 0, sizeof(Layer));
+   g_renderer.full_redraw = true;
+   release_layer_slot(layer);
    
    d_logv(2, "destroyed layer %u (total %d)", handle, g_renderer.layer_count);
 }
@@ -432,13 +638,18 @@ void renderer_set_layer_draw_outside(LayerHandle handle, bool can_draw) {
    Layer* layer = find_layer(handle);
    // TODO: preserve what was already done when scaling
    if (layer && layer->surface && can_draw != layer->can_draw_outside_viewport) {
+      finish_frame();
+      flush_draw_list();
       SDL_FreeSurface(layer->surface);
       layer->can_draw_outside_viewport = can_draw;
       layer->surface = create_layer_surface(layer->can_draw_outside_viewport);
+      reset_layer_dirty(layer);
+      g_renderer.full_redraw = true;
       if (d_dne(layer->surface)) {
          d_log("new surface don't exist");
          return;
       }
+      update_layer_mirror(layer);
    }
 }
 
@@ -446,6 +657,7 @@ void renderer_set_layer_visible(LayerHandle handle, bool visible) {
    Layer* layer = find_layer(handle);
    if (layer && visible != layer->visible) {
       layer->visible = visible;
+      g_renderer.full_redraw = true;
    }
 }
 
@@ -453,12 +665,14 @@ void renderer_set_layer_opacity(LayerHandle handle, ui8 opacity) {
    Layer* layer = find_layer(handle);
    if (layer && opacity != layer->opacity) {
       layer->opacity = opacity;
+      g_renderer.full_redraw = true;
    }
 }
 
 void renderer_set_layer_size(LayerHandle handle, ui8 size) {
    Layer* layer = find_layer(handle);
    if (layer && size != layer->size && size != 0) {
+      flush_draw_list(); // glyph runs still need the old size
       layer->size = size;
    }
 }
@@ -483,7 +697,18 @@ void renderer_draw_rect(LayerHandle handle, Rect rect, ui8 color_index) {
 void renderer_draw_rect_raw(Rect rect, ui8 color_index) {
    if (g_renderer.resize_in_progress || color_index >= PALETTE_SIZE) return;
    
-   SDL_FillRect(g_renderer.composite_surface, &rect, palette_map[color_index]);
+   // composite only gets cleared per dirty rect now, so hold onto these until then
+   if (g_renderer.raw_rect_count >= MAX_DIRTY_RECTS) {
+      if (!g_renderer.raw_rects_overflowed) {
+         d_log("WARNING: more than %d raw rects in a frame, the rest aren't drawn", MAX_DIRTY_RECTS);
+         g_renderer.raw_rects_overflowed = true;
+      }
+      return;
+   }
+   g_renderer.raw_rects[g_renderer.raw_rect_count] = rect;
+   g_renderer.raw_rect_colors[g_renderer.raw_rect_count] = color_index;
+   g_renderer.raw_rect_count++;
+   add_dirty_rect(g_renderer.dirty_rects, &g_renderer.dirty_count, rect);
 }
 
 void renderer_draw_fill(LayerHandle handle, ui8 color_index) {
@@ -491,8 +716,13 @@ void renderer_draw_fill(LayerHandle handle, ui8 color_index) {
    
    Layer* layer = find_layer(handle);
    if (!layer || !layer->surface) return;
-   
-   blit_rect(layer, NULL, color_index);
+
+   DrawCommand* command;
+   if (g_renderer.recording && (command = record_command(layer, DRAW_FILL, color_index))) {
+      command->bounds = (Rect){ 0, 0, layer->surface->w, layer->surface->h };
+      return;
+   }
+   fill_layer(layer, color_index);
 }
 
 void renderer_draw_char(LayerHandle handle, FontType font_type, char c, int x, int y, ui8 color_index) {
@@ -502,24 +732,8 @@ void renderer_draw_char(LayerHandle handle, FontType font_type, char c, int x, i
    if (!layer || !layer->surface || !font) return;
    if (c == ' ') return;
 
-   int sheet_index = (int)c - font->ascii_start;
-   if (sheet_index < 0 || sheet_index >= (font->image_w * font->image_h)) return;
-   
-   int tile_x = sheet_index % font->image_w;
-   int tile_y = sheet_index / font->image_w;
-   
-   Rect src_rect = {
-      tile_x * font->tile_w,
-      tile_y * font->tile_h,
-      font->tile_w,
-      font->tile_h
-   };
-   
-   // d_logv(3, "Char: %c, Index: %d, Tile: [%d, %d], SrcRect: [%d, %d, %d, %d]\n",
-          // c, sheet_index, tile_x, tile_y,
-          // src_rect.x, src_rect.y, src_rect.w, src_rect.h);
-   
-   renderer_blit_masked(handle, font->data, src_rect, x, y, color_index);
+   // a one glyph run lands in the same spot
+   renderer_draw_string(handle, font_type, (char[]){ c, '\0' }, x, y, color_index);
 }
 
 void renderer_draw_string(LayerHandle handle, FontType font_type, const char* str, int x, int y, ui8 color_index) {
@@ -527,32 +741,144 @@ void renderer_draw_string(LayerHandle handle, FontType font_type, const char* st
    Layer* layer = find_layer(handle);
    Font* font = file_get_font(&g_renderer.font_array, font_type);
    if (!layer || !layer->surface || !font) return;
-   
-   x -= (font->tile_w * layer->size); // uhh to line it up cause i add again
-   for (int i = 0; i < (int)strlen(str); i++) {
-      if (str[i] == ' ') {
-         x += (font->tile_w * layer->size);
-         continue;
+   ui32 length = (ui32)strlen(str);
+   if (length == 0) return;
+
+   DrawCommand* command;
+   if (!g_renderer.recording || !(command = record_command(layer, DRAW_GLYPHS, color_index))) {
+      draw_glyphs(layer, font, str, length, x, y, color_index);
+      return;
+   }
+   if (!drawlist_push_text(&g_renderer.draw_list, command, str, length)) {
+      command->culled = true; // nothing to draw from, do it now instead
+      flush_draw_list();
+      draw_glyphs(layer, font, str, length, x, y, color_index);
+      return;
+   }
+   command->font = (ui8)font_type;
+   command->x = x;
+   command->y = y;
+
+   // every glyph gets aligned down to the layer size, so pad a pixel block either side
+   Rect run = {
+      x - layer->size,
+      y - layer->size,
+      (int)(command->text_length * font->tile_w * layer->size) + layer->size * 2,
+      font->tile_h * layer->size + layer->size * 2
+   };
+   if (layer->can_draw_outside_viewport) {
+      run.x += g_renderer.unit_map.x;
+      run.y += g_renderer.unit_map.y;
+   }
+   Rect bounds = { 0, 0, layer->surface->w, layer->surface->h };
+   if (!SDL_IntersectRect(&run, &bounds, &command->bounds)) command->culled = true;
+}
+
+Sprite* renderer_get_sprite(const char* name) {
+   return file_get_sprite(&g_renderer.sprite_array, name);
+}
+
+void renderer_draw_sprite(LayerHandle handle, const Sprite* sprite, int frame, int x, int y, ui8 flags) {
+   if (g_renderer.resize_in_progress || !sprite) return;
+   if (frame < 0 || frame >= sprite->frame_count) return; // 0 frames until it has loaded
+   Layer* layer = find_layer(handle);
+   if (!layer || !layer->surface) return;
+
+   DrawCommand* command = NULL;
+   if (g_renderer.recording) {
+      // recorded by index, so anything that isn't in the sprite array goes now, in order
+      const SpriteArray* sprites = &g_renderer.sprite_array;
+      if (sprite >= sprites->sprites && sprite < sprites->sprites + sprites->sprite_count) {
+         command = record_command(layer, DRAW_SPRITE, 0);
+      } else {
+         flush_draw_list();
       }
+   }
+   if (!command) {
+      draw_sprite(layer, sprite, frame, x, y, flags);
+      return;
+   }
+   command->sprite = (ui16)(sprite - g_renderer.sprite_array.sprites);
+   command->sprite_flags = flags;
+   command->frame = (ui32)frame;
+   command->x = x;
+   command->y = y;
+
+   align_coords(&x, &y, layer->size);
+   Rect area = { x, y, sprite->tile_w * layer->size, sprite->tile_h * layer->size };
+   if (layer->can_draw_outside_viewport) {
+      area.x += g_renderer.unit_map.x;
+      area.y += g_renderer.unit_map.y;
+   }
+   Rect bounds = { 0, 0, layer->surface->w, layer->surface->h };
+   if (!SDL_IntersectRect(&area, &bounds, &command->bounds)) command->culled = true;
+}
 
-      int sheet_index = (int)str[i] - font->ascii_start;
-      if (sheet_index < 0 || sheet_index >= (font->image_w * font->image_h)) continue;
+void renderer_begin_sprites(void) {
+   SpriteBatch* batch = &g_renderer.sprite_batch;
+   if (batch->open && batch->count > 0) {
+      d_log("WARNING: sprite batch began again before it was submitted, dropping %u sprites", batch->count);
+   }
+   spritebatch_reset(batch);
+   batch->open = true;
+}
 
-      int tile_x = sheet_index % font->image_w;
-      int tile_y = sheet_index / font->image_w;
+void renderer_push_sprite(LayerHandle handle, const Sprite* sprite, int frame, int x, int y, ui8 flags) {
+   // just appends, everything gets checked once per layer/sheet at submit
+   SpriteBatch* batch = &g_renderer.sprite_batch;
+   if (!batch->open) {
+      d_err("renderer_push_sprite() outside renderer_begin_sprites()/renderer_submit_sprites()");
+      return;
+   }
+   if (!sprite) return;
+
+   const SpriteArray* sprites = &g_renderer.sprite_array;
+   ui16 sheet = (sprite >= sprites->sprites && sprite < sprites->sprites + sprites->sprite_count) ?
+                (ui16)(sprite - sprites->sprites) : SPRITEBATCH_NO_SHEET;
+   SpriteInstance* instance = spritebatch_push(batch, (ui16)LAYER_HANDLE_SLOT(handle), sheet);
+   if (!instance) {
+      renderer_draw_sprite(handle, sprite, frame, x, y, flags); // couldn't grow, at least it shows up
+      return;
+   }
+   instance->layer = handle;
+   instance->sprite = sprite;
+   instance->frame = frame;
+   instance->x = x;
+   instance->y = y;
+   instance->flags = flags;
+}
 
-      Rect src_rect = {
-         tile_x * font->tile_w,
-         tile_y * font->tile_h,
-         font->tile_w,
-         font->tile_h
-      };
-      // d_logv(3, "Char: %c, Index: %d, Tile: [%d, %d], SrcRect: [%d, %d, %d, %d]\n",
-          // str[i], sheet_index, tile_x, tile_y,
-          // src_rect.x, src_rect.y, src_rect.w, src_rect.h);
-      x += (font->tile_w * layer->size);
-      renderer_blit_masked(handle, font->data, src_rect, x, y, color_index);
+void renderer_submit_sprites(void) {
+   SpriteBatch* batch = &g_renderer.sprite_batch;
+   if (!batch->open) {
+      d_err("renderer_submit_sprites() without renderer_begin_sprites()");
+      return;
    }
+   batch->open = false;
+   batch->last_count = batch->count;
+   batch->last_culled = 0;
+   batch->last_layers = 0;
+   if (g_renderer.resize_in_progress || batch->count == 0) {
+      spritebatch_reset(batch);
+      return;
+   }
+
+   PROFILE_BEGIN("submit_sprites");
+   flush_draw_list(); // anything recorded before the batch lands first
+   spritebatch_sort(batch);
+   ui32 start = 0;
+   while (start < batch->count) {
+      ui32 end = start + 1;
+      while (end < batch->count && batch->sprites[end].layer == batch->sprites[start].layer) end++;
+      Layer* layer = find_layer(batch->sprites[start].layer);
+      if (layer && layer->surface) {
+         batch->last_culled += draw_batched_sprites(layer, &batch->sprites[start], end - start);
+         batch->last_layers++;
+      }
+      start = end;
+   }
+   spritebatch_reset(batch);
+   PROFILE_END();
 }
 
 // SYSTEM LAYER
@@ -585,26 +911,38 @@ static void draw_system_data(SystemData data, int* x, int* y, ui8 color) {
       break;
       
    case SYS_AVG_FPS:
-      ui32 min_ms = 0, max_ms = 0, avg_ms = 0, frames_over = 0;
-      char buffer[128];
-      timing_get_performance_info(&min_ms, &max_ms, &avg_ms, &frames_over);
+      TimingStats stats;
+      timing_get_frame_stats(&stats);
       
-      snprintf(buffer, sizeof(buffer), "avg = %u ms", avg_ms);
-      renderer_draw_string(handle, font, buffer, *x, *y, color);
-      if (frames_over > 0) {
-         snprintf(buffer, sizeof(buffer), "(%u over budget!)", frames_over);
-         renderer_draw_string(handle, font, buffer, (*x + (12 * 8)), *y, color);
+      if (stats.frames_over > 0) {
+         snprintf(buffer, sizeof(buffer), "avg = %.2f ms (%u over budget!)", stats.avg_ms, stats.frames_over);
+      } else {
+         snprintf(buffer, sizeof(buffer), "avg = %.2f ms", stats.avg_ms);
       }
+      renderer_draw_string(handle, font, buffer, *x, *y, color);
       *y += new_line;
-      snprintf(buffer, sizeof(buffer), "(min %u, max %u)", min_ms, max_ms);
+      snprintf(buffer, sizeof(buffer), "(min %.2f, max %.2f)", stats.min_ms, stats.max_ms);
       renderer_draw_string(handle, font, buffer, *x, *y, color);
       *y += new_line;
+      double* shown = g_renderer.percentile_text_ms;
+      if (!g_renderer.percentile_text[0] || shown[0] != stats.p50_ms || shown[1] != stats.p95_ms || shown[2] != stats.p99_ms) {
+         snprintf(g_renderer.percentile_text, sizeof(g_renderer.percentile_text), "p50 %.2f p95 %.2f p99 %.2f",
+                  stats.p50_ms, stats.p95_ms, stats.p99_ms);
+         shown[0] = stats.p50_ms;
+         shown[1] = stats.p95_ms;
+         shown[2] = stats.p99_ms;
+      }
+      renderer_draw_string(handle, font, g_renderer.percentile_text, *x, *y, color);
+      *y += new_line;
       break;
       
-   case SYS_LAYER_COUNT:
-      renderer_draw_string(handle, font, "haha weeeeee", *x, *y, color);
+   case SYS_FRAME_COUNTERS:
+      draw_system_counter("layers ", g_renderer.layer_count, *x, *y, color);
+      *y += new_line;
+      draw_system_counter("pixels ", g_renderer.last_pixels_composited, *x, *y, color);
+      *y += new_line;
+      draw_system_counter("glyphs ", g_renderer.last_glyphs_drawn, *x, *y, color);
       *y += new_line;
-      
       break;
 
    default:
@@ -612,6 +950,60 @@ static void draw_system_data(SystemData data, int* x, int* y, ui8 color) {
    }
 }
 
+static void draw_system_counter(const char* label, ui32 value, int x, int y, ui8 color) {
+   // digits by hand, no snprintf in the overlay
+   char digits[11];
+   int start = sizeof(digits) - 1;
+   digits[start] = '\0';
+   do {
+      digits[--start] = (char)('0' + value % 10);
+      value /= 10;
+   } while (value > 0);
+
+   LayerHandle handle = g_renderer.system_layer_handle;
+   Font* font = file_get_font(&g_renderer.font_array, FONT_SHARP_8_8);
+   if (!font) return;
+   renderer_draw_string(handle, FONT_SHARP_8_8, label, x, y, color);
+   x += (int)strlen(label) * font->tile_w * find_layer(handle)->size;
+   renderer_draw_string(handle, FONT_SHARP_8_8, &digits[start], x, y, color);
+}
+
+static void draw_frame_graph(Layer* layer, int* x, int* y) {
+   /* one column per frame, oldest on the left, each stacked from the bottom  */
+   /* by stage. the budget line is halfway up, anything past twice the budget */
+   /* gets cut off. columns are written straight into the surface             */
+   Rect area = { *x, *y, SYSTEM_GRAPH_FRAMES, SYSTEM_GRAPH_HEIGHT };
+   *y += SYSTEM_GRAPH_HEIGHT + 2; // padding
+   adjust_layer_rect(layer, &area);
+   if (area.x < 0 || area.y < 0 || area.w <= 0 || area.h <= 0 ||
+       area.x + area.w > layer->surface->w || area.y + area.h > layer->surface->h) return;
+
+   flush_draw_list(); // anything recorded for this layer has to land first
+   fill_layer_rect(layer, &area, GRAPH_BACKGROUND);
+
+   ui64 budget_ns = timing_get_target_frame_ns();
+   if (budget_ns == 0) budget_ns = TIMING_NS_PER_SEC / 60;
+   ui64 px_per_budget = (ui64)area.h / 2;
+   ui8* pixels = (ui8*)layer->surface->pixels;
+   int pitch = layer->surface->pitch;
+   int bottom = area.y + area.h - 1;
+
+   for (int column = 0; column < area.w; column++) {
+      const ui32* stages = timing_get_stage_history((ui32)(area.w - 1 - column));
+      if (!stages) continue;
+      ui64 total_us = 0;
+      int top = 0; // px filled so far
+      for (int s = 0; s < STAGE_MAX && top < area.h; s++) {
+         total_us += stages[s];
+         int height = (int)(total_us * 1000 * px_per_budget / budget_ns);
+         if (height > area.h) height = area.h;
+         ui8* pixel = pixels + (bottom - top) * pitch + area.x + column;
+         for (; top < height; top++, pixel -= pitch) *pixel = graph_stage_colors[s];
+      }
+   }
+   memset(pixels + (bottom - (int)px_per_budget) * pitch + area.x, GRAPH_BUDGET, area.w);
+}
+
 void renderer_draw_system_quit(ui8 duration_held) {
    LayerHandle handle = g_renderer.system_layer_handle;
    Layer* layer = find_layer(handle);
@@ -630,6 +1022,7 @@ void renderer_draw_system_quit(ui8 duration_held) {
 
 // UTILITY FUNCTIONS
 SDL_Surface* renderer_get_layer_surface(LayerHandle handle) {
+   flush_draw_list(); // caller is about to look at the pixels
    Layer* layer = find_layer(handle);
    return layer ? layer->surface : NULL;
 }
@@ -729,32 +1122,79 @@ static void calculate_mapping(void) {
       d_log("unhandled resize case");
    }
    
+   g_renderer.full_redraw = true;
+   
    d_logv(3, "unit_map: %s", d_name_rect(&g_renderer.unit_map));
    d_logv(3, "window_map: %s", d_name_rect(&g_renderer.window_map));
    d_logv(3, "scale_factor: %f", g_renderer.scale_factor);
 }
 
 static Layer* find_layer(LayerHandle handle) {
-   if (handle == INVALID_LAYER) return NULL;
+   // stale handles point at a slot that has moved on to a newer generation
+   ui32 slot = LAYER_HANDLE_SLOT(handle);
+   if (handle == INVALID_LAYER || slot >= g_renderer.slot_count) return NULL;
    
-   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
-      if (g_renderer.layers[i].handle == handle) {
-         return &g_renderer.layers[i];
-      }
-   }
-   return NULL;
+   Layer* layer = &g_renderer.layers[slot];
+   return (layer->handle == handle) ? layer : NULL;
 }
 
 static Layer* find_layer_by_index(ui32 index) {
-   // used when looping through all layers
+   // used when looping through all layers, index is the position in the draw order
    if (index >= g_renderer.layer_count) return NULL;
 
-   Layer* layer = &g_renderer.layers[index];   
-   if (!layer || layer->handle == INVALID_LAYER || !layer->surface) return NULL;
+   Layer* layer = &g_renderer.layers[g_renderer.draw_order[index]];
+   if (layer->handle == INVALID_LAYER || !layer->surface) return NULL;
    
    return layer;
 }
 
+static Layer* allocate_layer_slot(void) {
+   /* reuses the most recently freed slot, or takes a new one off the end. */
+   /* the layer comes back zeroed apart from its generation               */
+   ui32 slot = g_renderer.free_slot;
+   if (slot != LAYER_NO_SLOT) {
+      g_renderer.free_slot = g_renderer.layers[slot].next_free;
+   } else {
+      if (g_renderer.slot_count >= LAYER_MAX_SLOTS) {
+         d_err("out of layer slots");
+         return NULL;
+      }
+      if (g_renderer.slot_count >= g_renderer.layer_capacity) {
+         // each array keeps whatever it got, capacity only moves once all of them grew
+         ui32 new_capacity = g_renderer.layer_capacity * 2;
+         Layer* new_layers = realloc(g_renderer.layers, sizeof(Layer) * new_capacity);
+         if (new_layers) g_renderer.layers = new_layers;
+         ui32* new_draw_order = realloc(g_renderer.draw_order, sizeof(ui32) * new_capacity);
+         if (new_draw_order) g_renderer.draw_order = new_draw_order;
+         FrameLayer* new_frame_layers = realloc(g_renderer.frame.layers, sizeof(FrameLayer) * new_capacity);
+         if (new_frame_layers) g_renderer.frame.layers = new_frame_layers;
+         if (d_dne(new_layers) || d_dne(new_draw_order) || d_dne(new_frame_layers) ||
+             !resize_frame_sources(new_capacity)) {
+            d_err("couldn't resize layer arrays");
+            return NULL;
+         }
+         memset(&g_renderer.layers[g_renderer.layer_capacity], 0,
+                sizeof(Layer) * (new_capacity - g_renderer.layer_capacity));
+         g_renderer.layer_capacity = new_capacity;
+      }
+      slot = g_renderer.slot_count++;
+   }
+
+   Layer* layer = &g_renderer.layers[slot];
+   ui16 generation = layer->generation ? layer->generation : 1;
+   memset(layer, 0, sizeof(Layer));
+   layer->generation = generation;
+   return layer;
+}
+
+static void release_layer_slot(Layer* layer) {
+   layer->handle = INVALID_LAYER;
+   layer->generation++;
+   if (layer->generation == 0) layer->generation = 1; // wrapped, 0 would make slot 0 look invalid
+   layer->next_free = g_renderer.free_slot;
+   g_renderer.free_slot = (ui32)(layer - g_renderer.layers);
+}
+
 
 static SDL_Surface* create_composite_surface(void) {
    SDL_Surface* surface;
@@ -772,6 +1212,12 @@ static SDL_Surface* create_composite_surface(void) {
    return surface;
 }
 
+static SDL_Surface* get_window_surface(void) {
+   // headless keeps the one renderer_init() made, it never changes size
+   if (g_renderer.headless) return g_renderer.window_surface;
+   return SDL_GetWindowSurface(g_renderer.window);
+}
+
 static SDL_Surface* create_layer_surface(bool can_draw_outside) {
    SDL_Surface* surface;
    if (can_draw_outside) {
@@ -797,6 +1243,8 @@ static SDL_Surface* create_layer_surface(bool can_draw_outside) {
 
 // TODO: preserve what was already drawn when scaling
 static void resize_all_surfaces(void) {
+   finish_frame();
+   flush_draw_list();
    d_log("");
    d_logl("recreating composite surface");
    SDL_FreeSurface(g_renderer.composite_surface);
@@ -812,17 +1260,20 @@ static void resize_all_surfaces(void) {
       else d_logl(", %u", layer->handle);
       
       layer->surface = create_layer_surface(layer->can_draw_outside_viewport);
+      reset_layer_dirty(layer);
       
       if (d_dne(layer->surface)) {
          d_log("new surface doesn't exist");
          return;
       }
+      update_layer_mirror(layer);
       d_logl(" (%dx%d)", layer->surface->w, layer->surface->h);
    }
    d_logl("\n");
    
-   g_renderer.window_surface = SDL_GetWindowSurface(g_renderer.window);
+   g_renderer.window_surface = get_window_surface();
    if (d_dne(g_renderer.window_surface)) d_err("can't get widnow surfact haha");
+   g_renderer.full_redraw = true;
    // d_print_renderer_dims();
    return;
 }
@@ -843,21 +1294,201 @@ static void align_rect(Rect* rect, ui8 size) {
 static void blit_rect(Layer* layer, Rect* rect, ui8 color_index) {
    // TODO: if composite or window surface, use palette[color_index]. uh make it a separate fn
    /* assumes layer exists and color is in bounds */
-   Rect* adjusted_rect = rect;
-   if (adjusted_rect) {
-      if (layer->can_draw_outside_viewport) {
-         adjusted_rect->x += g_renderer.unit_map.x;
-         adjusted_rect->y += g_renderer.unit_map.y;
+   adjust_layer_rect(layer, rect);
+   if (g_renderer.recording && rect) {
+      Rect bounds = { 0, 0, layer->surface->w, layer->surface->h };
+      Rect clipped;
+      if (!SDL_IntersectRect(rect, &bounds, &clipped)) return; // wouldn't have drawn anything
+      DrawCommand* command = record_command(layer, DRAW_RECT, color_index);
+      if (command) {
+         command->bounds = clipped;
+         return;
+      }
+   }
+   fill_layer_rect(layer, rect, color_index);
+}
+
+static void adjust_layer_rect(Layer* layer, Rect* rect) {
+   // viewport coords -> layer surface coords, aligned to the layer size
+   if (!rect) return;
+   if (layer->can_draw_outside_viewport) {
+      rect->x += g_renderer.unit_map.x;
+      rect->y += g_renderer.unit_map.y;
+   }
+   align_rect(rect, layer->size);
+}
+
+static void fill_layer_rect(Layer* layer, Rect* rect, ui8 color_index) {
+   // rect is already adjusted, NULL fills the whole layer
+   resolve_layer_base(layer);
+   SDL_FillRect(layer->surface, rect, color_index);
+   mark_layer_dirty(layer, rect);
+}
+
+static void fill_layer(Layer* layer, ui8 color_index) {
+   if (color_index == layer->base_color) {
+      // layer was restored to this color by renderer_clear(), only undo what
+      // was drawn over it so far this frame
+      for (ui32 r = 0; r < layer->dirty_count; r++) {
+         SDL_FillRect(layer->surface, &layer->dirty_rects[r], color_index);
       }
-      align_rect(adjusted_rect, layer->size);
+      layer->base_resolved = true;
+      return;
    }
-   SDL_FillRect(layer->surface, adjusted_rect, color_index);
+   
+   layer->base_color = color_index;
+   layer->base_resolved = true;
+   fill_layer_rect(layer, NULL, color_index);
 }
 
-static void renderer_blit_masked(LayerHandle handle, ImageData* source, Rect src_rect,
+static void draw_glyphs(Layer* layer, Font* font, const char* str, ui32 length, int x, int y, ui8 color_index) {
+   PROFILE_BEGIN("draw_glyphs");
+   if (layer->handle != g_renderer.system_layer_handle) g_renderer.glyphs_drawn += length;
+   if (draw_cached_run(layer, font, str, length, x, y, color_index)) {
+      PROFILE_END();
+      return;
+   }
+   x -= (font->tile_w * layer->size); // uhh to line it up cause i add again
+   for (ui32 i = 0; i < length; i++) {
+      if (str[i] == ' ') {
+         x += (font->tile_w * layer->size);
+         continue;
+      }
+
+      int sheet_index = (int)str[i] - font->ascii_start;
+      if (sheet_index < 0 || sheet_index >= (font->image_w * font->image_h)) continue;
+
+      int tile_x = sheet_index % font->image_w;
+      int tile_y = sheet_index / font->image_w;
+
+      Rect src_rect = {
+         tile_x * font->tile_w,
+         tile_y * font->tile_h,
+         font->tile_w,
+         font->tile_h
+      };
+      // d_logv(3, "Char: %c, Index: %d, Tile: [%d, %d], SrcRect: [%d, %d, %d, %d]\n",
+          // str[i], sheet_index, tile_x, tile_y,
+          // src_rect.x, src_rect.y, src_rect.w, src_rect.h);
+      x += (font->tile_w * layer->size);
+      if (font->glyph_rows) draw_glyph(layer, font, sheet_index, x, y, color_index);
+      else renderer_blit_masked(layer, font->data, src_rect, x, y, color_index);
+   }
+   PROFILE_END();
+}
+
+static void draw_sprite(Layer* layer, const Sprite* sprite, int frame, int dest_x, int dest_y, ui8 flags) {
+   /* same clipping and pixel mapping as renderer_blit_masked(): dest pixel */
+   /* dx, dy shows frame pixel src_clip_left + dx / size, src_clip_top +    */
+   /* dy / size, counted from the far edge when flipped                     */
+   PROFILE_BEGIN("draw_sprite");
+   int size = layer->size;
+   align_coords(&dest_x, &dest_y, size);
+   Rect dest_rect = { dest_x, dest_y, sprite->tile_w * size, sprite->tile_h * size };
+   int src_clip_left, src_clip_top;
+   if (!clip_masked_rect(layer, &dest_rect, &src_clip_left, &src_clip_top)) {
+      PROFILE_END();
+      return;
+   }
+   resolve_layer_base(layer);
+
+   ui8* dest_row = (ui8*)layer->surface->pixels + dest_rect.y * layer->surface->pitch + dest_rect.x;
+   if (sprite->rows) {
+      blit_sprite_spans(dest_row, layer->surface->pitch, dest_rect.w, dest_rect.h, sprite, frame,
+                        src_clip_left, src_clip_top, size, flags);
+   } else {
+      blit_sprite_sampled(dest_row, layer->surface->pitch, dest_rect.w, dest_rect.h, sprite, frame,
+                          src_clip_left, src_clip_top, size, flags);
+   }
+   mark_layer_dirty(layer, &dest_rect);
+   PROFILE_END();
+}
+
+static ui32 draw_batched_sprites(Layer* layer, const SpriteInstance* sprites, ui32 count) {
+   /* one layer's share of a batch, sorted by sheet. bounds are what      */
+   /* clip_masked_rect() lets the layer draw on, in viewport coords, so   */
+   /* anything entirely outside is dropped before any clipping. returns   */
+   /* how many that was                                                   */
+   Rect bounds = { 0, 0, g_renderer.unit_map.w, g_renderer.unit_map.h };
+   if (layer->can_draw_outside_viewport) {
+      bounds = (Rect){ -g_renderer.unit_map.x, -g_renderer.unit_map.y, layer->surface->w, layer->surface->h };
+   }
+   int size = layer->size;
+   const Sprite* sprite = NULL;
+   int sprite_w = 0, sprite_h = 0;
+   ui32 culled = 0;
+
+   for (ui32 i = 0; i < count; i++) {
+      const SpriteInstance* instance = &sprites[i];
+      if (instance->sprite != sprite) {
+         sprite = instance->sprite;
+         sprite_w = sprite->tile_w * size;
+         sprite_h = sprite->tile_h * size;
+      }
+      if (instance->frame < 0 || instance->frame >= sprite->frame_count) continue; // 0 frames while loading
+
+      int x = instance->x, y = instance->y;
+      align_coords(&x, &y, size);
+      if (x >= bounds.x + bounds.w || y >= bounds.y + bounds.h || x + sprite_w <= bounds.x || y + sprite_h <= bounds.y) {
+         culled++;
+         continue;
+      }
+      draw_sprite(layer, sprite, instance->frame, instance->x, instance->y, instance->flags);
+   }
+   return culled;
+}
+
+static DrawCommand* record_command(Layer* layer, DrawOp op, ui8 color_index) {
+   // NULL means draw it straight away. whatever was recorded before goes first
+   DrawCommand* command = drawlist_push(&g_renderer.draw_list);
+   if (!command) {
+      flush_draw_list();
+      return NULL;
+   }
+   command->op = op;
+   command->color_index = color_index;
+   command->layer = (ui16)(layer - g_renderer.layers);
+   return command;
+}
+
+static void flush_draw_list(void) {
+   /* runs everything recorded since the last flush, a layer at a time */
+   DrawList* list = &g_renderer.draw_list;
+   if (list->count == 0) return;
+
+   drawlist_optimize(list);
+   for (ui32 i = 0; i < list->count; i++) {
+      DrawCommand* command = &list->commands[i];
+      if (command->culled) continue;
+      Layer* layer = &g_renderer.layers[command->layer];
+
+      switch (command->op) {
+      case DRAW_RECT:
+         fill_layer_rect(layer, &command->bounds, command->color_index);
+         break;
+      case DRAW_FILL:
+         fill_layer(layer, command->color_index);
+         break;
+      case DRAW_GLYPHS: {
+         Font* font = file_get_font(&g_renderer.font_array, command->font);
+         if (font) draw_glyphs(layer, font, list->text + command->text_offset,
+                               command->text_length, command->x, command->y, command->color_index);
+         break;
+      }
+      case DRAW_SPRITE:
+         draw_sprite(layer, &g_renderer.sprite_array.sprites[command->sprite], (int)command->frame,
+                     command->x, command->y, command->sprite_flags);
+         break;
+      default:
+         d_log("unhandled draw command");
+      }
+   }
+   drawlist_reset(list);
+}
+
+static void renderer_blit_masked(Layer* layer, ImageData* source, Rect src_rect,
                                  int dest_x, int dest_y, ui8 color_index) {
    if (g_renderer.resize_in_progress || color_index >= PALETTE_SIZE) return;
-   Layer* layer = find_layer(handle);
    if (!layer || !layer->surface || !source) return;
    
    align_coords(&dest_x, &dest_y, layer->size);
@@ -868,8 +1499,45 @@ static void renderer_blit_masked(LayerHandle handle, ImageData* source, Rect src
       src_rect.w * layer->size,
       src_rect.h * layer->size
    };
+   int src_clip_left, src_clip_top;
+   if (!clip_masked_rect(layer, &dest_rect, &src_clip_left, &src_clip_top)) return;
+   PROFILE_BEGIN("renderer_blit_masked");
+   resolve_layer_base(layer);
+   
+   ui8* layer_pixels = (ui8*)layer->surface->pixels;
+   int layer_pitch = layer->surface->pitch;
    
-   // bounds check
+   for (int dest_y = 0; dest_y < dest_rect.h; dest_y++) {
+      for (int dest_x = 0; dest_x < dest_rect.w; dest_x++) {
+         // map destination pixel back to original unclipped position
+         int src_x = src_rect.x + src_clip_left + (dest_x / layer->size);
+         int src_y = src_rect.y + src_clip_top + (dest_y / layer->size);
+         
+         // bounds check for source image
+         if (src_x >= source->width || src_y >= source->height ||
+             src_x < 0 || src_y < 0) continue;
+         
+         if (source->data[src_y * source->width + src_x] == PALETTE_TRANSPARENT) continue;
+         
+         // draw the destination pixel
+         int screen_x = dest_rect.x + dest_x;
+         int screen_y = dest_rect.y + dest_y;
+         
+         // bounds check for layer surface
+         if (screen_x >= 0 && screen_x < layer->surface->w && 
+             screen_y >= 0 && screen_y < layer->surface->h) {
+            layer_pixels[screen_y * layer_pitch + screen_x] = color_index;
+         }
+      }
+   }
+   mark_layer_dirty(layer, &dest_rect);
+   PROFILE_END();
+}
+
+static bool clip_masked_rect(Layer* layer, Rect* dest_rect, int* src_clip_left, int* src_clip_top) {
+   /* dest_rect comes in as viewport coords and goes out as surface coords, */
+   /* clipped to what the layer can draw on. src_clip_* are in source      */
+   /* pixels. false if nothing is left                                     */
    int lower_bound_x, lower_bound_y, upper_bound_x, upper_bound_y;
    if (layer->can_draw_outside_viewport) {
       // can draw anywhere on the surface, expressed in window coordinates
@@ -885,66 +1553,648 @@ static void renderer_blit_masked(LayerHandle handle, ImageData* source, Rect src
       upper_bound_y = g_renderer.unit_map.h;
    }
 
-   if (dest_rect.x + dest_rect.w <= lower_bound_x ||
-       dest_rect.y + dest_rect.h <= lower_bound_y ||
-       dest_rect.x >= upper_bound_x ||
-       dest_rect.y >= upper_bound_y) {
-      return;
+   if (dest_rect->x + dest_rect->w <= lower_bound_x ||
+       dest_rect->y + dest_rect->h <= lower_bound_y ||
+       dest_rect->x >= upper_bound_x ||
+       dest_rect->y >= upper_bound_y) {
+      return false;
    }
    
    // TODO: adjust this to align with layer size
    // clamp to drawing bounds
-   int clip_left   = (dest_rect.x < lower_bound_x) ? (lower_bound_x - dest_rect.x) : 0;
-   int clip_top    = (dest_rect.y < lower_bound_y) ? (lower_bound_y - dest_rect.y) : 0;
-   int clip_right  = (dest_rect.x + dest_rect.w > upper_bound_x) ?
-                     (dest_rect.x + dest_rect.w - upper_bound_x) : 0;
-   int clip_bottom = (dest_rect.y + dest_rect.h > upper_bound_y) ?
-                     (dest_rect.y + dest_rect.h - upper_bound_y) : 0;
+   int clip_left   = (dest_rect->x < lower_bound_x) ? (lower_bound_x - dest_rect->x) : 0;
+   int clip_top    = (dest_rect->y < lower_bound_y) ? (lower_bound_y - dest_rect->y) : 0;
+   int clip_right  = (dest_rect->x + dest_rect->w > upper_bound_x) ?
+                     (dest_rect->x + dest_rect->w - upper_bound_x) : 0;
+   int clip_bottom = (dest_rect->y + dest_rect->h > upper_bound_y) ?
+                     (dest_rect->y + dest_rect->h - upper_bound_y) : 0;
    
-   int src_clip_left = clip_left / layer->size;
-   int src_clip_top = clip_top / layer->size;
+   *src_clip_left = clip_left / layer->size;
+   *src_clip_top = clip_top / layer->size;
    
    // adjust destination rect
-   dest_rect.x += clip_left;
-   dest_rect.y += clip_top;
-   dest_rect.w -= (clip_left + clip_right);
-   dest_rect.h -= (clip_bottom + clip_top);
+   dest_rect->x += clip_left;
+   dest_rect->y += clip_top;
+   dest_rect->w -= (clip_left + clip_right);
+   dest_rect->h -= (clip_bottom + clip_top);
    
-   if (dest_rect.w <= 0 || dest_rect.h <= 0) return;
-   
-   ui8* layer_pixels = (ui8*)layer->surface->pixels;
-   int layer_pitch = layer->surface->pitch;
+   if (dest_rect->w <= 0 || dest_rect->h <= 0) return false;
    
    if (layer->can_draw_outside_viewport) {
-      dest_rect.x += g_renderer.unit_map.x;
-      dest_rect.y += g_renderer.unit_map.y;
+      dest_rect->x += g_renderer.unit_map.x;
+      dest_rect->y += g_renderer.unit_map.y;
    }
-   
-   for (int dest_y = 0; dest_y < dest_rect.h; dest_y++) {
-      for (int dest_x = 0; dest_x < dest_rect.w; dest_x++) {
-         // map destination pixel back to original unclipped position
-         int src_x = src_rect.x + src_clip_left + (dest_x / layer->size);
-         int src_y = src_rect.y + src_clip_top + (dest_y / layer->size);
-         
-         // bounds check for source image
-         if (src_x >= source->width || src_y >= source->height ||
-             src_x < 0 || src_y < 0) continue;
-         
-         int src_offset = (src_y * source->width + src_x) * 4;
-         
-         if (source->data[src_offset + 1] > 128) continue; // transparent
-         
-         // draw the destination pixel
-         int screen_x = dest_rect.x + dest_x;
-         int screen_y = dest_rect.y + dest_y;
-         
-         // bounds check for layer surface
-         if (screen_x >= 0 && screen_x < layer->surface->w && 
-             screen_y >= 0 && screen_y < layer->surface->h) {
-            layer_pixels[screen_y * layer_pitch + screen_x] = color_index;
+   return true;
+}
+
+static void draw_glyph(Layer* layer, const Font* font, int glyph, int dest_x, int dest_y, ui8 color_index) {
+   /* same clipping and pixel mapping as renderer_blit_masked(), but each  */
+   /* glyph row is a bit mask. set bits come in runs, and a run of source  */
+   /* pixels is one memset per dest row                                    */
+   if (glyph < 0 || glyph >= font->glyph_count) return;
+   align_coords(&dest_x, &dest_y, layer->size);
+
+   int size = layer->size;
+   Rect dest_rect = { dest_x, dest_y, font->tile_w * size, font->tile_h * size };
+   int src_clip_left, src_clip_top;
+   if (!clip_masked_rect(layer, &dest_rect, &src_clip_left, &src_clip_top)) return;
+   resolve_layer_base(layer);
+
+   ui8* dest_row = (ui8*)layer->surface->pixels + dest_rect.y * layer->surface->pitch + dest_rect.x;
+   expand_glyph(dest_row, layer->surface->pitch, dest_rect.w, dest_rect.h,
+                font->glyph_rows + glyph * font->tile_h, font->tile_w,
+                src_clip_left, src_clip_top, size, color_index);
+   mark_layer_dirty(layer, &dest_rect);
+}
+
+static void expand_glyph(ui8* dest_row, int pitch, int w, int h, const ui16* rows, int tile_w,
+                         int src_clip_left, int src_clip_top, int size, ui8 color_index) {
+   // dest column dx shows source column src_clip_left + dx / size
+   ui16 visible = (ui16)(((1u << tile_w) - 1) & ~((1u << src_clip_left) - 1));
+   for (int dy = 0; dy < h; dy++, dest_row += pitch) {
+      ui32 mask = rows[src_clip_top + dy / size] & visible;
+      while (mask) {
+         int first = 0;
+         while (!(mask & (1u << first))) first++;
+         int last = first;
+         while (mask & (1u << (last + 1))) last++;
+         mask &= ~(((1u << (last + 1)) - 1));
+
+         int x0 = (first - src_clip_left) * size;
+         int x1 = (last + 1 - src_clip_left) * size;
+         if (x0 >= w) break;
+         if (x1 > w) x1 = w;
+         memset(dest_row + x0, color_index, x1 - x0);
+      }
+   }
+}
+
+static bool draw_cached_run(Layer* layer, Font* font, const char* str, ui32 length, int x, int y, ui8 color_index) {
+   /* draws the whole run as one strip out of the text cache. only runs   */
+   /* that fit inside the drawing bounds come through here, clipped ones  */
+   /* keep the per glyph source mapping from clip_masked_rect(). false    */
+   /* means the caller has to draw it glyph by glyph                      */
+   int size = layer->size;
+   if (!font->glyph_rows || color_index == g_renderer.transparent_color_index) return false;
+   if (x < 0 && x % size != 0) return false; // glyphs either side of 0 would round towards it differently
+
+   int steps = 0, inked = 0; // pen steps (spaces included), glyphs that draw something
+   for (ui32 i = 0; i < length; i++) {
+      int sheet_index = (int)str[i] - font->ascii_start;
+      if (str[i] == ' ') steps++;
+      else if (sheet_index >= 0 && sheet_index < (font->image_w * font->image_h)) {
+         steps++;
+         if (sheet_index < font->glyph_count) inked++;
+      }
+   }
+   if (inked == 0) return true;
+
+   int dest_x = x, dest_y = y;
+   align_coords(&dest_x, &dest_y, size);
+   Rect run_rect = { dest_x, dest_y, steps * font->tile_w * size, font->tile_h * size };
+   Rect dest_rect = run_rect;
+   int src_clip_left, src_clip_top;
+   if (!clip_masked_rect(layer, &dest_rect, &src_clip_left, &src_clip_top)) return false;
+   if (dest_rect.w != run_rect.w || dest_rect.h != run_rect.h) return false;
+
+   TextCache* cache = &g_renderer.text_cache;
+   ui8 font_id = (ui8)(font - g_renderer.font_array.fonts);
+   const TextRun* run = textcache_find(cache, font_id, color_index, (ui8)size, str, length);
+   if (!run) {
+      TextRun* new_run = textcache_insert(cache, font_id, color_index, (ui8)size, str, length,
+                                          run_rect.w, run_rect.h);
+      if (!new_run) return false;
+      rasterize_run(new_run, font, str, length, size, color_index);
+      run = new_run;
+   }
+
+   resolve_layer_base(layer);
+   ui8* dest_row = (ui8*)layer->surface->pixels + dest_rect.y * layer->surface->pitch + dest_rect.x;
+   const ui8* src_row = run->pixels;
+   for (int dy = 0; dy < run->h; dy++, dest_row += layer->surface->pitch, src_row += run->w) {
+      composite_merge(dest_row, src_row, run->w);
+   }
+   mark_layer_dirty(layer, &dest_rect);
+   return true;
+}
+
+static void rasterize_run(TextRun* run, const Font* font, const char* str, ui32 length, int size, ui8 color_index) {
+   // same pen movement as draw_glyphs(), into a strip that starts out transparent
+   memset(run->pixels, g_renderer.transparent_color_index, (size_t)run->w * run->h);
+   int advance = font->tile_w * size;
+   int pen = 0;
+   for (ui32 i = 0; i < length; i++) {
+      int sheet_index = (int)str[i] - font->ascii_start;
+      if (str[i] != ' ' && (sheet_index < 0 || sheet_index >= (font->image_w * font->image_h))) continue;
+      if (str[i] != ' ' && sheet_index < font->glyph_count) {
+         expand_glyph(run->pixels + pen, run->w, advance, run->h,
+                      font->glyph_rows + sheet_index * font->tile_h, font->tile_w, 0, 0, size, color_index);
+      }
+      pen += advance;
+   }
+}
+
+static void blit_sprite_spans(ui8* dest_row, int pitch, int w, int h, const Sprite* sprite, int frame,
+                              int src_clip_left, int src_clip_top, int size, ui8 flags) {
+   /* only the opaque runs of each row get touched. a run of source pixels */
+   /* is a memcpy at size 1 and a memset per pixel above that, and rows    */
+   /* the layer size repeats copy the row above                            */
+   int tile_w = sprite->tile_w, tile_h = sprite->tile_h;
+   const SpriteRow* rows = sprite->rows + frame * tile_h;
+   const ImageData* image = sprite->data; // only read without SPRITE_RLE
+   const ui8* frame_pixels = sprite->pixels ? NULL :
+                             image->data + (size_t)(frame / sprite->image_w) * tile_h * image->width +
+                             (frame % sprite->image_w) * tile_w;
+   bool flip_x = (flags & SPRITE_FLIP_X) != 0;
+   bool flip_y = (flags & SPRITE_FLIP_Y) != 0;
+
+   int prev_row = -1;
+   for (int dy = 0; dy < h; dy++, dest_row += pitch) {
+      int row = src_clip_top + dy / size;
+      int src_y = flip_y ? tile_h - 1 - row : row;
+      bool repeat = (row == prev_row);
+      prev_row = row;
+      const ui8* run = sprite->pixels ? sprite->pixels + rows[src_y].first_pixel : NULL;
+
+      int run_x = 0;
+      for (ui32 s = rows[src_y].first_span; s < rows[src_y + 1].first_span; s++) {
+         const SpriteSpan* span = &sprite->spans[s];
+         run_x += span->skip;
+         if (!sprite->pixels) run = frame_pixels + (size_t)src_y * image->width + run_x;
+         // run[c - run_x] is frame column c. [first, end) in columns as they show up on screen
+         int first = flip_x ? tile_w - run_x - span->length : run_x;
+         int end = first + span->length;
+         int x0 = (first - src_clip_left) * size;
+         int x1 = (end - src_clip_left) * size;
+         if (x0 < 0) x0 = 0;
+         if (x1 > w) x1 = w;
+
+         if (x0 >= x1) {
+            // clipped away
+         } else if (repeat) {
+            memcpy(dest_row + x0, dest_row - pitch + x0, x1 - x0);
+         } else if (size == 1 && !flip_x) {
+            memcpy(dest_row + x0, run + (src_clip_left + x0 - run_x), x1 - x0);
+         } else {
+            for (int dx = x0; dx < x1;) {
+               int column = src_clip_left + dx / size;
+               int next = (column - src_clip_left + 1) * size;
+               if (next > x1) next = x1;
+               memset(dest_row + dx, run[(flip_x ? tile_w - 1 - column : column) - run_x], next - dx);
+               dx = next;
+            }
          }
+         if (sprite->pixels) run += span->length;
+         run_x += span->length;
+      }
+   }
+}
+
+static void blit_sprite_sampled(ui8* dest_row, int pitch, int w, int h, const Sprite* sprite, int frame,
+                                int src_clip_left, int src_clip_top, int size, ui8 flags) {
+   // every dest pixel looks its source pixel up, for when the spans couldn't be baked
+   const ImageData* image = sprite->data;
+   int tile_w = sprite->tile_w, tile_h = sprite->tile_h;
+   const ui8* frame_pixels = image->data + (size_t)(frame / sprite->image_w) * tile_h * image->width +
+                             (frame % sprite->image_w) * tile_w;
+   for (int dy = 0; dy < h; dy++, dest_row += pitch) {
+      int row = src_clip_top + dy / size;
+      const ui8* src_row = frame_pixels + (size_t)((flags & SPRITE_FLIP_Y) ? tile_h - 1 - row : row) * image->width;
+      for (int dx = 0; dx < w; dx++) {
+         int column = src_clip_left + dx / size;
+         ui8 index = src_row[(flags & SPRITE_FLIP_X) ? tile_w - 1 - column : column];
+         if (index != PALETTE_TRANSPARENT) dest_row[dx] = index;
+      }
+   }
+}
+
+static void add_dirty_rect(Rect* rects, ui32* count, Rect rect) {
+   if (rect.w <= 0 || rect.h <= 0) return;
+   ui64 area = (ui64)rect.w * rect.h;
+
+   // fold into an existing rect if the union doesn't drag in much clean area
+   // (glyphs of a string, the same string drawn two frames in a row, etc)
+   ui32 best = 0;
+   ui64 best_growth = UINT64_MAX;
+   for (ui32 i = 0; i < *count; i++) {
+      Rect merged;
+      SDL_UnionRect(&rects[i], &rect, &merged);
+      ui64 existing_area = (ui64)rects[i].w * rects[i].h;
+      ui64 merged_area = (ui64)merged.w * merged.h;
+      if (merged_area * 4 <= (existing_area + area) * 5) {
+         rects[i] = merged;
+         return;
+      }
+      if (merged_area - existing_area < best_growth) {
+         best_growth = merged_area - existing_area;
+         best = i;
+      }
+   }
+
+   if (*count < MAX_DIRTY_RECTS) {
+      rects[(*count)++] = rect;
+      return;
+   }
+
+   // out of slots, grow whichever rect it costs the least to grow
+   SDL_UnionRect(&rects[best], &rect, &rects[best]);
+}
+
+static void mark_layer_dirty(Layer* layer, const Rect* rect) {
+   // rect is in surface coords, NULL means the whole surface
+   Rect bounds = { 0, 0, layer->surface->w, layer->surface->h };
+   Rect clipped;
+   if (!rect) {
+      clipped = bounds;
+   } else if (!SDL_IntersectRect(rect, &bounds, &clipped)) {
+      return;
+   }
+   add_dirty_rect(layer->dirty_rects, &layer->dirty_count, clipped);
+}
+
+static void reset_layer_dirty(Layer* layer) {
+   // for freshly created surfaces, which start out transparent
+   layer->dirty_count = 0;
+   layer->prev_dirty_count = 0;
+   layer->base_color = g_renderer.transparent_color_index;
+   layer->base_resolved = true;
+}
+
+static void resolve_layer_base(Layer* layer) {
+   /* renderer_clear() leaves a layer filled with base_color, betting the scene */
+   /* will fill it with the same color again. if something else gets drawn    */
+   /* first (or nothing at all) the bet is off and the layer goes transparent */
+   if (layer->base_resolved) return;
+   layer->base_resolved = true;
+   if (layer->base_color == g_renderer.transparent_color_index) return;
+   
+   layer->base_color = g_renderer.transparent_color_index;
+   SDL_FillRect(layer->surface, NULL, layer->base_color);
+   mark_layer_dirty(layer, NULL);
+}
+
+static void build_frame_dirty_rects(void) {
+   /* union of everything drawn this frame and last frame across visible layers, */
+   /* in composite coords. falls back to one full-frame rect when too much of    */
+   /* the composite is dirty to be worth splitting up.                           */
+   Rect full = { 0, 0, g_renderer.composite_surface->w, g_renderer.composite_surface->h };
+
+   // draw_rect_raw may have already added rects this frame, keep those. last
+   // frame's raw rects have to be composited over with whatever's under them
+   if (!g_renderer.full_redraw) {
+      for (ui32 i = 0; i < g_renderer.prev_raw_rect_count; i++) {
+         add_dirty_rect(g_renderer.dirty_rects, &g_renderer.dirty_count, g_renderer.prev_raw_rects[i]);
+      }
+   }
+   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+      Layer* layer = find_layer_by_index(i);
+      if (!layer) continue;
+      resolve_layer_base(layer);
+      if (!layer->visible || g_renderer.full_redraw) continue;
+
+      int offset_x = layer->can_draw_outside_viewport ? 0 : g_renderer.unit_map.x;
+      int offset_y = layer->can_draw_outside_viewport ? 0 : g_renderer.unit_map.y;
+      for (ui32 r = 0; r < layer->prev_dirty_count + layer->dirty_count; r++) {
+         Rect rect = (r < layer->prev_dirty_count) ? layer->prev_dirty_rects[r]
+                                                   : layer->dirty_rects[r - layer->prev_dirty_count];
+         rect.x += offset_x;
+         rect.y += offset_y;
+         add_dirty_rect(g_renderer.dirty_rects, &g_renderer.dirty_count, rect);
+      }
+   }
+
+   ui64 dirty_area = 0;
+   for (ui32 i = 0; i < g_renderer.dirty_count; i++) {
+      Rect clipped;
+      if (SDL_IntersectRect(&g_renderer.dirty_rects[i], &full, &clipped)) {
+         g_renderer.dirty_rects[i] = clipped;
+         dirty_area += (ui64)clipped.w * clipped.h;
+      } else {
+         g_renderer.dirty_rects[i] = (Rect){ 0, 0, 0, 0 };
+      }
+   }
+
+   if (g_renderer.full_redraw ||
+       dirty_area * 100 >= (ui64)full.w * full.h * DIRTY_FULL_THRESHOLD) {
+      g_renderer.dirty_rects[0] = full;
+      g_renderer.dirty_count = 1;
+   }
+}
+
+static void fill_frame_layers(FrameSnapshot* frame, bool use_mirrors) {
+   // frame->layers needs room for layer_count entries
+   frame->layer_count = 0;
+   Layer* system_layer = NULL;
+   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+      Layer* layer = find_layer_by_index(i);
+      if (!layer || !layer->visible) continue;
+      if (layer->handle == g_renderer.system_layer_handle) { system_layer = layer; continue; }
+      frame->layers[frame->layer_count++] = (FrameLayer){
+         .surface = use_mirrors ? layer->mirror : layer->surface,
+         .x = layer->can_draw_outside_viewport ? 0 : g_renderer.unit_map.x,
+         .y = layer->can_draw_outside_viewport ? 0 : g_renderer.unit_map.y,
+         .opacity = layer->opacity
+      };
+   }
+
+   // system layer always goes on top, and never blends
+   if (system_layer) {
+      frame->layers[frame->layer_count++] = (FrameLayer){
+         .surface = use_mirrors ? system_layer->mirror : system_layer->surface,
+         .opacity = 255
+      };
+   }
+}
+
+static bool resize_frame_sources(ui32 layer_capacity) {
+   // each job thread composites its own bands, so each gets a slice
+   ui32 stride = layer_capacity + MAX_DIRTY_RECTS + 1;
+   CompositeSource* sources = realloc(g_renderer.frame.sources,
+                                      sizeof(CompositeSource) * stride * jobs_get_thread_count());
+   if (d_dne(sources)) return false;
+   g_renderer.frame.sources = sources;
+   g_renderer.frame.source_stride = stride;
+   return true;
+}
+
+static void build_frame_snapshot(bool fused) {
+   /* copies out this frame's dirty state and resets it for the next one. when */
+   /* pipelined, the dirty parts of each visible layer go over to its mirror   */
+   /* too, so the scene can start drawing the next frame straight away         */
+   FrameSnapshot* frame = &g_renderer.frame;
+   frame->fused = fused;
+   frame->full_redraw = g_renderer.full_redraw;
+   frame->clear_color_index = g_renderer.clear_color_index;
+   frame->dirty_count = g_renderer.dirty_count;
+   memcpy(frame->dirty_rects, g_renderer.dirty_rects, sizeof(Rect) * g_renderer.dirty_count);
+   frame->raw_rect_count = g_renderer.raw_rect_count;
+   memcpy(frame->raw_rects, g_renderer.raw_rects, sizeof(Rect) * g_renderer.raw_rect_count);
+   memcpy(frame->raw_rect_colors, g_renderer.raw_rect_colors, g_renderer.raw_rect_count);
+   fill_frame_layers(frame, g_renderer.pipelined);
+
+   if (g_renderer.pipelined && frame->dirty_count > 0) {
+      for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+         Layer* layer = find_layer_by_index(i);
+         if (layer && layer->visible) copy_to_mirror(layer, frame);
       }
    }
+
+   if (!fused) {
+      g_renderer.composite_stale = false;
+   } else if (frame->dirty_count > 0) {
+      g_renderer.composite_stale = true;
+   }
+
+   g_renderer.dirty_count = 0;
+   memcpy(g_renderer.prev_raw_rects, g_renderer.raw_rects, sizeof(Rect) * g_renderer.raw_rect_count);
+   g_renderer.prev_raw_rect_count = g_renderer.raw_rect_count;
+   g_renderer.raw_rect_count = 0;
+   g_renderer.full_redraw = false;
+}
+
+static void composite_rect(const FrameSnapshot* frame, const Rect* rect) {
+   /* rect is in composite coords. runs of full opacity layers get resolved */
+   /* per pixel in one pass, translucent layers still blend one at a time  */
+   if (rect->w <= 0 || rect->h <= 0) return;
+
+   CompositeSource* sources = &frame->sources[jobs_get_thread_index() * frame->source_stride];
+   int source_count = 0;
+
+   // clear color and raw rects start off the first run
+   sources[source_count++] = (CompositeSource){ .fill = *rect, .fill_index = frame->clear_color_index };
+   for (ui32 i = 0; i < frame->raw_rect_count; i++) {
+      sources[source_count++] = (CompositeSource){ .fill = frame->raw_rects[i], .fill_index = frame->raw_rect_colors[i] };
+   }
+
+   for (ui32 i = 0; i < frame->layer_count; i++) {
+      const FrameLayer* layer = &frame->layers[i];
+      if (layer->opacity == 255) {
+         sources[source_count++] = (CompositeSource){ .surface = layer->surface, .x = layer->x, .y = layer->y };
+         continue;
+      }
+
+      composite_flatten(sources, source_count, g_renderer.composite_surface, *rect);
+      source_count = 0;
+      Rect src_rect = { rect->x - layer->x, rect->y - layer->y, rect->w, rect->h }; // composite_blit() clips src to the layer
+      composite_blit(layer->surface, src_rect, g_renderer.composite_surface, rect->x, rect->y, layer->opacity);
+   }
+   composite_flatten(sources, source_count, g_renderer.composite_surface, *rect);
+}
+
+static void render_frame(FrameSnapshot* frame) {
+   /* composites and scales frame into window_surface, and works out which */
+   /* window rects to update. runs on the render thread when pipelined     */
+   frame->window_rect_count = 0;
+   if (frame->dirty_count == 0) return; // nothing changed, window already has this frame
+   PROFILE_BEGIN("render_frame");
+   ui64 start_us = timing_get_time_us();
+
+   SDL_Surface* composite = g_renderer.composite_surface;
+   SDL_Surface* window = g_renderer.window_surface;
+
+   if (!frame->fused) {
+      PROFILE_BEGIN("composite");
+      composite_run_bands(frame->dirty_rects, frame->dirty_count, composite_band, frame);
+      PROFILE_END();
+   }
+
+   // fused: layers go straight to the window, so the clear fill covers all of the composite
+   // area rather than just the dirty rect (scaled rects can reach a pixel past it).
+   // composite_rect() doesn't run on fused frames, so its first slice is free
+   CompositeSource* sources = frame->sources;
+   int source_count = 0;
+   if (frame->fused) {
+      sources[source_count++] = (CompositeSource){ .fill = { 0, 0, composite->w, composite->h },
+                                                   .fill_index = frame->clear_color_index };
+      for (ui32 i = 0; i < frame->raw_rect_count; i++) {
+         sources[source_count++] = (CompositeSource){ .fill = frame->raw_rects[i], .fill_index = frame->raw_rect_colors[i] };
+      }
+      for (ui32 i = 0; i < frame->layer_count; i++) {
+         sources[source_count++] = (CompositeSource){ .surface = frame->layers[i].surface,
+                                                      .x = frame->layers[i].x, .y = frame->layers[i].y };
+      }
+   }
+
+   frame->full_window = frame->full_redraw ||
+                        (frame->dirty_count == 1 && frame->dirty_rects[0].w == composite->w
+                                                 && frame->dirty_rects[0].h == composite->h);
+   if (frame->full_window) {
+      frame->window_rects[frame->window_rect_count++] = (Rect){ 0, 0, window->w, window->h };
+   } else {
+      for (ui32 i = 0; i < frame->dirty_count; i++) {
+         Rect* src = &frame->dirty_rects[i];
+         if (src->w <= 0 || src->h <= 0) continue;
+         
+         // round outwards so neighbouring rects don't leave seams. composite_scale()
+         // maps every window pixel the same way a full frame would, so this matches it exactly
+         int x0 = src->x * window->w / composite->w;
+         int y0 = src->y * window->h / composite->h;
+         int x1 = ((src->x + src->w) * window->w + composite->w - 1) / composite->w;
+         int y1 = ((src->y + src->h) * window->h + composite->h - 1) / composite->h;
+         frame->window_rects[frame->window_rect_count++] = (Rect){ x0, y0, x1 - x0, y1 - y0 };
+      }
+   }
+
+   // the column table is shared between bands, so build it before they start
+   PROFILE_BEGIN(frame->fused ? "composite_fused" : "scale");
+   composite_prepare_scale(composite->w, window->w);
+   if (frame->fused) {
+      FusedSources fused_sources = { sources, source_count };
+      composite_run_bands(frame->window_rects, frame->window_rect_count, fused_band, &fused_sources);
+   } else {
+      composite_run_bands(frame->window_rects, frame->window_rect_count, scale_band, NULL);
+   }
+   PROFILE_END();
+   timing_record_stage(STAGE_COMPOSITE, (ui32)(timing_get_time_us() - start_us));
+   PROFILE_END();
+}
+
+static void present_frame(const FrameSnapshot* frame) {
+   // SDL wants window updates on the main thread
+   if (frame->window_rect_count == 0 || g_renderer.headless) {
+      timing_record_stage(STAGE_PRESENT, 0);
+      return;
+   }
+   ui64 start_us = timing_get_time_us();
+   PROFILE_BEGIN("present_frame");
+   if (frame->full_window) SDL_UpdateWindowSurface(g_renderer.window);
+   else SDL_UpdateWindowSurfaceRects(g_renderer.window, frame->window_rects, frame->window_rect_count);
+   PROFILE_END();
+   timing_record_stage(STAGE_PRESENT, (ui32)(timing_get_time_us() - start_us));
+}
+
+static ui32 finish_frame(void) {
+   /* waits out the frame on the render thread and puts it up. anything that */
+   /* swaps out surfaces or the layer array calls this first. returns how    */
+   /* long it waited in us                                                    */
+   if (!g_renderer.frame_in_flight) return 0;
+   ui64 start_us = timing_get_time_us();
+   SDL_SemWait(g_renderer.frame_done);
+   ui32 wait_us = (ui32)(timing_get_time_us() - start_us);
+   g_renderer.frame_in_flight = false;
+   present_frame(&g_renderer.frame);
+   return wait_us;
+}
+
+static int render_thread_main(void* data) {
+   // only ever one frame in flight, so frame_ready/frame_done strictly alternate
+   (void)data;
+   profile_set_thread_name("render");
+   while (true) {
+      SDL_SemWait(g_renderer.frame_ready);
+      if (g_renderer.render_thread_quit) break;
+      render_frame(&g_renderer.frame);
+      SDL_SemPost(g_renderer.frame_done);
+   }
+   return 0;
+}
+
+static void stop_render_thread(void) {
+   finish_frame();
+   if (g_renderer.render_thread) {
+      g_renderer.render_thread_quit = true;
+      SDL_SemPost(g_renderer.frame_ready);
+      SDL_WaitThread(g_renderer.render_thread, NULL);
+      g_renderer.render_thread = NULL;
+      g_renderer.render_thread_quit = false;
+   }
+   if (g_renderer.frame_ready) SDL_DestroySemaphore(g_renderer.frame_ready);
+   if (g_renderer.frame_done) SDL_DestroySemaphore(g_renderer.frame_done);
+   g_renderer.frame_ready = NULL;
+   g_renderer.frame_done = NULL;
+}
+
+static bool update_layer_mirror(Layer* layer) {
+   // matches the mirror to the layer's surface, or drops it when not pipelined
+   if (layer->mirror) {
+      SDL_FreeSurface(layer->mirror);
+      layer->mirror = NULL;
+   }
+   if (!g_renderer.pipelined || !layer->surface) return true;
+
+   layer->mirror = create_layer_surface(layer->can_draw_outside_viewport);
+   if (d_dne(layer->mirror)) {
+      d_err("couldn't create mirror for layer %u", layer->handle);
+      return false;
+   }
+   g_renderer.full_redraw = true;
+   return true;
+}
+
+static void copy_to_mirror(Layer* layer, const FrameSnapshot* frame) {
+   /* straight row copies, no colorkey. the frame's dirty rects already */
+   /* cover everything that changed on the layer since the last frame  */
+   SDL_Surface* src = layer->surface;
+   SDL_Surface* dst = layer->mirror;
+   if (!dst) return;
+   if (frame->full_redraw) {
+      memcpy(dst->pixels, src->pixels, (size_t)src->pitch * src->h);
+      return;
+   }
+
+   int offset_x = layer->can_draw_outside_viewport ? 0 : g_renderer.unit_map.x;
+   int offset_y = layer->can_draw_outside_viewport ? 0 : g_renderer.unit_map.y;
+   Rect bounds = { 0, 0, src->w, src->h };
+   for (ui32 i = 0; i < frame->dirty_count; i++) {
+      Rect rect = frame->dirty_rects[i];
+      rect.x -= offset_x;
+      rect.y -= offset_y;
+      Rect clipped;
+      if (!SDL_IntersectRect(&rect, &bounds, &clipped)) continue;
+      for (int y = clipped.y; y < clipped.y + clipped.h; y++) {
+         size_t offset = (size_t)y * src->pitch + clipped.x;
+         memcpy((ui8*)dst->pixels + offset, (ui8*)src->pixels + offset, clipped.w);
+      }
+   }
+}
+
+static void composite_band(Rect rect, void* data) {
+   PROFILE_BEGIN("composite_band");
+   composite_rect(data, &rect);
+   PROFILE_END();
+}
+
+static void scale_band(Rect rect, void* data) {
+   (void)data;
+   PROFILE_BEGIN("scale_band");
+   composite_scale(g_renderer.composite_surface, g_renderer.window_surface, rect);
+   PROFILE_END();
+}
+
+static void fused_band(Rect rect, void* data) {
+   FusedSources* fused_sources = data;
+   PROFILE_BEGIN("fused_band");
+   composite_flatten_scaled(fused_sources->sources, fused_sources->count,
+                            g_renderer.composite_surface->w, g_renderer.composite_surface->h,
+                            g_renderer.window_surface, rect);
+   PROFILE_END();
+}
+
+static bool can_fuse_present(void) {
+   // translucent layers need something to blend onto
+   if (!g_renderer.fused_present || g_renderer.window_surface->format->BytesPerPixel != 4) return false;
+   for (ui32 i = 0; i < g_renderer.layer_count; i++) {
+      Layer* layer = find_layer_by_index(i);
+      if (!layer || !layer->visible || layer->handle == g_renderer.system_layer_handle) continue;
+      if (layer->opacity != 255) return false;
+   }
+   return true;
+}
+
+static void refresh_stale_composite(void) {
+   /* fused frames never touch composite_surface, but the resize preview */
+   /* stretches it, so bring it up to date with what the layers hold     */
+   finish_frame();
+   if (!g_renderer.composite_stale || !g_renderer.composite_surface) return;
+
+   // layers hold exactly what the last frame showed at this point, so no need for the mirrors.
+   // that frame is done with its snapshot, so this one borrows the buffers
+   FrameSnapshot frame = { .layers = g_renderer.frame.layers, .sources = g_renderer.frame.sources,
+                           .source_stride = g_renderer.frame.source_stride,
+                           .clear_color_index = g_renderer.clear_color_index };
+   fill_frame_layers(&frame, false);
+   composite_rect(&frame, &(Rect){ 0, 0, g_renderer.composite_surface->w, g_renderer.composite_surface->h });
+   g_renderer.composite_stale = false;
 }
 
 static SDL_Color* get_palette_colors(void) {
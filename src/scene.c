@@ -11,6 +11,7 @@
 #include "input.h"
 #include "menu.h"
 #include "debug.h"
+#include "profile.h"
 #include <stdio.h>
 
 static SceneManager scene_manager = { 0 };
@@ -59,14 +60,16 @@ void scene_init(void) {
 }
 
 void scene_update(float delta_time) {
+   PROFILE_BEGIN("scene_update");
    if (scene_manager.scenes[scene_manager.current_scene].update) {
       scene_manager.scenes[scene_manager.current_scene].update(delta_time);
    }
+   PROFILE_END();
 }
 
 void scene_render(void) {
    if (scene_manager.scenes[scene_manager.current_scene].render) {
-      scene_manager.scenes[scene_manager.current_scene].render();
+      scene_manager.scenes[scene_manager.current_scene].render(timing_get_sim_alpha());
    }
 }
 
@@ -111,6 +114,10 @@ void scene_reset_session(void) {
    scene_manager.session.valid = false;
 }
 
+SceneType scene_get_current(void) {
+   return scene_manager.current_scene;
+}
+
 // ============================================================================
 // TITLE SCENE
 // ============================================================================
@@ -118,11 +125,13 @@ void scene_reset_session(void) {
 LayerHandle layer_bg, layer_test, layer_sized;
 int dimx = 0, dimy = 0;
 Rect moving_box = {0, 0, 100, 100};
+Rect moving_box_prev = {0, 0, 100, 100}; // last step, for interpolating
 uint8_t box_color = 5;
 bool x_forward = true, y_forward = true;
 void update_dvd(Rect* rect, int amt);
 void draw_title(void);
-void draw_dvd(void);
+void draw_dvd(float alpha);
+static int lerp_int(int from, int to, float alpha);
 
 void title_scene_init(void) {
    layer_bg = renderer_create_layer(false);
@@ -131,6 +140,8 @@ void title_scene_init(void) {
    renderer_set_layer_size(layer_test, 1);
    // renderer_set_layer_size(layer_bg, 1);
 
+   moving_box_prev = moving_box;
+
    input_reset_player_devices();
    input_set_context(CONTEXT_TITLE);
 }
@@ -156,12 +167,13 @@ void title_scene_handle_input(InputEvent event, InputState state, int device_id)
 void title_scene_update(float delta_time) {
    (void)delta_time;
 
+   moving_box_prev = moving_box;
    update_dvd(&moving_box, 4);
 }
 
-void title_scene_render(void) {
+void title_scene_render(float alpha) {
    draw_title();
-   draw_dvd();
+   draw_dvd(alpha);
 }
 
 void title_scene_destroy(void) {
@@ -192,9 +204,17 @@ void update_dvd(Rect* rect, int amt) {
    }
 }
 
-void draw_dvd(void) {
-   renderer_draw_rect(layer_sized, moving_box, box_color);
-   renderer_draw_string(layer_sized, FONT_MASTER_8_8, "DVD", moving_box.x + 28, moving_box.y + 42, 4);
+void draw_dvd(float alpha) {
+   Rect box = moving_box;
+   box.x = lerp_int(moving_box_prev.x, moving_box.x, alpha);
+   box.y = lerp_int(moving_box_prev.y, moving_box.y, alpha);
+   renderer_draw_rect(layer_sized, box, box_color);
+   renderer_draw_string(layer_sized, FONT_MASTER_8_8, "DVD", box.x + 28, box.y + 42, 4);
+}
+
+static int lerp_int(int from, int to, float alpha) {
+   float offset = (to - from) * alpha;
+   return from + (int)(offset + (offset < 0 ? -0.5f : 0.5f));
 }
 
 void draw_title(void) {
@@ -248,7 +268,8 @@ void main_menu_scene_update(float delta_time) {
    (void)delta_time;
 }
 
-void main_menu_scene_render(void) {
+void main_menu_scene_render(float alpha) {
+   (void)alpha;
    renderer_draw_fill(main_bg, 9); // brown-dark
    menu_render(main_menu);
 }
@@ -298,7 +319,8 @@ void settings_scene_update(float delta_time) {
    (void)delta_time;
 }
 
-void settings_scene_render(void) {
+void settings_scene_render(float alpha) {
+   (void)alpha;
    renderer_draw_fill(settings_bg, 17); // teal-dark
    menu_render(settings_menu);
    draw_input_display();
@@ -442,7 +464,8 @@ void character_select_scene_update(float delta_time) {
    character_select_update(delta_time);
 }
 
-void character_select_scene_render(void) {
+void character_select_scene_render(float alpha) {
+   (void)alpha;
    if (!scene_manager.session.confirmed_devices) {
       renderer_set_layer_visible(dev_bg, true);
       renderer_set_layer_visible(charsel_bg, false);
@@ -654,7 +677,8 @@ void gameplay_scene_update(float delta_time) {
    // soon (tm)
 }
 
-void gameplay_scene_render(void) {
+void gameplay_scene_render(float alpha) {
+   (void)alpha;
    // !!! renderer_draw_string(8, 15, "this is where the game will go..............................", 22, 4);
 }
 
@@ -0,0 +1,51 @@
+#include "spritebatch.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_instances(const void* a, const void* b);
+
+bool spritebatch_init(SpriteBatch* batch) {
+   memset(batch, 0, sizeof(SpriteBatch));
+   batch->sprites = malloc(sizeof(SpriteInstance) * SPRITEBATCH_START_SPRITES);
+   if (d_dne(batch->sprites)) return false;
+   batch->capacity = SPRITEBATCH_START_SPRITES;
+   return true;
+}
+
+void spritebatch_free(SpriteBatch* batch) {
+   free(batch->sprites);
+   memset(batch, 0, sizeof(SpriteBatch));
+}
+
+void spritebatch_reset(SpriteBatch* batch) {
+   batch->count = 0;
+}
+
+SpriteInstance* spritebatch_push(SpriteBatch* batch, ui16 layer_slot, ui16 sheet) {
+   if (batch->count >= batch->capacity) {
+      ui32 new_capacity = batch->capacity ? batch->capacity * 2 : SPRITEBATCH_START_SPRITES;
+      SpriteInstance* new_sprites = realloc(batch->sprites, sizeof(SpriteInstance) * new_capacity);
+      if (d_dne(new_sprites)) return NULL;
+      batch->sprites = new_sprites;
+      batch->capacity = new_capacity;
+      d_logv(3, "sprite batch grew to %u sprites", new_capacity);
+   }
+
+   SpriteInstance* instance = &batch->sprites[batch->count];
+   memset(instance, 0, sizeof(SpriteInstance));
+   instance->key = ((ui64)layer_slot << 48) | ((ui64)sheet << 32) | batch->count++;
+   return instance;
+}
+
+void spritebatch_sort(SpriteBatch* batch) {
+   if (batch->count > 1) qsort(batch->sprites, batch->count, sizeof(SpriteInstance), compare_instances);
+}
+
+// INTERNAL
+static int compare_instances(const void* a, const void* b) {
+   // push order is in the key, so no two are equal and the sort is stable
+   ui64 ka = ((const SpriteInstance*)a)->key;
+   ui64 kb = ((const SpriteInstance*)b)->key;
+   return (ka > kb) - (ka < kb);
+}
@@ -0,0 +1,154 @@
+#include "textcache.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+static ui32 hash_key(ui8 font, ui8 color_index, ui8 size, const char* text, ui32 length);
+static bool key_matches(const TextRun* run, ui32 hash, ui8 font, ui8 color_index, ui8 size,
+                        const char* text, ui32 length);
+static void unlink_lru(TextCache* cache, ui16 index);
+static void push_lru(TextCache* cache, ui16 index);
+static void evict_run(TextCache* cache, ui16 index);
+static size_t run_bytes(int w, int h, ui32 length);
+
+void textcache_init(TextCache* cache, size_t max_bytes) {
+   memset(cache, 0, sizeof(TextCache));
+   cache->max_bytes = max_bytes;
+   textcache_clear(cache);
+}
+
+void textcache_free(TextCache* cache) {
+   textcache_clear(cache);
+}
+
+void textcache_clear(TextCache* cache) {
+   for (ui32 i = 0; i < TEXTCACHE_MAX_RUNS; i++) {
+      free(cache->runs[i].pixels);
+      memset(&cache->runs[i], 0, sizeof(TextRun));
+      cache->runs[i].next = (i + 1 < TEXTCACHE_MAX_RUNS) ? (ui16)(i + 1) : TEXTCACHE_NONE;
+   }
+   for (ui32 b = 0; b < TEXTCACHE_BUCKETS; b++) cache->buckets[b] = TEXTCACHE_NONE;
+   cache->head = TEXTCACHE_NONE;
+   cache->tail = TEXTCACHE_NONE;
+   cache->free_run = 0;
+   cache->run_count = 0;
+   cache->bytes = 0;
+}
+
+void textcache_set_max_bytes(TextCache* cache, size_t max_bytes) {
+   cache->max_bytes = max_bytes;
+   while (cache->tail != TEXTCACHE_NONE && cache->bytes > cache->max_bytes) evict_run(cache, cache->tail);
+}
+
+const TextRun* textcache_find(TextCache* cache, ui8 font, ui8 color_index, ui8 size,
+                              const char* text, ui32 length) {
+   ui32 hash = hash_key(font, color_index, size, text, length);
+   for (ui16 i = cache->buckets[hash & (TEXTCACHE_BUCKETS - 1)]; i != TEXTCACHE_NONE;
+        i = cache->runs[i].bucket_next) {
+      if (!key_matches(&cache->runs[i], hash, font, color_index, size, text, length)) continue;
+      if (cache->head != i) {
+         unlink_lru(cache, i);
+         push_lru(cache, i);
+      }
+      cache->hits++;
+      return &cache->runs[i];
+   }
+   cache->misses++;
+   return NULL;
+}
+
+TextRun* textcache_insert(TextCache* cache, ui8 font, ui8 color_index, ui8 size,
+                          const char* text, ui32 length, int w, int h) {
+   if (w <= 0 || h <= 0 || length > UINT16_MAX) return NULL;
+   size_t bytes = run_bytes(w, h, length);
+   if (bytes > cache->max_bytes) return NULL; // would push everything else out and still not fit
+
+   while (cache->tail != TEXTCACHE_NONE &&
+          (cache->free_run == TEXTCACHE_NONE || cache->bytes + bytes > cache->max_bytes)) {
+      evict_run(cache, cache->tail);
+   }
+
+   ui8* memory = malloc(bytes);
+   if (d_dne(memory)) return NULL;
+
+   ui16 index = cache->free_run;
+   TextRun* run = &cache->runs[index];
+   cache->free_run = run->next;
+
+   run->hash = hash_key(font, color_index, size, text, length);
+   run->font = font;
+   run->color_index = color_index;
+   run->size = size;
+   run->length = (ui16)length;
+   run->w = w;
+   run->h = h;
+   run->pixels = memory;
+   run->text = (char*)memory + (size_t)w * h;
+   memcpy(run->text, text, length);
+
+   ui32 bucket = run->hash & (TEXTCACHE_BUCKETS - 1);
+   run->bucket_next = cache->buckets[bucket];
+   cache->buckets[bucket] = index;
+   push_lru(cache, index);
+   cache->run_count++;
+   cache->bytes += bytes;
+   return run;
+}
+
+// INTERNAL
+static ui32 hash_key(ui8 font, ui8 color_index, ui8 size, const char* text, ui32 length) {
+   // fnv-1a over the text, then the rest of the key
+   ui32 hash = 2166136261u;
+   for (ui32 i = 0; i < length; i++) {
+      hash ^= (ui8)text[i];
+      hash *= 16777619u;
+   }
+   hash ^= (ui32)font | ((ui32)color_index << 8) | ((ui32)size << 16);
+   hash *= 16777619u;
+   return hash ^ (hash >> 15);
+}
+
+static bool key_matches(const TextRun* run, ui32 hash, ui8 font, ui8 color_index, ui8 size,
+                        const char* text, ui32 length) {
+   return run->hash == hash && run->font == font && run->color_index == color_index &&
+          run->size == size && run->length == length && memcmp(run->text, text, length) == 0;
+}
+
+static void unlink_lru(TextCache* cache, ui16 index) {
+   TextRun* run = &cache->runs[index];
+   if (run->prev != TEXTCACHE_NONE) cache->runs[run->prev].next = run->next;
+   else cache->head = run->next;
+   if (run->next != TEXTCACHE_NONE) cache->runs[run->next].prev = run->prev;
+   else cache->tail = run->prev;
+   run->prev = run->next = TEXTCACHE_NONE;
+}
+
+static void push_lru(TextCache* cache, ui16 index) {
+   TextRun* run = &cache->runs[index];
+   run->prev = TEXTCACHE_NONE;
+   run->next = cache->head;
+   if (cache->head != TEXTCACHE_NONE) cache->runs[cache->head].prev = index;
+   cache->head = index;
+   if (cache->tail == TEXTCACHE_NONE) cache->tail = index;
+}
+
+static void evict_run(TextCache* cache, ui16 index) {
+   TextRun* run = &cache->runs[index];
+   unlink_lru(cache, index);
+
+   ui16* link = &cache->buckets[run->hash & (TEXTCACHE_BUCKETS - 1)];
+   while (*link != index) link = &cache->runs[*link].bucket_next;
+   *link = run->bucket_next;
+
+   cache->bytes -= run_bytes(run->w, run->h, run->length);
+   cache->run_count--;
+   cache->evictions++;
+   free(run->pixels);
+   memset(run, 0, sizeof(TextRun));
+   run->next = cache->free_run;
+   cache->free_run = index;
+}
+
+static size_t run_bytes(int w, int h, ui32 length) {
+   return (size_t)w * h + length;
+}
@@ -1,80 +1,146 @@
 #include "timing.h"
 #include "debug.h"
 #include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
 
 static TimingState g_timing = { 0 };
+static SDL_SpinLock g_timing_lock = 0; // stage and band times can come from the render thread
+
+static void update_stats(void);
+static void sleep_until(ui64 deadline);
+static ui64 snap_frame_time(ui64 elapsed);
+static int compare_ns(const void* a, const void* b);
+static double ns_to_ms(ui64 ns);
 
 void timing_init(ui32 target_fps) {
    if (target_fps == 0) { d_log("cmon man. fps set to 60"); target_fps = 60; }
    g_timing.target_fps = target_fps;
-   g_timing.target_frame_time = 1000 / target_fps;  // ms per frame
-   g_timing.frame_start_time = SDL_GetTicks();
-   g_timing.last_frame_time = g_timing.target_frame_time;
+   g_timing.target_frame_ns = TIMING_NS_PER_SEC / target_fps;
+   g_timing.frame_start_ns = timing_get_time_ns();
+   g_timing.prev_frame_start_ns = 0;
+   g_timing.last_frame_ns = g_timing.target_frame_ns;
    g_timing.frame_count = 0;
    
-   g_timing.min_frame_time = UINT32_MAX;
-   g_timing.max_frame_time = 0;
-   g_timing.avg_frame_time = g_timing.target_frame_time;
+   g_timing.min_frame_ns = UINT64_MAX;
+   g_timing.max_frame_ns = 0;
    g_timing.frames_over_budget = 0;
+
+   g_timing.history_next = 0;
+   g_timing.history_count = 0;
+   memset(&g_timing.stats, 0, sizeof(TimingStats));
+   g_timing.stats_frame = UINT32_MAX;
+   g_timing.percentile_frame = UINT32_MAX;
    
-   g_timing.game_start_time = SDL_GetTicks();
-   g_timing.total_game_time = 0;
+   g_timing.game_start_ns = g_timing.frame_start_ns;
+   g_timing.total_game_ns = 0;
+
+   g_timing.deadline_ns = 0;
+   g_timing.spin_ns = TIMING_SPIN_NS;
+   g_timing.pace_last_ns = 0;
+   g_timing.pace_max_ns = 0;
+   g_timing.pace_total_ns = 0;
+   g_timing.pace_count = 0;
+   g_timing.frames_missed = 0;
+
+   g_timing.sim_step_ns = TIMING_NS_PER_SEC / TIMING_SIM_HZ;
+   g_timing.sim_accumulator_ns = 0;
+   g_timing.sim_dropped_ns = 0;
+   g_timing.sim_steps_last = 0;
+   g_timing.sim_steps_total = 0;
+   g_timing.sim_alpha = 1.0f;
 }
 
 void timing_frame_start(void) {
-   g_timing.frame_start_time = SDL_GetTicks();
+   // the first frame has nothing before it, timing_init() doesn't count
+   g_timing.prev_frame_start_ns = (g_timing.frame_count > 0) ? g_timing.frame_start_ns : 0;
+   g_timing.frame_start_ns = timing_get_time_ns();
+   SDL_AtomicLock(&g_timing_lock);
+   g_timing.band_count = 0;
+   SDL_AtomicUnlock(&g_timing_lock);
 }
 
 void timing_frame_end(void) {
-   ui32 current_time = SDL_GetTicks();
-   ui32 frame_duration = current_time - g_timing.frame_start_time;
+   ui64 current_time = timing_get_time_ns();
+   ui64 frame_duration = current_time - g_timing.frame_start_ns;
    
-   g_timing.last_frame_time = frame_duration;
+   g_timing.last_frame_ns = frame_duration;
    g_timing.frame_count++;
-   g_timing.total_game_time = current_time - g_timing.game_start_time;
+   g_timing.total_game_ns = current_time - g_timing.game_start_ns;
    
-   if (frame_duration < g_timing.min_frame_time) {
-      g_timing.min_frame_time = frame_duration;
+   if (frame_duration < g_timing.min_frame_ns) {
+      g_timing.min_frame_ns = frame_duration;
    }
-   if (frame_duration > g_timing.max_frame_time) {
-      g_timing.max_frame_time = frame_duration;
+   if (frame_duration > g_timing.max_frame_ns) {
+      g_timing.max_frame_ns = frame_duration;
    }
-   if (frame_duration > g_timing.target_frame_time) {
+   if (frame_duration > g_timing.target_frame_ns) {
       g_timing.frames_over_budget++;
    }
-   
-   // simple rolling average - maybe improve at some point
-   g_timing.avg_frame_time = (g_timing.avg_frame_time * 9 + frame_duration) / 10;
+
+   g_timing.frame_history[g_timing.history_next] = frame_duration;
+   SDL_AtomicLock(&g_timing_lock);
+   memcpy(g_timing.stage_history[g_timing.history_next], g_timing.stage_times, sizeof(g_timing.stage_times));
+   SDL_AtomicUnlock(&g_timing_lock);
+   g_timing.history_next = (g_timing.history_next + 1) % TIMING_HISTORY;
+   if (g_timing.history_count < TIMING_HISTORY) g_timing.history_count++;
 }
 
 bool timing_should_limit_frame(void) {
-   return (g_timing.last_frame_time < g_timing.target_frame_time);
+   return (g_timing.last_frame_ns < g_timing.target_frame_ns);
+}
+
+void timing_wait_for_next_frame(void) {
+   /* deadlines are absolute and step by exactly one frame, so being a bit */
+   /* late one frame doesn't push every frame after it back               */
+   ui64 target = g_timing.target_frame_ns;
+   if (g_timing.deadline_ns == 0) g_timing.deadline_ns = g_timing.frame_start_ns + target;
+   ui64 deadline = g_timing.deadline_ns;
+
+   ui64 now = timing_get_time_ns();
+   if (now >= deadline) {
+      g_timing.frames_missed++;
+   } else {
+      sleep_until(deadline);
+      while ((now = timing_get_time_ns()) < deadline) {
+         // spin, it's at most spin_ns
+      }
+   }
+
+   ui64 late = now - deadline;
+   g_timing.pace_last_ns = late;
+   g_timing.pace_total_ns += late;
+   g_timing.pace_count++;
+   if (late > g_timing.pace_max_ns) g_timing.pace_max_ns = late;
+
+   // more than a frame behind (hitch, breakpoint, dragging the window), start over from now instead of racing to catch up
+   g_timing.deadline_ns = (late > target) ? now + target : deadline + target;
 }
 
 ui32 timing_get_last_frame_time(void) {
-   return g_timing.last_frame_time;
+   return (ui32)(g_timing.last_frame_ns / TIMING_NS_PER_MS);
+}
+
+ui64 timing_get_last_frame_ns(void) {
+   return g_timing.last_frame_ns;
 }
 
 ui32 timing_get_frame_duration(void) {
-   if (g_timing.last_frame_time >= g_timing.target_frame_time) {
+   if (g_timing.last_frame_ns >= g_timing.target_frame_ns) {
       return 0;  // already over budget...
    }
-   return g_timing.target_frame_time - g_timing.last_frame_time;
+   return (ui32)((g_timing.target_frame_ns - g_timing.last_frame_ns) / TIMING_NS_PER_MS);
 }
 
 float timing_get_delta_time(void) {
-   static ui32 previous_frame_start = 0;
-   
-   if (previous_frame_start == 0) {
-      previous_frame_start = g_timing.frame_start_time;
-      return 1.0f / g_timing.target_fps;  // return target delta for first frame
+   float expected_delta = (float)((double)g_timing.target_frame_ns / TIMING_NS_PER_SEC);
+   if (g_timing.prev_frame_start_ns == 0) {
+      return expected_delta;  // return target delta for first frame
    }
    
-   float delta = (g_timing.frame_start_time - previous_frame_start) / 1000.0f;
-   previous_frame_start = g_timing.frame_start_time;
+   float delta = (float)((double)(g_timing.frame_start_ns - g_timing.prev_frame_start_ns) / TIMING_NS_PER_SEC);
    
    // only clamp if delta is way off from target (like 5+ frames worth)
-   float expected_delta = g_timing.target_frame_time / 1000.0f;
    if (delta > expected_delta * 5.0f) {
       delta = expected_delta;  // reset to target on major hiccups
    }
@@ -85,35 +151,219 @@ ui32 timing_get_frame_count(void) {
    return g_timing.frame_count;
 }
 
+ui32 timing_advance_simulation(void) {
+   ui64 step = g_timing.sim_step_ns;
+   if (g_timing.prev_frame_start_ns == 0) {
+      g_timing.sim_accumulator_ns += step; // first frame, nothing to measure yet
+   } else {
+      g_timing.sim_accumulator_ns += snap_frame_time(g_timing.frame_start_ns - g_timing.prev_frame_start_ns);
+   }
+
+   // spiral of death: if steps take longer than they simulate, catching up only makes the next frame later
+   ui64 max_time = step * TIMING_MAX_SIM_STEPS;
+   if (g_timing.sim_accumulator_ns >= max_time + step) {
+      ui64 dropped = g_timing.sim_accumulator_ns - max_time;
+      dropped -= dropped % step; // keep the fraction so alpha stays smooth
+      g_timing.sim_accumulator_ns -= dropped;
+      g_timing.sim_dropped_ns += dropped;
+      d_logv(2, "simulation is behind, dropped %.2f ms", ns_to_ms(dropped));
+   }
+
+   ui32 steps = (ui32)(g_timing.sim_accumulator_ns / step);
+   g_timing.sim_accumulator_ns -= steps * step;
+   g_timing.sim_steps_last = steps;
+   g_timing.sim_steps_total += steps;
+   g_timing.sim_alpha = (float)((double)g_timing.sim_accumulator_ns / step);
+   return steps;
+}
+
+float timing_get_sim_delta(void) {
+   return (float)((double)g_timing.sim_step_ns / TIMING_NS_PER_SEC);
+}
+
+float timing_get_sim_alpha(void) {
+   return g_timing.sim_alpha;
+}
+
 ui32 timing_get_game_time_ms(void) {
-   return g_timing.total_game_time;
+   return (ui32)(g_timing.total_game_ns / TIMING_NS_PER_MS);
 }
 
 float timing_get_current_fps(void) {
-   if (g_timing.last_frame_time == 0) return 0.0f;
-   return 1000.0f / g_timing.last_frame_time;
+   if (g_timing.last_frame_ns == 0) return 0.0f;
+   return (float)((double)TIMING_NS_PER_SEC / g_timing.last_frame_ns);
 }
 
 Timer* timer_start(void) {
    Timer* timer = malloc(sizeof(Timer));
-   timer->start_time = SDL_GetTicks();
+   timer->start_ns = timing_get_time_ns();
    return timer;
 }
 
 ui32 timer_end(Timer* timer) {
-   ui32 time = SDL_GetTicks() - timer->start_time;
+   ui32 time = (ui32)((timing_get_time_ns() - timer->start_ns) / TIMING_NS_PER_MS);
    free(timer);
    return time;
 }
 
+ui64 timing_get_time_ns(void) {
+   // split so counter * 1e9 can't overflow on fast counters
+   ui64 counter = SDL_GetPerformanceCounter();
+   ui64 frequency = SDL_GetPerformanceFrequency();
+   return (counter / frequency) * TIMING_NS_PER_SEC + (counter % frequency) * TIMING_NS_PER_SEC / frequency;
+}
+
+ui64 timing_get_time_us(void) {
+   return timing_get_time_ns() / 1000;
+}
+
+void timing_record_stage(FrameStage stage, ui32 us) {
+   if (stage < 0 || stage >= STAGE_MAX) return;
+   SDL_AtomicLock(&g_timing_lock);
+   g_timing.stage_times[stage] = us;
+   SDL_AtomicUnlock(&g_timing_lock);
+}
+
+ui32 timing_get_stage_time(FrameStage stage) {
+   if (stage < 0 || stage >= STAGE_MAX) return 0;
+   SDL_AtomicLock(&g_timing_lock);
+   ui32 us = g_timing.stage_times[stage];
+   SDL_AtomicUnlock(&g_timing_lock);
+   return us;
+}
+
+const ui32* timing_get_stage_history(ui32 frames_ago) {
+   // main thread only, same as timing_frame_end()
+   if (frames_ago >= g_timing.history_count) return NULL;
+   ui32 index = (g_timing.history_next + TIMING_HISTORY - 1 - frames_ago) % TIMING_HISTORY;
+   return g_timing.stage_history[index];
+}
+
+ui64 timing_get_target_frame_ns(void) {
+   return g_timing.target_frame_ns;
+}
+
+void timing_add_band_times(const ui32* band_us, ui32 count) {
+   SDL_AtomicLock(&g_timing_lock);
+   for (ui32 i = 0; i < count && g_timing.band_count < TIMING_MAX_BANDS; i++) {
+      g_timing.band_times[g_timing.band_count++] = band_us[i];
+   }
+   SDL_AtomicUnlock(&g_timing_lock);
+}
+
+const ui32* timing_get_band_times(ui32* count) {
+   if (count) *count = g_timing.band_count;
+   return g_timing.band_times;
+}
+
 void timing_get_performance_info(ui32* min_ms, ui32* max_ms, 
                                  ui32* avg_ms, ui32* frames_over) {
-   if (min_ms) *min_ms = g_timing.min_frame_time;
-   if (max_ms) *max_ms = g_timing.max_frame_time;
-   if (avg_ms) *avg_ms = g_timing.avg_frame_time;
-   if (frames_over) *frames_over = g_timing.frames_over_budget;
+   TimingStats stats;
+   timing_get_frame_stats(&stats);
+   if (min_ms) *min_ms = (ui32)stats.min_ms;
+   if (max_ms) *max_ms = (ui32)stats.max_ms;
+   if (avg_ms) *avg_ms = (ui32)stats.avg_ms;
+   if (frames_over) *frames_over = stats.frames_over;
+}
+
+void timing_get_frame_stats(TimingStats* stats) {
+   if (g_timing.stats_frame != g_timing.frame_count) update_stats();
+   *stats = g_timing.stats;
 }
 
 const TimingState* timing_get_debug_state(void) {
    return &g_timing;
-}
\ No newline at end of file
+}
+
+// INTERNAL
+static void update_stats(void) {
+   // everything but the percentiles once per frame at most. those need the
+   // history sorted, so they only move every TIMING_PERCENTILE_FRAMES
+   static ui64 sorted[TIMING_HISTORY];
+   TimingStats* stats = &g_timing.stats;
+   ui32 count = g_timing.history_count;
+   g_timing.stats_frame = g_timing.frame_count;
+
+   double p50_ms = stats->p50_ms, p95_ms = stats->p95_ms, p99_ms = stats->p99_ms;
+   memset(stats, 0, sizeof(TimingStats));
+   stats->frames_over = g_timing.frames_over_budget;
+   stats->samples = count;
+   stats->frames_missed = g_timing.frames_missed;
+   stats->pace_last_ms = ns_to_ms(g_timing.pace_last_ns);
+   stats->pace_max_ms = ns_to_ms(g_timing.pace_max_ns);
+   if (g_timing.pace_count > 0) stats->pace_avg_ms = ns_to_ms(g_timing.pace_total_ns) / g_timing.pace_count;
+   stats->sim_steps_last = g_timing.sim_steps_last;
+   stats->sim_steps_total = g_timing.sim_steps_total;
+   stats->sim_dropped_ms = ns_to_ms(g_timing.sim_dropped_ns);
+   if (count == 0) return;
+
+   stats->last_ms = ns_to_ms(g_timing.last_frame_ns);
+   stats->min_ms = ns_to_ms(g_timing.min_frame_ns);
+   stats->max_ms = ns_to_ms(g_timing.max_frame_ns);
+
+   ui64 total = 0;
+   for (ui32 i = 0; i < count; i++) total += g_timing.frame_history[i];
+   stats->avg_ms = ns_to_ms(total) / count;
+
+   if (g_timing.percentile_frame != UINT32_MAX &&
+       g_timing.frame_count - g_timing.percentile_frame < TIMING_PERCENTILE_FRAMES) {
+      stats->p50_ms = p50_ms;
+      stats->p95_ms = p95_ms;
+      stats->p99_ms = p99_ms;
+      return;
+   }
+   g_timing.percentile_frame = g_timing.frame_count;
+   memcpy(sorted, g_timing.frame_history, sizeof(ui64) * count);
+   qsort(sorted, count, sizeof(ui64), compare_ns);
+   stats->p50_ms = ns_to_ms(sorted[(count - 1) * 50 / 100]);
+   stats->p95_ms = ns_to_ms(sorted[(count - 1) * 95 / 100]);
+   stats->p99_ms = ns_to_ms(sorted[(count - 1) * 99 / 100]);
+}
+
+static void sleep_until(ui64 deadline) {
+   /* SDL_Delay only does whole ms and the OS can wake us late, so sleep   */
+   /* until spin_ns before the deadline and leave the rest to the spin. if */
+   /* a sleep still overshoots, wake up earlier from then on. once sleeps  */
+   /* are back on time, spin_ns eases back down to TIMING_SPIN_NS          */
+   ui64 now = timing_get_time_ns();
+   if (now >= deadline || deadline - now <= g_timing.spin_ns) return; // late already, don't wrap around
+   ui32 ms = (ui32)((deadline - now - g_timing.spin_ns) / TIMING_NS_PER_MS);
+   if (ms == 0) return;
+
+   SDL_Delay(ms);
+   ui64 woke = timing_get_time_ns();
+   ui64 expected = now + ms * TIMING_NS_PER_MS;
+   ui64 overshoot = (woke > expected) ? woke - expected : 0;
+   if (overshoot > g_timing.spin_ns && g_timing.spin_ns < TIMING_SPIN_MAX_NS) {
+      g_timing.spin_ns = (overshoot < TIMING_SPIN_MAX_NS) ? overshoot : TIMING_SPIN_MAX_NS;
+      d_logv(2, "frame limiter overslept by %.2f ms, spinning for %.2f ms now",
+             ns_to_ms(overshoot), ns_to_ms(g_timing.spin_ns));
+   } else if (overshoot <= g_timing.spin_ns && g_timing.spin_ns > TIMING_SPIN_NS) {
+      ui64 eased = g_timing.spin_ns - (g_timing.spin_ns - TIMING_SPIN_NS + TIMING_SPIN_DECAY - 1) / TIMING_SPIN_DECAY;
+      g_timing.spin_ns = (eased > overshoot) ? eased : overshoot;
+      if (g_timing.spin_ns == TIMING_SPIN_NS) d_logv(2, "frame limiter is back to spinning for %.2f ms", ns_to_ms(TIMING_SPIN_NS));
+   }
+}
+
+static ui64 snap_frame_time(ui64 elapsed) {
+   /* the limiter wakes a few us either side of the deadline. left alone,  */
+   /* that jitter makes a 60 hz frame with a 60 hz simulation run 0 steps  */
+   /* one frame and 2 the next, so anything close enough to a whole number */
+   /* of frames is rounded to it                                          */
+   ui64 target = g_timing.target_frame_ns;
+   ui64 frames = (elapsed + target / 2) / target;
+   if (frames == 0) return elapsed;
+   ui64 snapped = frames * target;
+   ui64 diff = (elapsed > snapped) ? elapsed - snapped : snapped - elapsed;
+   return (diff < TIMING_SNAP_NS) ? snapped : elapsed;
+}
+
+static int compare_ns(const void* a, const void* b) {
+   ui64 na = *(const ui64*)a;
+   ui64 nb = *(const ui64*)b;
+   return (na > nb) - (na < nb);
+}
+
+static double ns_to_ms(ui64 ns) {
+   return (double)ns / TIMING_NS_PER_MS;
+}
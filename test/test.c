@@ -0,0 +1,146 @@
+#include "timing.h"
+#include "renderer.h"
+#include "debug.h"
+#include "jobs.h"
+#include "loader.h"
+#include "profile.h"
+#include "test.h"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// runs every check in test/ against a headless renderer and exits non-zero
+// if any of them fails. the checks log what differs through d_err, the rest
+// of what they found shows up at -l 3
+
+extern int LOG_VERBOSITY;
+
+typedef struct {
+   const char* name;
+   bool (*run)(void);
+} TestCase;
+
+static const TestCase test_cases[] = {
+   { "composite kernels", test_composite_kernels },
+   { "composite bands",   test_composite_bands },
+   { "glyph atlas",       test_glyph_atlas },
+   { "sprite blit",       test_sprite_blit },
+   { "layer handles",     test_layer_handles },
+   { "draw list",         test_draw_list },
+   { "text cache",        test_text_cache },
+   { "sprite batch",      test_sprite_batch },
+};
+#define TEST_CASE_COUNT (sizeof(test_cases) / sizeof(test_cases[0]))
+
+static bool handle_flags(int argc, char* argv[], int* workers);
+
+// input.c and scene.c call back into the game
+void game_escape(uint32_t timer) { (void)timer; }
+void game_shutdown(void) {}
+
+int main(int argc, char* argv[]) {
+   int workers = JOBS_AUTO;
+   if (!handle_flags(argc, argv, &workers)) return 1;
+
+   if (SDL_Init(0) < 0) {
+      d_err("SDL could not initialize! SDL_Error: %s", SDL_GetError());
+      return 1;
+   }
+   timing_init(60);
+   if (!profile_init(NULL)) return 1;
+   if (!jobs_init(workers) || !loader_init(LOADER_THREADS) || !renderer_init(1.0f, true)) return 1;
+   file_wait_sheets(false); // sprites normally stream in behind the first frames
+   int threads = jobs_get_thread_count();
+
+   ui32 failed = 0;
+   for (ui32 i = 0; i < TEST_CASE_COUNT; i++) {
+      ui64 start_us = timing_get_time_us();
+      bool passed = test_cases[i].run();
+      printf("%-4s %-20s %8.1f ms\n", passed ? "ok" : "FAIL", test_cases[i].name,
+             (timing_get_time_us() - start_us) / 1000.0);
+      if (!passed) failed++;
+   }
+
+   renderer_cleanup();
+   loader_cleanup();
+   jobs_cleanup();
+   profile_cleanup();
+   SDL_Quit();
+
+   printf("test: %u of %u passed, %d threads\n", (ui32)TEST_CASE_COUNT - failed, (ui32)TEST_CASE_COUNT, threads);
+   return failed ? 1 : 0;
+}
+
+int test_diff_surfaces(const SDL_Surface* expected, const SDL_Surface* actual) {
+   // what every check compares its pixels with, the padding past w doesn't count
+   if (expected->w != actual->w || expected->h != actual->h ||
+       expected->format->BytesPerPixel != actual->format->BytesPerPixel) return 0;
+   size_t row_bytes = (size_t)expected->w * expected->format->BytesPerPixel;
+   for (int y = 0; y < expected->h; y++) {
+      if (memcmp((const ui8*)expected->pixels + y * expected->pitch,
+                 (const ui8*)actual->pixels + y * actual->pitch, row_bytes) != 0) return y;
+   }
+   return -1;
+}
+
+int test_diff_draws(TestDraw draw, void* user, const TestLayer* spec, int layer_count) {
+   bool was_recording = renderer_get_debug_state()->recording;
+   LayerHandle layers[2][TEST_MAX_LAYERS];
+   int row = -1;
+   if (layer_count > TEST_MAX_LAYERS) layer_count = TEST_MAX_LAYERS;
+
+   for (int v = 0; v < 2; v++) {
+      for (int l = 0; l < layer_count; l++) {
+         layers[v][l] = renderer_create_layer(spec[l].draw_outside);
+         if (layers[v][l] == INVALID_LAYER) row = 0;
+      }
+   }
+   if (row == 0) {
+      d_err("couldn't create the layers to draw on");
+      goto cleanup;
+   }
+
+   renderer_set_recording(false);
+   for (int v = 0; v < 2; v++) {
+      for (int l = 0; l < layer_count; l++) {
+         renderer_set_layer_size(layers[v][l], spec[l].size);
+         renderer_draw_fill(layers[v][l], PALETTE_TRANSPARENT);
+      }
+      draw(layers[v], v, user);
+      renderer_set_recording(false); // flushes anything the variant recorded
+   }
+   for (int l = 0; l < layer_count && row < 0; l++) {
+      row = test_diff_surfaces(renderer_get_layer_surface(layers[0][l]), renderer_get_layer_surface(layers[1][l]));
+   }
+
+cleanup:
+   renderer_set_recording(was_recording);
+   for (int v = 0; v < 2; v++) {
+      for (int l = 0; l < layer_count; l++) renderer_destroy_layer(layers[v][l]);
+   }
+   return row;
+}
+
+// INTERNAL
+static bool handle_flags(int argc, char* argv[], int* workers) {
+   for (int i = 1; i < argc; i++) {
+      if (argv[i][0] != '-') continue;
+      char flag = argv[i][1];
+      if (i + 1 >= argc) {
+         fprintf(stderr, "Missing value for -%c\n", flag);
+         return false;
+      }
+      switch (flag) {
+      case 'l':
+         LOG_VERBOSITY = atoi(argv[++i]);
+         break;
+      case 't':
+         *workers = atoi(argv[++i]);
+         break;
+      default:
+         fprintf(stderr, "Unknown flag: -%c\n", flag);
+         return false;
+      }
+   }
+   return true;
+}
@@ -0,0 +1,44 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "renderer.h"
+#include <stdbool.h>
+
+// checks bin/test runs one after the other on the same headless renderer.
+// each one leaves the renderer the way it found it, logs what differs
+// through d_err and returns false if anything did
+
+// test_renderer.c
+bool test_layer_handles(void); // stale handles are rejected after their slot is reused
+bool test_draw_list(void); // recorded (sorted, merged, culled) draws against immediate ones
+bool test_text_cache(void); // cached text runs against drawing glyph by glyph, and that the cap holds
+bool test_sprite_batch(void); // a submitted batch against drawing its sprites one at a time
+
+// test_sheets.c
+bool test_glyph_atlas(void); // baked glyph rows against sampling the font bitmap
+bool test_sprite_blit(void); // packed and dense sprite runs against sampling a freshly decoded sheet, and the name lookup
+
+// test_composite.c
+bool test_composite_kernels(void); // every supported kernel against SDL_BlitSurface/SDL_BlitScaled
+bool test_composite_bands(void);   // composite_run_bands() against the same rects done serially
+
+// test.c
+#define TEST_MAX_LAYERS 4
+
+typedef struct {
+   ui8 size;
+   bool draw_outside;
+} TestLayer;
+
+// draws one side of a comparison onto its layers. variant 0 is the expected
+// way of drawing, 1 the one under test. recording is off unless it turns it on
+typedef void (*TestDraw)(const LayerHandle* layers, int variant, void* user);
+
+int test_diff_surfaces(const SDL_Surface* expected, const SDL_Surface* actual); // first row that differs, -1 if they match
+
+/* runs draw() for both variants on fresh transparent layers made from spec, */
+/* then diffs them layer by layer. first row that differs, -1 if they all   */
+/* match, 0 if the layers couldn't be made. puts recording back after        */
+int test_diff_draws(TestDraw draw, void* user, const TestLayer* spec, int layer_count);
+
+#endif
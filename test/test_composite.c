@@ -0,0 +1,230 @@
+#include "test.h"
+#include "debug.h"
+#include "jobs.h"
+#include "timing.h"
+#include <stdlib.h>
+#include <string.h>
+
+// the compositing kernels and the banded compositor
+
+bool test_composite_kernels(void) {
+   /* compares each kernel to SDL's own colorkey/alpha-mod blit on a layer  */
+   /* with random indices and transparent runs, exact at opacity 255, +-1    */
+   /* when blending. also composite_scale() against SDL_BlitScaled 1x-6x and */
+   /* the fused flatten + scale against doing both. bin/bench -k 1 times them */
+   const RendererState* g_renderer = renderer_get_debug_state();
+   Uint32 format = g_renderer->composite_surface->format->format;
+   const ui8 opacities[] = { 255, 128, 37 };
+   CompositeKernel original = composite_get_kernel();
+   bool passed = true;
+
+   SDL_Surface* layer = SDL_CreateRGBSurface(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 8, 0, 0, 0, 0);
+   SDL_Surface* expected = SDL_CreateRGBSurfaceWithFormat(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 32, format);
+   SDL_Surface* actual = SDL_CreateRGBSurfaceWithFormat(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 32, format);
+   if (d_dne(layer) || d_dne(expected) || d_dne(actual)) {
+      passed = false;
+      goto cleanup;
+   }
+   SDL_SetPaletteColors(layer->format->palette, g_renderer->layers[g_renderer->draw_order[0]].surface->format->palette->colors, 0, PALETTE_SIZE);
+   SDL_SetColorKey(layer, SDL_TRUE, PALETTE_TRANSPARENT);
+
+   srand(1);
+   for (int y = 0; y < layer->h; y++) {
+      ui8* row = (ui8*)layer->pixels + y * layer->pitch;
+      for (int x = 0; x < layer->w; x++) {
+         // about half the layer is transparent, mostly in runs
+         row[x] = ((x / 24 + y / 16) % 3 == 0 || rand() % 8 == 0) ? PALETTE_TRANSPARENT : rand() % PALETTE_TRANSPARENT;
+      }
+   }
+
+   for (int k = 0; k < COMPOSITE_MAX; k++) {
+      if (!composite_set_kernel(k)) {
+         d_logv(3, "%s: not supported", d_name_composite_kernel(k));
+         continue;
+      }
+
+      for (ui32 o = 0; o < sizeof(opacities); o++) {
+         // odd offset and width so the simd tails get exercised
+         Rect src_rect = { 3, 5, layer->w - 10, layer->h - 9 };
+         Rect dest_rect = { 1, 2, src_rect.w, src_rect.h };
+         SDL_FillRect(expected, NULL, SDL_MapRGB(expected->format, 40, 90, 200));
+         SDL_FillRect(actual, NULL, SDL_MapRGB(actual->format, 40, 90, 200));
+         SDL_SetSurfaceAlphaMod(layer, opacities[o]);
+         SDL_BlitSurface(layer, &src_rect, expected, &dest_rect);
+         composite_blit(layer, src_rect, actual, 1, 2, opacities[o]);
+
+         int max_delta = 0;
+         for (int y = 0; y < actual->h; y++) {
+            ui8* e = (ui8*)expected->pixels + y * expected->pitch;
+            ui8* a = (ui8*)actual->pixels + y * actual->pitch;
+            for (int x = 0; x < actual->w * 4; x++) {
+               int delta = abs(e[x] - a[x]);
+               if (delta > max_delta) max_delta = delta;
+            }
+         }
+         if (max_delta > (opacities[o] == 255 ? 0 : 1)) {
+            d_err("%s: off by %d at opacity %u", d_name_composite_kernel(k), max_delta, opacities[o]);
+            passed = false;
+         }
+      }
+
+      {  // flatten has to match stacking the same layer with plain blits
+         CompositeSource sources[] = {
+            { .fill = { 0, 0, actual->w, actual->h }, .fill_index = 4 },
+            { .surface = layer, .x = 0, .y = 0 },
+            { .surface = layer, .x = 7, .y = -3 },
+            { .fill = { 100, 50, 33, 21 }, .fill_index = 11 },
+            { .surface = layer, .x = -13, .y = 9 },
+         };
+         Rect rect = { 5, 3, actual->w - 17, actual->h - 8 };
+         SDL_FillRect(expected, NULL, SDL_MapRGB(expected->format, 40, 90, 200));
+         SDL_FillRect(actual, NULL, SDL_MapRGB(actual->format, 40, 90, 200));
+         for (ui32 i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+            CompositeSource* source = &sources[i];
+            Rect fill;
+            if (!source->surface && SDL_IntersectRect(&source->fill, &rect, &fill)) {
+               SDL_FillRect(expected, &fill, SDL_MapRGBA(expected->format, palette[source->fill_index] >> 24,
+                                                         palette[source->fill_index] >> 16, palette[source->fill_index] >> 8, 255));
+            } else if (source->surface) {
+               Rect src_rect = { rect.x - source->x, rect.y - source->y, rect.w, rect.h };
+               composite_blit(source->surface, src_rect, expected, rect.x, rect.y, 255);
+            }
+         }
+         composite_flatten(sources, sizeof(sources) / sizeof(sources[0]), actual, rect);
+         int row = test_diff_surfaces(expected, actual);
+         if (row >= 0) {
+            d_err("%s: flatten differs on row %d", d_name_composite_kernel(k), row);
+            passed = false;
+         }
+      }
+   }
+
+   // upscaling the composite (actual still has the last flatten in it) vs SDL_BlitScaled
+   const float scales[] = { 1.0f, 2.0f, 2.5f, 3.0f, 4.0f, 5.0f, 6.0f };
+   CompositeKernel scale_kernels[] = { COMPOSITE_SCALAR, original };
+   for (ui32 i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+      int w = (int)(actual->w * scales[i]);
+      int h = (int)(actual->h * scales[i]);
+      SDL_Surface* sdl_scaled = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, format);
+      SDL_Surface* scaled = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, format);
+      if (d_dne(sdl_scaled) || d_dne(scaled)) {
+         if (sdl_scaled) SDL_FreeSurface(sdl_scaled);
+         if (scaled) SDL_FreeSurface(scaled);
+         passed = false;
+         break;
+      }
+
+      // only whole number scales have to match SDL, its fractional stepping is its own thing
+      if (scales[i] == (int)scales[i]) SDL_BlitScaled(actual, NULL, sdl_scaled, NULL);
+      for (ui32 k = 0; k < 2 && scales[i] == (int)scales[i]; k++) {
+         composite_set_kernel(scale_kernels[k]);
+         composite_scale(actual, scaled, (Rect){ 0, 0, w, h });
+         int row = test_diff_surfaces(sdl_scaled, scaled);
+         if (row >= 0) {
+            d_err("%s: scale x%.1f differs on row %d", d_name_composite_kernel(scale_kernels[k]), scales[i], row);
+            passed = false;
+         }
+      }
+
+      // fused flatten + scale has to match doing them one after the other
+      CompositeSource sources[] = {
+         { .fill = { 0, 0, actual->w, actual->h }, .fill_index = 4 },
+         { .surface = layer }, { .surface = layer, .x = 5, .y = 3 }, { .surface = layer, .x = -9 }, { .surface = layer, .y = 11 }
+      };
+      int source_count = sizeof(sources) / sizeof(sources[0]);
+      composite_set_kernel(original);
+      composite_flatten(sources, source_count, actual, (Rect){ 0, 0, actual->w, actual->h });
+      composite_scale(actual, sdl_scaled, (Rect){ 0, 0, w, h });
+      composite_flatten_scaled(sources, source_count, actual->w, actual->h, scaled, (Rect){ 0, 0, w, h });
+      int row = test_diff_surfaces(sdl_scaled, scaled);
+      if (row >= 0) {
+         d_err("%s: fused scale x%.1f differs on row %d", d_name_composite_kernel(original), scales[i], row);
+         passed = false;
+      }
+
+      SDL_FreeSurface(sdl_scaled);
+      SDL_FreeSurface(scaled);
+   }
+
+cleanup:
+   composite_set_kernel(original);
+   if (layer) SDL_FreeSurface(layer);
+   if (expected) SDL_FreeSurface(expected);
+   if (actual) SDL_FreeSurface(actual);
+   return passed;
+}
+
+typedef struct {
+   CompositeSource* sources;
+   int count;
+   SDL_Surface* layer;
+   SDL_Surface* dst;
+} BandTest;
+
+static void bantest_func(Rect rect, void* data) {
+   // flatten then blend a translucent layer on top, like composite_rect()
+   BandTest* test = data;
+   composite_flatten(test->sources, test->count, test->dst, rect);
+   composite_blit(test->layer, (Rect){ rect.x - 3, rect.y - 7, rect.w, rect.h }, test->dst, rect.x, rect.y, 100);
+}
+
+bool test_composite_bands(void) {
+   /* banded compositing has to be bit-identical to doing the same rects   */
+   /* one after the other on the main thread, overlapping rects included   */
+   const RendererState* g_renderer = renderer_get_debug_state();
+   Uint32 format = g_renderer->composite_surface->format->format;
+   bool passed = true;
+
+   SDL_Surface* layer = SDL_CreateRGBSurface(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 8, 0, 0, 0, 0);
+   SDL_Surface* serial = SDL_CreateRGBSurfaceWithFormat(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 32, format);
+   SDL_Surface* banded = SDL_CreateRGBSurfaceWithFormat(0, GAME_WIDTH_FWVGA, GAME_HEIGHT_FWVGA, 32, format);
+   if (d_dne(layer) || d_dne(serial) || d_dne(banded)) {
+      passed = false;
+      goto cleanup;
+   }
+   srand(2);
+   for (int y = 0; y < layer->h; y++) {
+      ui8* row = (ui8*)layer->pixels + y * layer->pitch;
+      for (int x = 0; x < layer->w; x++) {
+         row[x] = ((x / 40 + y / 12) % 2 == 0 || rand() % 5 == 0) ? PALETTE_TRANSPARENT : rand() % PALETTE_TRANSPARENT;
+      }
+   }
+
+   CompositeSource sources[] = {
+      { .fill = { 0, 0, serial->w, serial->h }, .fill_index = 4 },
+      { .surface = layer }, { .surface = layer, .x = 11, .y = -5 }, { .fill = { 60, 200, 300, 45 }, .fill_index = 23 }
+   };
+   const Rect rects[] = {
+      { 0, 0, 854, 480 }, { 20, 30, 400, 300 }, { 200, 100, 500, 41 }, { 600, 400, 254, 80 }, { 5, 470, 33, 10 }
+   };
+   int rect_count = sizeof(rects) / sizeof(rects[0]);
+   BandTest test = { sources, sizeof(sources) / sizeof(sources[0]), layer, serial };
+
+   for (int n = 1; n <= rect_count; n++) {
+      SDL_FillRect(serial, NULL, 0);
+      SDL_FillRect(banded, NULL, 0);
+      test.dst = serial;
+      for (int i = 0; i < n; i++) bantest_func(rects[i], &test);
+      test.dst = banded;
+      composite_run_bands(rects, n, bantest_func, &test);
+
+      int row = test_diff_surfaces(serial, banded);
+      if (row >= 0) {
+         d_err("banded composite differs on row %d with %d rects", row, n);
+         passed = false;
+      }
+   }
+
+   ui32 band_count = 0;
+   const ui32* band_times = timing_get_band_times(&band_count);
+   ui32 total = 0;
+   for (ui32 i = 0; i < band_count; i++) total += band_times[i];
+   d_logv(3, "banded composite: %d threads, %u bands in %u us", jobs_get_thread_count(), band_count, total);
+
+cleanup:
+   if (layer) SDL_FreeSurface(layer);
+   if (serial) SDL_FreeSurface(serial);
+   if (banded) SDL_FreeSurface(banded);
+   return passed;
+}
+
@@ -0,0 +1,217 @@
+#include "test.h"
+#include "debug.h"
+#include <stdio.h>
+
+// layers, the draw list, the text cache and sprite batches
+
+bool test_layer_handles(void) {
+   /* a destroyed layer's handle has to stop working even once its slot is reused */
+   LayerHandle first = renderer_create_layer(false);
+   LayerHandle second = renderer_create_layer(true);
+   renderer_destroy_layer(first);
+   LayerHandle reused = renderer_create_layer(false);
+   bool passed = true;
+
+   if (first == INVALID_LAYER || second == INVALID_LAYER || reused == INVALID_LAYER) {
+      d_err("couldn't create test layers");
+      passed = false;
+   } else if (LAYER_HANDLE_SLOT(reused) != LAYER_HANDLE_SLOT(first) || reused == first) {
+      d_err("freed slot %u wasn't reused with a new generation", LAYER_HANDLE_SLOT(first));
+      passed = false;
+   } else if (renderer_get_layer_surface(first) || !renderer_get_layer_surface(reused) || !renderer_get_layer_surface(second)) {
+      d_err("stale handle %u still resolves", first);
+      passed = false;
+   }
+   d_logv(3, "layer handles: %u -> %u in slot %u", first, reused, LAYER_HANDLE_SLOT(reused));
+
+   renderer_destroy_layer(second);
+   renderer_destroy_layer(reused);
+   return passed;
+}
+
+static void draw_list_test_script(const LayerHandle* layers, int variant, void* user) {
+   // variant 1 records the same draws, they get sorted, merged and culled on the flush
+   LayerHandle handle = layers[0];
+   if (variant == 1) renderer_set_recording(true);
+   renderer_draw_fill(handle, 12);
+   renderer_draw_rect(handle, (Rect){ 10, 10, 40, 20 }, 5);
+   renderer_draw_rect(handle, (Rect){ 50, 10, 40, 20 }, 5);     // merges with the one before
+   renderer_draw_rect(handle, (Rect){ 100, 100, 20, 20 }, 7);   // covered by the next one
+   renderer_draw_rect(handle, (Rect){ 90, 90, 60, 60 }, 8);
+   renderer_draw_string(handle, FONT_ACER_8_8, "hello there", 20, 60, 3);
+   renderer_draw_char(handle, FONT_ACER_8_8, 'q', 95, 95, 0);  // glyphs don't cover anything
+   renderer_draw_pixel(handle, 5, 5, 9);
+   renderer_draw_rect(handle, (Rect){ 300, 201, 31, 17 }, 11);  // gets aligned down
+   renderer_draw_rect(handle, (Rect){ -20, -20, 50, 50 }, 14);  // partly off the layer
+   renderer_draw_string(handle, FONT_ACER_8_8, "offscreen", -100, -100, 3);
+   renderer_draw_sprite(handle, renderer_get_sprite("guy-run"), 3, 150, 20, SPRITE_FLIP_X); // has holes too
+   renderer_draw_rect(handle, (Rect){ 200, 100, 30, 30 }, 16);  // over the sprite
+   if (variant == 1) *(ui32*)user = renderer_get_debug_state()->draw_list.count;
+}
+
+bool test_draw_list(void) {
+   /* same draws into two fresh layers, one straight away and one recorded, */
+   /* then the pixels have to match exactly                                */
+   const DrawList* list = &renderer_get_debug_state()->draw_list;
+   bool passed = true;
+
+   ui32 count = 0;
+   int row = test_diff_draws(draw_list_test_script, &count, &(TestLayer){ 2, false }, 1);
+   d_logv(3, "draw list: %u commands, %u merged, %u culled", count, list->last_merged, list->last_culled);
+   if (list->last_count != count || list->last_merged == 0 || list->last_culled == 0) {
+      d_err("draw list didn't merge or cull anything");
+      passed = false;
+   }
+   if (row >= 0) {
+      d_err("recorded draws differ on row %d", row);
+      passed = false;
+   }
+   return passed;
+}
+
+static void text_cache_test_script(const LayerHandle* layers, int variant, void* user) {
+   // the repeats hit the cache, the rest is clipped or misaligned somehow.
+   // variant 0 has nothing fit in the cache, so every run goes glyph by glyph
+   const char* strings[] = { "settings", "  back  ", "fps: 60.00", "a\tb~c", "settings" };
+   int w, h;
+   renderer_get_dims(&w, &h);
+   const int positions[][2] = { { 4, 4 }, { 33, 17 }, { 4, 4 }, { -6, 40 }, { -8, 60 },
+                                { w - 30, 80 }, { 50, h - 3 }, { 50, -5 } };
+   if (variant == 0) renderer_set_text_cache_bytes(0);
+   for (int p = 0; p < 8; p++) {
+      for (int s = 0; s < 5; s++) {
+         renderer_draw_string(layers[0], FONT_ACER_8_8, strings[s], positions[p][0], positions[p][1] + s * 9, (ui8)(3 + s % 2));
+      }
+   }
+   renderer_draw_string(layers[0], FONT_COMPIS_8_16, "settings", 100, 100, 3); // same text, other font
+   if (variant == 0) renderer_set_text_cache_bytes(*(const size_t*)user);
+}
+
+static void text_cache_evict_script(const LayerHandle* layers, int variant, void* user) {
+   // more runs than a small cap holds, keeping track of how big the cache got
+   size_t* peak = user;
+   const TextCache* cache = &renderer_get_debug_state()->text_cache;
+   renderer_set_text_cache_bytes(variant == 0 ? 0 : 4096);
+   char text[16];
+   for (int i = 0; i < 64; i++) {
+      snprintf(text, sizeof(text), "run %d", i);
+      renderer_draw_string(layers[0], FONT_ACER_8_8, text, 8, 8 + (i % 16) * 9, 5);
+      if (cache->bytes > *peak) *peak = cache->bytes;
+   }
+}
+
+bool test_text_cache(void) {
+   /* the same strings with the cache on and off have to land on the same */
+   /* pixels, and a small cap has to evict instead of growing past it     */
+   const TextCache* cache = &renderer_get_debug_state()->text_cache;
+   size_t max_bytes = cache->max_bytes;
+   ui32 hits = cache->hits, evictions = cache->evictions;
+   bool passed = true;
+
+   for (int size = 1; size <= 3 && passed; size++) {
+      for (int outside = 0; outside < 2 && passed; outside++) {
+         int row = test_diff_draws(text_cache_test_script, &max_bytes, &(TestLayer){ (ui8)size, outside }, 1);
+         if (row >= 0) {
+            d_err("cached text at size %d differs on row %d", size, row);
+            passed = false;
+         }
+      }
+   }
+   if (passed && cache->hits == hits) {
+      d_err("text cache never hit");
+      passed = false;
+   }
+
+   size_t peak = 0;
+   int row = test_diff_draws(text_cache_evict_script, &peak, &(TestLayer){ 2, false }, 1);
+   if (passed && row >= 0) {
+      d_err("text through a full cache differs on row %d", row);
+      passed = false;
+   }
+   if (passed && peak > cache->max_bytes) {
+      d_err("text cache grew to %zu bytes past its %zu cap", peak, cache->max_bytes);
+      passed = false;
+   }
+   if (passed && cache->evictions == evictions) {
+      d_err("text cache never evicted");
+      passed = false;
+   }
+   d_logv(3, "text cache: %u hits, %u misses, %u evictions", cache->hits, cache->misses, cache->evictions);
+
+   renderer_set_text_cache_bytes(0);
+   renderer_set_text_cache_bytes(max_bytes);
+   return passed;
+}
+
+#define SPRITE_BATCH_TEST_COUNT 400
+
+static struct {
+   int sheet, layer, frame, x, y;
+   ui8 flags;
+} batch_sprites[SPRITE_BATCH_TEST_COUNT];
+
+static void sprite_batch_test_script(const LayerHandle* layers, int variant, void* user) {
+   // variant 1 pushes them all as one batch, 0 draws them one at a time in
+   // the order the batch ends up in: by layer, then sheet, then push order
+   const SpriteArray* sprite_array = user;
+   if (variant == 1) {
+      renderer_begin_sprites();
+      for (int i = 0; i < SPRITE_BATCH_TEST_COUNT; i++) {
+         const Sprite* sprite = &sprite_array->sprites[batch_sprites[i].sheet];
+         int frame = sprite->frame_count ? batch_sprites[i].frame % sprite->frame_count : 0;
+         renderer_push_sprite(layers[batch_sprites[i].layer], sprite, frame, batch_sprites[i].x, batch_sprites[i].y, batch_sprites[i].flags);
+      }
+      renderer_submit_sprites();
+      return;
+   }
+   for (int l = 0; l < 2; l++) {
+      for (int s = 0; s < sprite_array->sprite_count; s++) {
+         for (int i = 0; i < SPRITE_BATCH_TEST_COUNT; i++) {
+            if (batch_sprites[i].layer != l || batch_sprites[i].sheet != s) continue;
+            const Sprite* sprite = &sprite_array->sprites[s];
+            int frame = sprite->frame_count ? batch_sprites[i].frame % sprite->frame_count : 0;
+            renderer_draw_sprite(layers[l], sprite, frame, batch_sprites[i].x, batch_sprites[i].y, batch_sprites[i].flags);
+         }
+      }
+   }
+}
+
+bool test_sprite_batch(void) {
+   /* sprites spread over two layers (some off screen) pushed as one batch, */
+   /* against the same sprites drawn one at a time                          */
+   const RendererState* g_renderer = renderer_get_debug_state();
+   const SpriteArray* sprite_array = &g_renderer->sprite_array;
+   bool passed = true;
+   if (sprite_array->sprite_count == 0) {
+      d_err("no sprites loaded to batch");
+      return false;
+   }
+
+   int w, h;
+   renderer_get_dims(&w, &h);
+   ui32 seed = 12345;
+   for (int i = 0; i < SPRITE_BATCH_TEST_COUNT; i++) {
+      seed = seed * 1664525u + 1013904223u;
+      batch_sprites[i].sheet = (int)((seed >> 8) % sprite_array->sprite_count);
+      batch_sprites[i].layer = (int)((seed >> 4) & 1);
+      batch_sprites[i].frame = i;
+      batch_sprites[i].x = (int)((seed >> 12) % (ui32)(w + 600)) - 300;
+      seed = seed * 1664525u + 1013904223u;
+      batch_sprites[i].y = (int)((seed >> 12) % (ui32)(h + 600)) - 300;
+      batch_sprites[i].flags = (ui8)(i % 4);
+   }
+
+   const TestLayer spec[] = { { 1, false }, { 2, true } };
+   int row = test_diff_draws(sprite_batch_test_script, (void*)sprite_array, spec, 2);
+   const SpriteBatch* batch = &g_renderer->sprite_batch;
+   d_logv(3, "sprite batch: %u sprites on %u layers, %u culled", batch->last_count, batch->last_layers, batch->last_culled);
+   if (batch->last_count != SPRITE_BATCH_TEST_COUNT || batch->last_layers != 2 || batch->last_culled == 0) {
+      d_err("sprite batch didn't draw on both layers or cull anything");
+      passed = false;
+   }
+   if (row >= 0) {
+      d_err("batched sprites differ on row %d", row);
+      passed = false;
+   }
+   return passed;
+}
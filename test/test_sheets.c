@@ -0,0 +1,118 @@
+#include "test.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// what file.c bakes out of the sheets: glyph rows and sprite runs
+
+static void glyph_atlas_test_script(const LayerHandle* layers, int variant, void* user) {
+   // variant 0 samples the font bitmap, 1 goes through the baked rows
+   Font* font = user;
+   char text[128];
+   int length = 0;
+   for (int c = 33; c < 127; c++) text[length++] = (char)c;
+   text[length] = '\0';
+   int w, h;
+   renderer_get_dims(&w, &h);
+   const int positions[][2] = { { 3, 5 }, { -7, -3 }, { w - 300, h - 5 }, { -400, 200 }, { w / 3, h / 2 } };
+
+   uint16_t* glyph_rows = font->glyph_rows;
+   if (variant == 0) font->glyph_rows = NULL;
+   for (int i = 0; i < 5; i++) renderer_draw_string(layers[0], font->type, text, positions[i][0], positions[i][1], 7);
+   font->glyph_rows = glyph_rows;
+}
+
+bool test_glyph_atlas(void) {
+   /* every glyph of every font through the baked rows and through the bitmap */
+   /* fallback, at a few sizes and hanging off each edge, has to match        */
+   const RendererState* g_renderer = renderer_get_debug_state();
+   FontArray* font_array = (FontArray*)&g_renderer->font_array; // glyph_rows gets swapped out in the script
+   bool passed = true;
+
+   for (int f = 0; f < FONT_MAX && passed; f++) {
+      Font* font = file_get_font(font_array, f);
+      if (!font || !font->glyph_rows) continue;
+      for (int size = 1; size <= 3 && passed; size++) {
+         for (int outside = 0; outside < 2 && passed; outside++) {
+            int row = test_diff_draws(glyph_atlas_test_script, font, &(TestLayer){ (ui8)size, outside }, 1);
+            if (row >= 0) {
+               d_err("%s at size %d differs on row %d", d_name_font(f), size, row);
+               passed = false;
+            }
+         }
+      }
+   }
+   return passed;
+}
+
+static void sprite_blit_test_script(const LayerHandle* layers, int variant, void* user) {
+   // every flip at each spot, some of them hanging off an edge. variant 0
+   // samples the sheet, 1 draws from whichever runs the sprite was left with
+   Sprite* sprite = user;
+   int w, h;
+   renderer_get_dims(&w, &h);
+   const int positions[][2] = { { 3, 5 }, { -37, -21 }, { w - 50, h - 40 }, { w / 3, h / 2 } };
+
+   SpriteRow* rows = sprite->rows;
+   if (variant == 0) sprite->rows = NULL;
+   for (int i = 0; i < 16; i++) {
+      renderer_draw_sprite(layers[0], sprite, (i * 5) % sprite->frame_count, positions[i % 4][0], positions[i % 4][1], (ui8)(i / 4));
+   }
+   sprite->rows = rows;
+}
+
+bool test_sprite_blit(void) {
+   /* frames drawn from the packed runs, from runs over the dense sheet and */
+   /* by sampling the sheet, every flip, a few sizes and hanging off each   */
+   /* edge, have to match. and every sprite has to come back from its name  */
+   const RendererState* g_renderer = renderer_get_debug_state();
+   SpriteArray* sprite_array = (SpriteArray*)&g_renderer->sprite_array; // runs get swapped out below
+   const char* variants[] = { "packed runs", "dense runs" };
+   bool passed = true;
+
+   for (int s = 0; s < sprite_array->sprite_count && passed; s++) {
+      Sprite* sprite = &sprite_array->sprites[s];
+      if (sprite->frame_count == 0) continue;
+      if (renderer_get_sprite(sprite->name) != sprite) {
+         d_err("%s doesn't come back from its name", sprite->fname);
+         passed = false;
+      }
+      if (!sprite->rows) continue; // sampled either way, nothing to compare
+
+      // loaded sprites don't keep their sheet with SPRITE_RLE, so the dense
+      // runs and the sampling get a fresh one straight from the bitmap
+      char path[512];
+      snprintf(path, sizeof(path), "%s%s", DIR_SHEETS, sprite->fname);
+      ImageData* sheet = file_load_bitmap(path);
+      if (!sheet) {
+         d_err("couldn't decode %s to check %s against", path, sprite->name);
+         passed = false;
+         break;
+      }
+      ImageData* data = sprite->data;
+      sprite->data = sheet;
+      uint8_t* pixels = sprite->pixels;
+
+      for (int v = 0; v < 2 && passed; v++) {
+         if (v == 0 && !pixels) continue; // SPRITE_RLE 0
+         sprite->pixels = (v == 0) ? pixels : NULL;
+         for (int size = 1; size <= 3 && passed; size++) {
+            for (int outside = 0; outside < 2 && passed; outside++) {
+               int row = test_diff_draws(sprite_blit_test_script, sprite, &(TestLayer){ (ui8)size, outside }, 1);
+               if (row >= 0) {
+                  d_err("%s from %s at size %d differs on row %d", sprite->fname, variants[v], size, row);
+                  passed = false;
+               }
+            }
+         }
+         sprite->pixels = pixels;
+      }
+      sprite->data = data;
+      free(sheet);
+   }
+   if (renderer_get_sprite("not-a-sprite")) {
+      d_err("a sprite came back for a name nothing has");
+      passed = false;
+   }
+   return passed;
+}
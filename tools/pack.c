@@ -0,0 +1,187 @@
+#include "bundle.h"
+#include "file.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+   #include <windows.h>
+#else
+   #include <dirent.h>
+#endif
+
+// packs every sheet in a directory into one bundle (see bundle.h), so the
+// game can skip the directory scan, filename parsing and bitmap decoding.
+// make bundle runs it whenever a sheet changes
+//
+// pack [-d sheet_dir] [-o bundle_path] [-l verbosity]
+
+extern int LOG_VERBOSITY;
+
+#define PACK_MAX_SHEETS 1024
+
+typedef struct {
+   char fname[BUNDLE_NAME_MAX];
+   char name[BUNDLE_NAME_MAX];
+} PackName;
+
+static bool handle_flags(int argc, char* argv[], const char** sheet_dir, const char** bundle_path);
+static int list_sheets(const char* sheet_dir, char names[][BUNDLE_NAME_MAX], int max);
+static bool add_sheet(const char* sheet_dir, const char* fname, BundleSource* source, PackName* strings);
+static int compare_names(const void* a, const void* b);
+
+// file.c and the rest of the engine call back into the game
+void game_escape(uint32_t timer) { (void)timer; }
+void game_shutdown(void) { }
+
+int main(int argc, char* argv[]) {
+   const char* sheet_dir = DIR_SHEETS;
+   const char* bundle_path = BUNDLE_PATH;
+   if (!handle_flags(argc, argv, &sheet_dir, &bundle_path)) return 1;
+
+   static char names[PACK_MAX_SHEETS][BUNDLE_NAME_MAX];
+   int name_count = list_sheets(sheet_dir, names, PACK_MAX_SHEETS);
+   if (name_count < 0) return 1;
+   qsort(names, name_count, BUNDLE_NAME_MAX, compare_names); // same bundle whatever order the directory lists in
+
+   BundleSource* sources = calloc(name_count > 0 ? name_count : 1, sizeof(BundleSource));
+   PackName* strings = calloc(name_count > 0 ? name_count : 1, sizeof(PackName));
+   if (d_dne(sources) || d_dne(strings)) return 1;
+
+   ui32 count = 0;
+   size_t pixel_bytes = 0;
+   for (int i = 0; i < name_count; i++) {
+      if (!add_sheet(sheet_dir, names[i], &sources[count], &strings[count])) continue;
+      pixel_bytes += sources[count].image->size;
+      count++;
+   }
+
+   bool written = bundle_write(bundle_path, sources, count);
+   if (written) {
+      printf("pack: %u sheets (%zu bytes of pixels) -> %s\n", count, pixel_bytes, bundle_path);
+   }
+   for (ui32 i = 0; i < count; i++) free((ImageData*)sources[i].image);
+   free(sources);
+   free(strings);
+   return written ? 0 : 1;
+}
+
+// INTERNAL
+static bool handle_flags(int argc, char* argv[], const char** sheet_dir, const char** bundle_path) {
+   for (int i = 1; i < argc; i++) {
+      if (argv[i][0] != '-') continue;
+      char flag = argv[i][1];
+      if (i + 1 >= argc) {
+         fprintf(stderr, "Missing value for -%c\n", flag);
+         return false;
+      }
+      switch (flag) {
+      case 'd':
+         *sheet_dir = argv[++i]; // with the trailing slash
+         break;
+      case 'o':
+         *bundle_path = argv[++i];
+         break;
+      case 'l':
+         LOG_VERBOSITY = atoi(argv[++i]);
+         break;
+      default:
+         fprintf(stderr, "Unknown flag: -%c\n", flag);
+         return false;
+      }
+   }
+   return true;
+}
+
+static int list_sheets(const char* sheet_dir, char names[][BUNDLE_NAME_MAX], int max) {
+   int count = 0;
+#ifdef _WIN32
+   WIN32_FIND_DATA find_data;
+   char search_path[512];
+   snprintf(search_path, sizeof(search_path), "%s*.bmp", sheet_dir);
+   HANDLE find_handle = FindFirstFile(search_path, &find_data);
+   if (find_handle == INVALID_HANDLE_VALUE) {
+      d_err("no bitmap files found in %s", sheet_dir);
+      return -1;
+   }
+   do {
+      const char* fname = find_data.cFileName;
+#else
+   DIR* dir = opendir(sheet_dir);
+   if (!dir) {
+      d_err("could not open directory: %s", sheet_dir);
+      return -1;
+   }
+   struct dirent* entry;
+   while ((entry = readdir(dir)) != NULL) {
+      const char* fname = entry->d_name;
+#endif
+      size_t length = strlen(fname);
+#ifdef _WIN32
+      if (length < 4 || _stricmp(fname + length - 4, ".bmp") != 0) continue;
+#else
+      if (length < 4 || strcasecmp(fname + length - 4, ".bmp") != 0) continue;
+#endif
+      if (length >= BUNDLE_NAME_MAX) {
+         d_err("%s: name is too long for a bundle, skipping it", fname);
+         continue;
+      }
+      if (count == max) {
+         d_err("more than %d sheets, the rest are left out", max);
+         break;
+      }
+      strcpy(names[count++], fname);
+#ifdef _WIN32
+   } while (FindNextFile(find_handle, &find_data));
+   FindClose(find_handle);
+#else
+   }
+   closedir(dir);
+#endif
+   return count;
+}
+
+static bool add_sheet(const char* sheet_dir, const char* fname, BundleSource* source, PackName* strings) {
+   // same rules file_load_sheets() uses for loose bitmaps
+   char type[64], name[128];
+   int tile_w, tile_h;
+   if (!file_parse_sheet_filename(fname, type, name, &tile_w, &tile_h) || tile_w <= 0 || tile_h <= 0) {
+      d_log("couldn't parse filename: %s", fname);
+      return false;
+   }
+   BundleType bundle_type;
+   if (strcmp(type, "font") == 0) bundle_type = BUNDLE_FONT;
+   else if (strcmp(type, "sprite") == 0) bundle_type = BUNDLE_SPRITE;
+   else {
+      d_log("unknown resource type '%s' in file %s", type, fname);
+      return false;
+   }
+   if (strlen(name) >= BUNDLE_NAME_MAX) {
+      d_err("%s: name is too long for a bundle, skipping it", fname);
+      return false;
+   }
+
+   char path[512];
+   snprintf(path, sizeof(path), "%s%s", sheet_dir, fname);
+   ImageData* image = file_load_bitmap(path);
+   if (!image) return false;
+   if (image->width % tile_w != 0 || image->height % tile_h != 0) {
+      d_log("WARNING: %s has partial tiles", fname);
+   }
+
+   strcpy(strings->fname, fname);
+   strcpy(strings->name, name);
+   source->fname = strings->fname;
+   source->name = strings->name;
+   source->type = bundle_type;
+   source->tile_w = tile_w;
+   source->tile_h = tile_h;
+   source->image = image;
+   d_logv(2, "%s: %s %dx%d, %dx%d tiles", fname, type, image->width, image->height, tile_w, tile_h);
+   return true;
+}
+
+static int compare_names(const void* a, const void* b) {
+   return strcmp((const char*)a, (const char*)b);
+}